@@ -0,0 +1,206 @@
+#include "BenchCommon.h"
+#include "UserInput.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+// Allocation counters. Physics worker threads and the simulation thread
+// allocate too, so these are only ever touched atomically. We use the GCC
+// builtins (which clang has as well) rather than a lock, since operator new
+// can run before any static lock has been constructed.
+static unsigned long sAllocationCount = 0;
+static unsigned long sAllocationBytes = 0;
+
+static void
+CountAllocation(size_t size)
+{
+    __sync_fetch_and_add(&sAllocationCount, 1);
+    __sync_fetch_and_add(&sAllocationBytes, size);
+}
+
+/*
+ * Global allocation hooks. These replace the ones in the standard library
+ * for any executable that links us in. Every replaceable operator new is
+ * hooked, so nothing gets past the counters.
+ */
+
+void*
+operator new(size_t size)
+{
+    CountAllocation(size);
+    void* p = malloc(size ? size : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void*
+operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void*
+operator new(size_t size, const std::nothrow_t&) throw()
+{
+    CountAllocation(size);
+    return malloc(size ? size : 1);
+}
+
+void*
+operator new[](size_t size, const std::nothrow_t& nothrow) throw()
+{
+    return operator new(size, nothrow);
+}
+
+void
+operator delete(void* p) throw()
+{
+    free(p);
+}
+
+void
+operator delete[](void* p) throw()
+{
+    free(p);
+}
+
+void
+operator delete(void* p, const std::nothrow_t&) throw()
+{
+    free(p);
+}
+
+void
+operator delete[](void* p, const std::nothrow_t&) throw()
+{
+    free(p);
+}
+
+// Over-aligned allocations only exist as of C++17. The sized deletes that
+// came in with C++14 fall back on the ones above by default.
+#if __cplusplus >= 201703L
+
+void*
+operator new(size_t size, std::align_val_t alignment)
+{
+    CountAllocation(size);
+    void* p = NULL;
+    size_t align = (size_t) alignment;
+    if (align < sizeof(void*))
+        align = sizeof(void*);
+    if (posix_memalign(&p, align, size ? size : 1))
+        throw std::bad_alloc();
+    return p;
+}
+
+void*
+operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void*
+operator new(size_t size, std::align_val_t alignment,
+             const std::nothrow_t&) noexcept
+{
+    CountAllocation(size);
+    void* p = NULL;
+    size_t align = (size_t) alignment;
+    if (align < sizeof(void*))
+        align = sizeof(void*);
+    if (posix_memalign(&p, align, size ? size : 1))
+        return NULL;
+    return p;
+}
+
+void*
+operator new[](size_t size, std::align_val_t alignment,
+               const std::nothrow_t& nothrow) noexcept
+{
+    return operator new(size, alignment, nothrow);
+}
+
+void
+operator delete(void* p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void
+operator delete[](void* p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void
+operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void
+operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+#endif /* __cplusplus >= 201703L */
+
+unsigned long
+GetAllocationCount()
+{
+    return __sync_fetch_and_add(&sAllocationCount, 0);
+}
+
+unsigned long
+GetAllocationBytes()
+{
+    return __sync_fetch_and_add(&sAllocationBytes, 0);
+}
+
+int
+GetBenchOption(int argc, char** argv, const char* flag, int defaultValue)
+{
+    for (int i = 0; i < argc - 1; ++i)
+        if (!strcmp(argv[i], flag))
+            return atoi(argv[i + 1]);
+
+    return defaultValue;
+}
+
+const char*
+GetBenchString(int argc, char** argv, const char* flag,
+               const char* defaultValue)
+{
+    for (int i = 0; i < argc - 1; ++i)
+        if (!strcmp(argv[i], flag))
+            return argv[i + 1];
+
+    return defaultValue;
+}
+
+const unsigned gBenchDirections[BENCH_NUM_DIRECTIONS] = {
+    USERINPUT_INDEX_UP, USERINPUT_INDEX_RIGHT,
+    USERINPUT_INDEX_DOWN, USERINPUT_INDEX_LEFT
+};
+
+uint32_t
+GetScriptedInput(unsigned playerID, unsigned tick)
+{
+    // Vary the period and phase by player
+    unsigned period = 16 + 2 * (playerID % 8);
+    unsigned phase = tick + 3 * playerID;
+    unsigned direction =
+        gBenchDirections[(phase / period) % BENCH_NUM_DIRECTIONS];
+
+    // Press at the start of the period
+    if (phase % period == 0)
+        return GEN_INPUT_MASK(direction, true);
+
+    // Let go halfway through, as long as we pressed it in the first place
+    if (phase % period == period / 2 && tick >= period / 2)
+        return GEN_INPUT_MASK(direction, false);
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef BENCHCOMMON_H
+#define BENCHCOMMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Shared helpers for the benchmark executables.
+ */
+
+/*
+ * Gets the number of heap allocations made so far, on any thread. Linking
+ * BenchCommon.o replaces the global operator new to keep count.
+ */
+unsigned long GetAllocationCount();
+
+/*
+ * Gets the number of bytes allocated on the heap so far.
+ */
+unsigned long GetAllocationBytes();
+
+/*
+ * Gets the integer value of a command line flag, or the default if the
+ * flag isn't there.
+ */
+int GetBenchOption(int argc, char** argv, const char* flag, int defaultValue);
+
+/*
+ * Gets the string value of a command line flag, or the default if the flag
+ * isn't there.
+ */
+const char* GetBenchString(int argc, char** argv, const char* flag,
+                           const char* defaultValue);
+
+/*
+ * The directions scripted players and bots steer in, in order. These are
+ * USERINPUT_INDEX_* values.
+ */
+#define BENCH_NUM_DIRECTIONS 4
+extern const unsigned gBenchDirections[BENCH_NUM_DIRECTIONS];
+
+/*
+ * Generates the scripted input for a player at a given tick, for worlds
+ * that start at t=0. Each player steers in a circle, pressing a direction
+ * for half of its period and then letting go, with the period and phase
+ * varying from player to player so they don't move in lockstep.
+ *
+ * Returns the USERINPUT_* bitfield for the tick, which is 0 if the player
+ * doesn't do anything.
+ */
+uint32_t GetScriptedInput(unsigned playerID, unsigned tick);
+
+#endif /* BENCHCOMMON_H */
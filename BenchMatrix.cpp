@@ -0,0 +1,349 @@
+/*
+ * Benchmark for the Vector and Matrix kernels.
+ *
+ * Times dot and cross products, matrix-vector and matrix-matrix products
+ * and the inverses, and compares them with the plain-array versions they
+ * replaced (kept here for reference). Then times the batch kernels against
+ * calling the single ones in a loop.
+ *
+ * The compiler is free to vectorize the plain-array loops, and usually
+ * does, so the "plain" column is not a scalar baseline. To see what SSE
+ * buys us, compare the "library" column of this build with one built with
+ * -DVECTOR_NO_SIMD.
+ *
+ * Usage: bench_matrix [-n iterations]
+ */
+
+#include "Matrix.h"
+#include "VectorArray.h"
+#include "BenchCommon.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+#define BENCH_DEFAULT_ITERATIONS 1000000
+
+// How many different operands we cycle through
+#define BENCH_NUM_OPERANDS 64
+
+// How many vectors or matrices go in a batch
+#define BENCH_BATCH_SIZE 4096
+
+/*
+ * The kernels as they were before we had SIMD ones. These work on plain
+ * arrays so that nothing else gets in the way, which also leaves the
+ * compiler free to vectorize them.
+ */
+struct ScalarVector {
+    float v[4];
+};
+
+struct ScalarMatrix {
+    ScalarVector rows[4];
+};
+
+static float
+ScalarDot(const ScalarVector& a, const ScalarVector& b)
+{
+    return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2] + a.v[3] * b.v[3];
+}
+
+static ScalarVector
+ScalarCross(const ScalarVector& a, const ScalarVector& b)
+{
+    ScalarVector rv;
+    rv.v[0] = a.v[1] * b.v[2] - a.v[2] * b.v[1];
+    rv.v[1] = -(a.v[0] * b.v[2] - a.v[2] * b.v[0]);
+    rv.v[2] = a.v[0] * b.v[1] - a.v[1] * b.v[0];
+    rv.v[3] = 0.0f;
+    return rv;
+}
+
+static ScalarMatrix
+ScalarTranspose(const ScalarMatrix& m)
+{
+    ScalarMatrix rv;
+    for (unsigned row = 0; row < 4; ++row)
+        for (unsigned col = 0; col < 4; ++col)
+            rv.rows[row].v[col] = m.rows[col].v[row];
+    return rv;
+}
+
+static ScalarVector
+ScalarMVProduct(const ScalarMatrix& m, const ScalarVector& vec)
+{
+    ScalarVector rv;
+    for (unsigned row = 0; row < 4; ++row)
+        rv.v[row] = ScalarDot(m.rows[row], vec);
+    return rv;
+}
+
+static ScalarMatrix
+ScalarMMProduct(const ScalarMatrix& m, const ScalarMatrix& mat)
+{
+    // Transposes and dot products, just like the old Matrix::MMProduct()
+    ScalarMatrix rvPrime;
+    ScalarMatrix matPrime = ScalarTranspose(mat);
+    for (unsigned row = 0; row < 4; ++row)
+        rvPrime.rows[row] = ScalarMVProduct(m, matPrime.rows[row]);
+    return ScalarTranspose(rvPrime);
+}
+
+/*
+ * The library's kernels are out of line, so we call these through pointers
+ * to keep the compiler from inlining them into the loop, which would make
+ * the comparison meaningless.
+ */
+static float (*volatile sScalarDot)(const ScalarVector&, const ScalarVector&) =
+    ScalarDot;
+static ScalarVector (*volatile sScalarCross)(const ScalarVector&,
+                                             const ScalarVector&) = ScalarCross;
+static ScalarVector (*volatile sScalarMVProduct)(const ScalarMatrix&,
+                                                 const ScalarVector&) =
+    ScalarMVProduct;
+static ScalarMatrix (*volatile sScalarMMProduct)(const ScalarMatrix&,
+                                                 const ScalarMatrix&) =
+    ScalarMMProduct;
+
+/*
+ * Copies a Vector or Matrix into its scalar twin.
+ */
+static ScalarVector
+ToScalar(const Vector& vec)
+{
+    ScalarVector rv;
+    for (unsigned i = 0; i < 4; ++i)
+        rv.v[i] = vec[i];
+    return rv;
+}
+
+static ScalarMatrix
+ToScalar(const Matrix& mat)
+{
+    ScalarMatrix rv;
+    for (unsigned row = 0; row < 4; ++row)
+        rv.rows[row] = ToScalar(mat[row]);
+    return rv;
+}
+
+/*
+ * Largest difference between corresponding elements.
+ */
+static float
+MaxError(const Vector& vec, const ScalarVector& scalar)
+{
+    float error = 0.0f;
+    for (unsigned i = 0; i < 4; ++i)
+        error = MAX(error, (float) fabs(vec[i] - scalar.v[i]));
+    return error;
+}
+
+static float
+MaxError(const Matrix& mat, const ScalarMatrix& scalar)
+{
+    float error = 0.0f;
+    for (unsigned row = 0; row < 4; ++row)
+        error = MAX(error, MaxError(mat[row], scalar.rows[row]));
+    return error;
+}
+
+/*
+ * Prints one line of results.
+ */
+static void
+Report(const char* name, double seconds, double scalarSeconds, int iterations)
+{
+    if (scalarSeconds > 0.0)
+        printf("    %-12s %8.2f ns %8.2f ns %6.2fx\n", name,
+               seconds * 1e9 / iterations, scalarSeconds * 1e9 / iterations,
+               scalarSeconds / seconds);
+    else
+        printf("    %-12s %8.2f ns\n", name, seconds * 1e9 / iterations);
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = GetBenchOption(argc, argv, "-n", BENCH_DEFAULT_ITERATIONS);
+    if (iterations < 1) {
+        printf("Usage: %s [-n iterations]\n", argv[0]);
+        return -1;
+    }
+
+    // Random rigid transforms and points, and their scalar copies
+    Vector vectors[BENCH_NUM_OPERANDS];
+    Matrix matrices[BENCH_NUM_OPERANDS];
+    ScalarVector scalarVectors[BENCH_NUM_OPERANDS];
+    ScalarMatrix scalarMatrices[BENCH_NUM_OPERANDS];
+    for (unsigned i = 0; i < BENCH_NUM_OPERANDS; ++i) {
+        vectors[i] = Vector::Random(10.0f, 10.0f, 10.0f);
+        Vector axis = Vector::Random(1.0f, 1.0f, 1.0f);
+        matrices[i].Translate(vectors[i].x, vectors[i].y, vectors[i].z);
+        matrices[i].Rotate(Vector::RandomFloat(180.0f),
+                           axis.x + 2.0f, axis.y, axis.z);
+        scalarVectors[i] = ToScalar(vectors[i]);
+        scalarMatrices[i] = ToScalar(matrices[i]);
+    }
+
+    // Make sure we get the same answers first
+    float maxError = 0.0f;
+    for (unsigned i = 0; i < BENCH_NUM_OPERANDS; ++i) {
+        unsigned j = (i + 1) % BENCH_NUM_OPERANDS;
+        Vector cross = vectors[i].Cross(vectors[j]);
+        Vector product = matrices[i].MVProduct(vectors[j]);
+        Matrix composed = matrices[i].MMProduct(matrices[j]);
+        Matrix inverse = matrices[i].Inverse4();
+        Matrix identity = matrices[i].MMProduct(inverse);
+        Matrix affine = matrices[i].InverseAffine();
+        Matrix rigid = matrices[i].InverseRigid();
+        maxError = MAX(maxError, (float) fabs(vectors[i].Dot(vectors[j]) -
+            ScalarDot(scalarVectors[i], scalarVectors[j])));
+        maxError = MAX(maxError, MaxError(cross,
+            ScalarCross(scalarVectors[i], scalarVectors[j])));
+        maxError = MAX(maxError, MaxError(product,
+            ScalarMVProduct(scalarMatrices[i], scalarVectors[j])));
+        maxError = MAX(maxError, MaxError(composed,
+            ScalarMMProduct(scalarMatrices[i], scalarMatrices[j])));
+        maxError = MAX(maxError, MaxError(identity, ToScalar(Matrix())));
+        maxError = MAX(maxError, MaxError(affine, ToScalar(inverse)));
+        maxError = MAX(maxError, MaxError(rigid, ToScalar(inverse)));
+    }
+
+    // Everything feeds into this, so none of it gets optimized away
+    float sink = 0.0f;
+    sf::Clock timer;
+
+#define BENCH_LOOP(expression) \
+    timer.Reset(); \
+    for (int n = 0; n < iterations; ++n) { \
+        unsigned i = n % BENCH_NUM_OPERANDS; \
+        unsigned j = (n + 1) % BENCH_NUM_OPERANDS; \
+        (void) i; (void) j; \
+        sink += expression; \
+    }
+
+    BENCH_LOOP(vectors[i].Dot(vectors[j]));
+    double dot = timer.GetElapsedTime();
+    BENCH_LOOP(sScalarDot(scalarVectors[i], scalarVectors[j]));
+    double scalarDot = timer.GetElapsedTime();
+
+    BENCH_LOOP(vectors[i].Cross(vectors[j]).x);
+    double cross = timer.GetElapsedTime();
+    BENCH_LOOP(sScalarCross(scalarVectors[i], scalarVectors[j]).v[0]);
+    double scalarCross = timer.GetElapsedTime();
+
+    BENCH_LOOP(matrices[i].MVProduct(vectors[j]).x);
+    double mv = timer.GetElapsedTime();
+    BENCH_LOOP(sScalarMVProduct(scalarMatrices[i], scalarVectors[j]).v[0]);
+    double scalarMV = timer.GetElapsedTime();
+
+    BENCH_LOOP(matrices[i].MMProduct(matrices[j])[0].x);
+    double mm = timer.GetElapsedTime();
+    BENCH_LOOP(sScalarMMProduct(scalarMatrices[i],
+                                scalarMatrices[j]).rows[0].v[0]);
+    double scalarMM = timer.GetElapsedTime();
+
+    BENCH_LOOP(matrices[i].Inverse4()[0].x);
+    double inverse = timer.GetElapsedTime();
+    BENCH_LOOP(matrices[i].InverseAffine()[0].x);
+    double inverseAffine = timer.GetElapsedTime();
+    BENCH_LOOP(matrices[i].InverseRigid()[0].x);
+    double inverseRigid = timer.GetElapsedTime();
+
+#undef BENCH_LOOP
+
+    // Batches. Each round does a whole batch, so we do fewer rounds.
+    int rounds = MAX(1, iterations / BENCH_BATCH_SIZE);
+    int batchIterations = rounds * BENCH_BATCH_SIZE;
+    std::vector<Matrix> lhs(BENCH_BATCH_SIZE), rhs(BENCH_BATCH_SIZE);
+    std::vector<Matrix> composed(BENCH_BATCH_SIZE);
+    std::vector<Vector> points(BENCH_BATCH_SIZE), transformed(BENCH_BATCH_SIZE);
+    VectorArray pointArray, transformedArray;
+    pointArray.Resize(BENCH_BATCH_SIZE);
+    for (unsigned i = 0; i < BENCH_BATCH_SIZE; ++i) {
+        lhs[i] = matrices[i % BENCH_NUM_OPERANDS];
+        rhs[i] = matrices[(i + 1) % BENCH_NUM_OPERANDS];
+        points[i] = vectors[i % BENCH_NUM_OPERANDS];
+        pointArray.Set(i, points[i]);
+    }
+
+    timer.Reset();
+    for (int round = 0; round < rounds; ++round) {
+        Matrix::MMProductBatch(&lhs[0], &rhs[0], &composed[0],
+                               BENCH_BATCH_SIZE);
+        sink += composed[round % BENCH_BATCH_SIZE][0].x;
+    }
+    double mmBatch = timer.GetElapsedTime();
+    timer.Reset();
+    for (int round = 0; round < rounds; ++round) {
+        for (unsigned i = 0; i < BENCH_BATCH_SIZE; ++i)
+            composed[i] = lhs[i].MMProduct(rhs[i]);
+        sink += composed[round % BENCH_BATCH_SIZE][0].x;
+    }
+    double mmSingle = timer.GetElapsedTime();
+
+    timer.Reset();
+    for (int round = 0; round < rounds; ++round) {
+        Matrix::MVProductBatch(matrices[round % BENCH_NUM_OPERANDS],
+                               &points[0], &transformed[0], BENCH_BATCH_SIZE);
+        sink += transformed[round % BENCH_BATCH_SIZE].x;
+    }
+    double mvBatch = timer.GetElapsedTime();
+    timer.Reset();
+    for (int round = 0; round < rounds; ++round) {
+        pointArray.Transform(matrices[round % BENCH_NUM_OPERANDS], 1.0f,
+                             transformedArray);
+        sink += transformedArray.X()[round % BENCH_BATCH_SIZE];
+    }
+    double soaBatch = timer.GetElapsedTime();
+    timer.Reset();
+    for (int round = 0; round < rounds; ++round) {
+        Matrix& mat = matrices[round % BENCH_NUM_OPERANDS];
+        for (unsigned i = 0; i < BENCH_BATCH_SIZE; ++i)
+            transformed[i] = mat.MVProduct(points[i]);
+        sink += transformed[round % BENCH_BATCH_SIZE].x;
+    }
+    double mvSingle = timer.GetElapsedTime();
+
+    // Make sure the batches agree with the single versions
+    float batchError = 0.0f;
+    Matrix::MMProductBatch(&lhs[0], &rhs[0], &composed[0], BENCH_BATCH_SIZE);
+    Matrix::MVProductBatch(matrices[0], &points[0], &transformed[0],
+                           BENCH_BATCH_SIZE);
+    pointArray.Transform(matrices[0], 1.0f, transformedArray);
+    for (unsigned i = 0; i < BENCH_BATCH_SIZE; ++i) {
+        Vector single = matrices[0].MVProduct(points[i]);
+        Matrix product = lhs[i].MMProduct(rhs[i]);
+        Vector soa = transformedArray.Get(i);
+        batchError = MAX(batchError, MaxError(composed[i], ToScalar(product)));
+        batchError = MAX(batchError, MaxError(transformed[i], ToScalar(single)));
+        batchError = MAX(batchError, MaxError(soa, ToScalar(single)));
+    }
+
+    // Report
+#ifdef VECTOR_USE_SSE
+    const char* kernels = "SSE";
+#else
+    const char* kernels = "scalar";
+#endif
+    printf("Matrix kernels (%s), %d iterations:\n", kernels, iterations);
+    printf("    %-12s %11s %11s %7s\n", "kernel", "library", "plain", "ratio");
+    Report("Dot", dot, scalarDot, iterations);
+    Report("Cross", cross, scalarCross, iterations);
+    Report("MVProduct", mv, scalarMV, iterations);
+    Report("MMProduct", mm, scalarMM, iterations);
+    Report("Inverse4", inverse, 0.0, iterations);
+    Report("InvAffine", inverseAffine, 0.0, iterations);
+    Report("InvRigid", inverseRigid, 0.0, iterations);
+    printf("    max error:   %g\n", maxError);
+    printf("Batches of %d, %d elements:\n", BENCH_BATCH_SIZE, batchIterations);
+    printf("    %-12s %11s %11s %7s\n", "kernel", "batch", "single", "speedup");
+    Report("MMProduct", mmBatch, mmSingle, batchIterations);
+    Report("MVProduct", mvBatch, mvSingle, batchIterations);
+    Report("SoA points", soaBatch, mvSingle, batchIterations);
+    printf("    SoA points:  %.2f GB/s\n",
+           batchIterations * 6.0 * sizeof(float) / soaBatch / 1e9);
+    printf("    max error:   %g\n", batchError);
+    printf("    (checksum %g)\n", sink);
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Rollback stress benchmark for Timeline.
+ *
+ * Drives a Timeline over a headless world with scripted input from a number
+ * of players. Player 1 is local, and its input arrives immediately. Everybody
+ * else's input arrives a fixed number of ticks late, plus some random jitter,
+ * which forces the timeline to roll back and resimulate.
+ *
+ * Usage: bench_timeline [-p players] [-t ticks] [-l lateness] [-j jitter]
+ *                       [-s seed]
+ */
+
+#include "WorldModel.h"
+#include "Timeline.h"
+#include "UserInput.h"
+#include "Gameclock.h"
+#include "BenchCommon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <vector>
+
+#define BENCH_DEFAULT_PLAYERS 8
+#define BENCH_DEFAULT_TICKS 2000
+#define BENCH_DEFAULT_LATENESS 3
+#define BENCH_DEFAULT_JITTER 2
+#define BENCH_DEFAULT_SEED 123456
+
+int main(int argc, char** argv)
+{
+    int numPlayers = GetBenchOption(argc, argv, "-p", BENCH_DEFAULT_PLAYERS);
+    int numTicks = GetBenchOption(argc, argv, "-t", BENCH_DEFAULT_TICKS);
+    int lateness = GetBenchOption(argc, argv, "-l", BENCH_DEFAULT_LATENESS);
+    int jitter = GetBenchOption(argc, argv, "-j", BENCH_DEFAULT_JITTER);
+    srand(GetBenchOption(argc, argv, "-s", BENCH_DEFAULT_SEED));
+    if (numPlayers < 1 || numPlayers > WORLDMODEL_MAX_PLAYERS || numTicks < 1 ||
+        lateness < 0 || jitter < 0 ||
+        lateness + jitter >= TIMELINE_ROLLBACK_WINDOW) {
+        printf("Usage: %s [-p players (1-%d)] [-t ticks] [-l lateness] "
+               "[-j jitter] [-s seed]\n", argv[0], WORLDMODEL_MAX_PLAYERS);
+        printf("lateness + jitter must be less than %d ticks\n",
+               TIMELINE_ROLLBACK_WINDOW);
+        return -1;
+    }
+
+    // Set up the world and the timeline
+    WorldModel world;
+    world.InitHeadless();
+    for (int i = 1; i <= numPlayers; ++i)
+        world.AddPlayer(i);
+    Timeline timeline;
+    timeline.Init(world, COMMUNICATOR_MODE_CLIENT);
+
+    // Inputs in flight, keyed by the tick they arrive at. Inputs from a given
+    // player never overtake each other, just like on a TCP connection.
+    std::multimap<unsigned, UserInput> inFlight;
+    std::vector<unsigned> lastArrival(numPlayers + 1, 0);
+
+    // Counters
+    unsigned long resimTicks = 0;
+    unsigned numAddInputs = 0;
+    double addInputSeconds = 0.0;
+    float maxAddInputSeconds = 0.0f;
+    size_t maxKeyframeBytes = 0;
+    unsigned maxKeyframes = 0;
+
+    sf::Clock wallTimer;
+    for (int tick = 0; tick < numTicks; ++tick) {
+        unsigned now = world.GetCurrentTimestamp();
+
+        // Everybody does their thing
+        for (int i = 1; i <= numPlayers; ++i) {
+            UserInput input(i, now);
+            input.inputs = GetScriptedInput(i, now);
+            if (input.inputs == 0)
+                continue;
+
+            unsigned arrival = now;
+            if (i != 1)
+                arrival += lateness + (jitter ? rand() % (jitter + 1) : 0);
+            arrival = MAX(arrival, lastArrival[i]);
+            lastArrival[i] = arrival;
+            inFlight.insert(std::make_pair(arrival, input));
+        }
+
+        // Deliver whatever has arrived
+        while (!inFlight.empty() && inFlight.begin()->first <= now) {
+            sf::Clock addTimer;
+            timeline.AddInput(inFlight.begin()->second);
+            float elapsed = addTimer.GetElapsedTime();
+            addInputSeconds += elapsed;
+            maxAddInputSeconds = MAX(maxAddInputSeconds, elapsed);
+            ++numAddInputs;
+            inFlight.erase(inFlight.begin());
+        }
+
+        // Step
+        timeline.Advance(1);
+        resimTicks += timeline.GetProfiler().GetFrame(0).resimTicks;
+        maxKeyframes = MAX(maxKeyframes, timeline.GetNumKeyframes());
+        maxKeyframeBytes = MAX(maxKeyframeBytes, timeline.GetKeyframeBytes());
+    }
+    double seconds = wallTimer.GetElapsedTime();
+    double simSeconds = numTicks * GAMECLOCK_TICK_MS / 1000.0;
+
+    // Report
+    TimelineMetrics& metrics = timeline.GetMetrics();
+    printf("Timeline: %d players, %d ticks, lateness %d, jitter %d, "
+           "in %.3f s\n", numPlayers, numTicks, lateness, jitter, seconds);
+    printf("    rollbacks:          %u (%.1f per simulated second, %.1f per "
+           "wall second)\n", metrics.numRollbacks,
+           metrics.numRollbacks / simSeconds, metrics.numRollbacks / seconds);
+    printf("    rollback depth:     %.2f average, %u max\n",
+           metrics.numRollbacks ?
+               (double) metrics.totalRollbackTicks / metrics.numRollbacks : 0.0,
+           metrics.maxRollbackTicks);
+    printf("    resimulated ticks:  %lu (%.2f per rollback)\n", resimTicks,
+           metrics.numRollbacks ? (double) resimTicks / metrics.numRollbacks
+                                : 0.0);
+    printf("    AddInput:           %u calls, %.1f us average, %.1f us max\n",
+           numAddInputs,
+           numAddInputs ? addInputSeconds * 1e6 / numAddInputs : 0.0,
+           maxAddInputSeconds * 1e6);
+    printf("    keyframes:          %u now, %u max\n",
+           timeline.GetNumKeyframes(), maxKeyframes);
+    printf("    keyframe memory:    %lu bytes now, %lu max\n",
+           (unsigned long) timeline.GetKeyframeBytes(),
+           (unsigned long) maxKeyframeBytes);
+    printf("    dropped inputs:     %u\n", metrics.numDroppedInputs);
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Benchmark for WorldModel physics stepping.
+ *
+ * Builds a headless world, adds a bunch of players driven by scripted
+ * input, and steps it for a fixed number of ticks.
+ *
+ * Usage: bench_worldmodel [-p players] [-t ticks] [-w physicsThreads]
+ */
+
+#include "WorldModel.h"
+#include "UserInput.h"
+#include "BenchCommon.h"
+#include <stdio.h>
+
+#define BENCH_DEFAULT_PLAYERS 8
+#define BENCH_DEFAULT_TICKS 2000
+
+int main(int argc, char** argv)
+{
+    int numPlayers = GetBenchOption(argc, argv, "-p", BENCH_DEFAULT_PLAYERS);
+    int numTicks = GetBenchOption(argc, argv, "-t", BENCH_DEFAULT_TICKS);
+    int numThreads = GetBenchOption(argc, argv, "-w", 1);
+    if (numPlayers < 1 || numPlayers > WORLDMODEL_MAX_PLAYERS || numTicks < 1 ||
+        numThreads < 1) {
+        printf("Usage: %s [-p players (1-%d)] [-t ticks] [-w physicsThreads]\n",
+               argv[0], WORLDMODEL_MAX_PLAYERS);
+        return -1;
+    }
+    WorldModel::SetPhysicsThreads((unsigned) numThreads);
+
+    // Set up the world
+    WorldModel world;
+    world.InitHeadless();
+    for (int i = 1; i <= numPlayers; ++i)
+        world.AddPlayer(i);
+
+    // Run it
+    unsigned long allocationsBefore = GetAllocationCount();
+    unsigned long bytesBefore = GetAllocationBytes();
+    sf::Clock timer;
+    for (int tick = 0; tick < numTicks; ++tick) {
+        for (int i = 1; i <= numPlayers; ++i) {
+            UserInput input(i, world.GetCurrentTimestamp());
+            input.inputs = GetScriptedInput(i, world.GetCurrentTimestamp());
+            if (input.inputs != 0)
+                world.ApplyInput(input);
+        }
+        world.Step(1);
+    }
+    double seconds = timer.GetElapsedTime();
+    unsigned long allocations = GetAllocationCount() - allocationsBefore;
+    unsigned long bytes = GetAllocationBytes() - bytesBefore;
+
+    // Report
+    printf("WorldModel: %d players, %d ticks, %d physics threads in %.3f s\n",
+           numPlayers, numTicks, numThreads, seconds);
+    printf("    ticks/sec:              %.1f\n", numTicks / seconds);
+    printf("    ns per player per tick: %.1f\n",
+           seconds * 1e9 / ((double) numTicks * numPlayers));
+    printf("    allocations:            %lu (%.2f per tick, %.1f bytes per tick)\n",
+           allocations, (double) allocations / numTicks,
+           (double) bytes / numTicks);
+
+    return 0;
+}
@@ -1,11 +1,16 @@
 #include "Communicator.h"
 #include "WorldModel.h"
 #include "Timeline.h"
+#include "Gameclock.h"
 #include "assert.h"
+#include <math.h>
+#include <stdlib.h>
 
 #include <Sockets/Lock.h>
 #include <Sockets/ListenSocket.h>
 
+using std::vector;
+
 const unsigned sGrowblesMagic = 0x640E8135;
 
 /*
@@ -30,22 +35,52 @@ Payload::GetDataSize()
 {
     switch(type) {
         case PAYLOAD_TYPE_WORLDSTATE:
-            return (unsigned) sizeof(WorldState);
+            return size;
         case PAYLOAD_TYPE_USERINPUT:
             return (unsigned) sizeof(UserInput);
+        case PAYLOAD_TYPE_USERINPUT_BATCH:
+            assert(size % sizeof(UserInput) == 0);
+            return size;
+        case PAYLOAD_TYPE_CLOCKSYNC:
+            return (unsigned) sizeof(ClockSyncMessage);
+        case PAYLOAD_TYPE_CHECKSUM:
+            return (unsigned) sizeof(ChecksumMessage);
         default:
             assert(0); // Not reached
             return 0;
     }
 }
 
+bool
+Payload::IsVariableSize(PayloadType t)
+{
+    return t == PAYLOAD_TYPE_WORLDSTATE || t == PAYLOAD_TYPE_USERINPUT_BATCH;
+}
+
+void
+Payload::Encode(std::string& buffer)
+{
+    // Header: the type, followed by the data size
+    unsigned dataSize = GetDataSize();
+    buffer.append((const char*)&type, sizeof(type));
+    buffer.append((const char*)&dataSize, sizeof(dataSize));
+
+    // Data
+    buffer.append((const char*)data, dataSize);
+}
+
 /*
  * GrowblesSocket Methods.
  */
 
 GrowblesSocket::GrowblesSocket(ISocketHandler& h) : TcpSocket(h)
+                                                  , mHandler(NULL)
                                                   , mRemoteID(0)
+                                                  , mNeedsBootstrap(false)
 {
+    // Everything we send goes through the handler, so only cast once
+    mHandler = dynamic_cast<GrowblesHandler*>(&h);
+
     // We don't want TCP to buffer things up
     SetTcpNodelay();
 }
@@ -65,15 +100,42 @@ GrowblesSocket::OnAccept()
     message[0] = sGrowblesMagic;
 
     // Then we send them our ID
-    Communicator* comm = dynamic_cast<GrowblesHandler&>(Handler()).GetCommunicator();
+    assert(mHandler);
+    GrowblesHandler& handler = *mHandler;
+    Communicator* comm = handler.GetCommunicator();
     message[1] = comm->mPlayerID;
 
+    // If we're full, we send them an ID of zero and hang up.
+    if (handler.GetNumPeers() + 1 >= WORLDMODEL_MAX_PLAYERS) {
+        printf("Turning away a client, we already have %u players.\n",
+               handler.GetNumPeers() + 1);
+        message[2] = 0;
+        SendBuf((const char *)&message, sizeof(message));
+        SetCloseAndDelete();
+        return;
+    }
+
     // Then we send them their player ID
     SetRemoteID(comm->mNextPlayerID++);
     message[2] = mRemoteID;
 
     // Send
     SendBuf((const char *)&message, sizeof(message));
+
+    // They're a peer now, but they don't have a world yet
+    SetNeedsBootstrap(true);
+    handler.AddPeer(this);
+}
+
+void
+GrowblesSocket::OnDelete()
+{
+    // Make sure the handler forgets about us. This is a no-op for sockets
+    // that never became peers. If the handler itself is being destroyed,
+    // the cast fails and there's nobody to tell.
+    GrowblesHandler* handler = dynamic_cast<GrowblesHandler*>(&Handler());
+    if (handler)
+        handler->RemovePeer(this);
 }
 
 unsigned
@@ -95,23 +157,56 @@ void
 GrowblesSocket::SendPayload(Payload& payload)
 {
     // We're using TCP_NODELAY, which sends data immediately. However, we want
-    // our payload to go in a single packet. So we create a buffer here for
-    // the packet.
-    unsigned dataSize = payload.GetDataSize();
-    unsigned buffSize = sizeof(payload.type) + sizeof(dataSize) + dataSize;
-    char* buffer = (char*)malloc(buffSize);
-    assert(buffer);
+    // our payload to go in a single packet. So we encode it into a buffer
+    // first.
+    std::string encoded;
+    payload.Encode(encoded);
+    SendEncoded(encoded);
+}
 
-    // Fill the buffer
-    char* currBuffer = buffer;
-    memcpy(currBuffer, &payload.type, sizeof(payload.type));
-    currBuffer += sizeof(payload.type);
-    memcpy(currBuffer, &dataSize, sizeof(dataSize));
-    currBuffer += sizeof(dataSize);
-    memcpy(currBuffer, payload.data, dataSize);
+void
+GrowblesSocket::SendEncoded(const std::string& encoded)
+{
+    // If we're simulating a bad network, hold on to it for a bit
+    assert(mHandler);
+    if (mHandler->GetNetConditions().IsActive()) {
+        double release = mHandler->GetReleaseTime();
+
+        // TCP keeps things in order, so nothing overtakes what's ahead of it
+        if (!mDelayed.empty())
+            release = MAX(release, mDelayed.back().first);
+        mDelayed.push_back(std::make_pair(release, encoded));
+        return;
+    }
 
-    // Send the buffer
-    SendBuf(buffer, buffSize);
+    SendBuf(encoded.data(), encoded.size());
+}
+
+void
+GrowblesSocket::SendDelayed(double now)
+{
+    while (!mDelayed.empty() && mDelayed.front().first <= now) {
+        SendBuf(mDelayed.front().second.data(), mDelayed.front().second.size());
+        mDelayed.pop_front();
+    }
+}
+
+void
+GrowblesSocket::DeferInput(const UserInput& input)
+{
+    mDeferredInputs.push_back(input);
+}
+
+void
+GrowblesSocket::FlushDeferredInputs()
+{
+    if (mDeferredInputs.empty())
+        return;
+
+    Payload payload(PAYLOAD_TYPE_USERINPUT_BATCH, &mDeferredInputs[0],
+                    mDeferredInputs.size() * sizeof(UserInput));
+    SendPayload(payload);
+    mDeferredInputs.clear();
 }
 
 bool
@@ -129,6 +224,8 @@ GrowblesSocket::HasPayload()
     unsigned dataSize;
     ReadInput((char*)&mIncoming.type, sizeof(mIncoming.type));
     ReadInput((char*)&dataSize, sizeof(dataSize));
+    if (Payload::IsVariableSize(mIncoming.type))
+        mIncoming.size = dataSize;
     assert(dataSize == mIncoming.GetDataSize()); // Make sure compilers pack
                                                  // the structs the same way.
     return HasPayload();
@@ -142,6 +239,7 @@ GrowblesSocket::GetPayload(Payload& payload)
 
     // Set the type
     payload.type = mIncoming.type;
+    payload.size = mIncoming.size;
 
     // Allocate the data buffer
     payload.data = malloc(payload.GetDataSize());
@@ -163,15 +261,39 @@ GrowblesSocket::GetPayload(Payload& payload)
 
 GrowblesHandler::GrowblesHandler(Communicator& c) : SocketHandler()
                                                   , mCommunicator(&c)
+                                                  , mReadCursor(0)
+{
+}
+
+void
+GrowblesHandler::AddPeer(GrowblesSocket* socket)
 {
+    assert(mPeersByID.find(socket->GetRemoteID()) == mPeersByID.end());
+    mPeers.push_back(socket);
+    mPeersByID[socket->GetRemoteID()] = socket;
 }
 
 void
-GrowblesHandler::AddPlayers(WorldModel& model)
+GrowblesHandler::RemovePeer(GrowblesSocket* socket)
 {
-    for (socket_m::iterator it = m_sockets.begin();
-         it != m_sockets.end(); ++it)
-        model.AddPlayer(dynamic_cast<GrowblesSocket*>(it->second)->GetRemoteID());
+    for (vector<GrowblesSocket*>::iterator it = mPeers.begin();
+         it != mPeers.end(); ++it) {
+        if (*it == socket) {
+            mPeers.erase(it);
+            mPeersByID.erase(socket->GetRemoteID());
+            if (!socket->NeedsBootstrap())
+                mDepartedPeers.push_back(socket->GetRemoteID());
+            mReadCursor = 0;
+            return;
+        }
+    }
+}
+
+void
+GrowblesHandler::TakeDepartedPeers(vector<unsigned>& departedOut)
+{
+    departedOut.swap(mDepartedPeers);
+    mDepartedPeers.clear();
 }
 
 void
@@ -184,35 +306,102 @@ GrowblesHandler::SendToAll(Payload& payload)
 void
 GrowblesHandler::SendToAllExcept(Payload& payload, unsigned excluded)
 {
-    for (socket_m::iterator it = m_sockets.begin();
-         it != m_sockets.end(); ++it) {
-        GrowblesSocket* socket = dynamic_cast<GrowblesSocket*>(it->second);
-        if (socket->GetRemoteID() != excluded)
-            socket->SendPayload(payload);
+    // Encode once, send many times
+    std::string encoded;
+    payload.Encode(encoded);
+
+    for (vector<GrowblesSocket*>::iterator it = mPeers.begin();
+         it != mPeers.end(); ++it) {
+        GrowblesSocket* socket = *it;
+        if (socket->GetRemoteID() != excluded && !socket->NeedsBootstrap())
+            socket->SendEncoded(encoded);
     }
 }
 
 void
 GrowblesHandler::SendTo(Payload& payload, unsigned playerID)
 {
-    for (socket_m::iterator it = m_sockets.begin();
-         it != m_sockets.end(); ++it) {
-        GrowblesSocket* socket = dynamic_cast<GrowblesSocket*>(it->second);
-        if (socket->GetRemoteID() == playerID) {
-            socket->SendPayload(payload);
-            return;
-        }
+    std::map<unsigned, GrowblesSocket*>::iterator it = mPeersByID.find(playerID);
+    if (it != mPeersByID.end())
+        it->second->SendPayload(payload);
+}
+
+void
+GrowblesHandler::SendToNewPeers(Payload& payload)
+{
+    std::string encoded;
+    payload.Encode(encoded);
+
+    for (vector<GrowblesSocket*>::iterator it = mPeers.begin();
+         it != mPeers.end(); ++it)
+        if ((*it)->NeedsBootstrap())
+            (*it)->SendEncoded(encoded);
+}
+
+void
+GrowblesHandler::RelayInput(UserInput& input, InterestManager& interest)
+{
+    // Encode once for everybody who gets it right away
+    Payload payload(PAYLOAD_TYPE_USERINPUT, &input);
+    std::string encoded;
+    payload.Encode(encoded);
+
+    for (vector<GrowblesSocket*>::iterator it = mPeers.begin();
+         it != mPeers.end(); ++it) {
+        GrowblesSocket* socket = *it;
+        if (socket->GetRemoteID() == input.playerID || socket->NeedsBootstrap())
+            continue;
+        if (interest.IsNear(input.playerID, socket->GetRemoteID()))
+            socket->SendEncoded(encoded);
+        else
+            socket->DeferInput(input);
     }
 }
 
+void
+GrowblesHandler::FlushDeferredInputs()
+{
+    for (vector<GrowblesSocket*>::iterator it = mPeers.begin();
+         it != mPeers.end(); ++it)
+        (*it)->FlushDeferredInputs();
+}
+
+void
+GrowblesHandler::SetNetConditions(const NetConditions& conditions)
+{
+    mNetConditions = conditions;
+}
+
+double
+GrowblesHandler::GetReleaseTime()
+{
+    float delayMS = mNetConditions.latencyMS;
+    delayMS += mNetConditions.jitterMS * (rand() / (float) RAND_MAX);
+    if (rand() / (float) RAND_MAX * 100.0f < mNetConditions.lossPercent)
+        delayMS += NETCONDITIONS_RETRANSMIT_MS;
+    return mNetClock.GetElapsedTime() + delayMS / 1000.0;
+}
+
+void
+GrowblesHandler::SendDelayed()
+{
+    double now = mNetClock.GetElapsedTime();
+    for (vector<GrowblesSocket*>::iterator it = mPeers.begin();
+         it != mPeers.end(); ++it)
+        (*it)->SendDelayed(now);
+}
+
 bool
 GrowblesHandler::HasPayload()
 {
-    for (socket_m::iterator it = m_sockets.begin();
-         it != m_sockets.end(); ++it) {
-        GrowblesSocket* socket = dynamic_cast<GrowblesSocket*>(it->second);
-        if (socket->HasPayload())
+    // Start looking where we left off last time. This leaves mReadCursor
+    // pointing at the socket with the payload.
+    for (unsigned i = 0; i < mPeers.size(); ++i) {
+        unsigned index = (mReadCursor + i) % mPeers.size();
+        if (mPeers[index]->HasPayload()) {
+            mReadCursor = index;
             return true;
+        }
     }
     return false;
 }
@@ -221,20 +410,15 @@ unsigned
 GrowblesHandler::ReceivePayload(Payload& payload)
 {
     // We must have a payload available
-    assert(HasPayload());
-
-    for (socket_m::iterator it = m_sockets.begin();
-         it != m_sockets.end(); ++it) {
-        GrowblesSocket* socket = dynamic_cast<GrowblesSocket*>(it->second);
-        if (socket->HasPayload()) {
-            socket->GetPayload(payload);
-            return socket->GetRemoteID();
-        }
+    if (!HasPayload()) {
+        assert(0); // Not reached
+        return 0;
     }
 
-    // We should never get here
-    assert(0);
-    return 0;
+    // HasPayload() left the cursor on a socket with a payload
+    GrowblesSocket* socket = mPeers[mReadCursor];
+    socket->GetPayload(payload);
+    return socket->GetRemoteID();
 }
 
 /*
@@ -243,11 +427,22 @@ GrowblesHandler::ReceivePayload(Payload& payload)
 
 Communicator::Communicator(Timeline& timeline,
                            CommunicatorMode mode) : mTimeline(&timeline)
+                                                  , mWorld(NULL)
+                                                  , mClock(NULL)
+                                                  , mLastClockSync(0)
+                                                  , mRoundTrip(0.0)
+                                                  , mInputDelay(0)
+                                                  , mAdaptiveInputDelay(false)
+                                                  , mLastInputTimestamp(0)
+                                                  , mNextInputSequence(0)
+                                                  , mNextChecksum(0)
                                                   , mMode(mode)
                                                   , mPlayerID(0)
                                                   , mNextPlayerID(1)
                                                   , mNumClientsExpected(0)
+                                                  , mListenSocket(NULL)
                                                   , mSocketHandler(*this)
+                                                  , mLastFarFlush(0)
 {
     // If we're a server, assign ourselves a player ID
     if (mode == COMMUNICATOR_MODE_SERVER)
@@ -261,6 +456,40 @@ Communicator::SetServer(const char* server)
     mServerAddress = server;
 }
 
+void
+Communicator::SetClock(Gameclock& clock)
+{
+    mClock = &clock;
+}
+
+void
+Communicator::SetInputDelay(unsigned ticks)
+{
+    mInputDelay = ticks;
+}
+
+void
+Communicator::SetAdaptiveInputDelay(bool enabled)
+{
+    mAdaptiveInputDelay = enabled;
+}
+
+unsigned
+Communicator::GetInputTimestamp(unsigned now)
+{
+    unsigned timestamp = now + mInputDelay;
+    if (timestamp < mLastInputTimestamp)
+        timestamp = mLastInputTimestamp;
+    mLastInputTimestamp = timestamp;
+    return timestamp;
+}
+
+void
+Communicator::SetNetConditions(const NetConditions& conditions)
+{
+    mSocketHandler.SetNetConditions(conditions);
+}
+
 void
 Communicator::SetNumClientsExpected(unsigned n)
 {
@@ -299,8 +528,15 @@ Communicator::ConnectAsClient()
         exit(-1);
     }
 
+    // A player ID of zero means the server is full
+    if (openingMessage[2] == 0) {
+        printf("Server is full!\n");
+        exit(-1);
+    }
+
     // Set the server's ID
     socket->SetRemoteID(openingMessage[1]);
+    mSocketHandler.AddPeer(socket);
 
     // Save our player ID
     mPlayerID = openingMessage[2];
@@ -312,30 +548,38 @@ Communicator::ConnectAsServer()
 {
     // Create the ListenSocket. Once bound, this adds a new
     // TcpSocket to the handler for each accepted connection.
-    ListenSocket<GrowblesSocket> listenSocket(mSocketHandler);
-    if (listenSocket.Bind(GROWBLES_PORT)) {
+    mListenSocket = new ListenSocket<GrowblesSocket>(mSocketHandler);
+    if (mListenSocket->Bind(GROWBLES_PORT)) {
         printf("Couldn't bind to port %u!\n", GROWBLES_PORT);
         exit(-1);
     }
 
-    // Add the ListenSocket to the handler. When the destructor is called
-    // at the end of this method, the ListenSocket will remove itself.
-    mSocketHandler.Add(&listenSocket);
+    // Add the ListenSocket to the handler. We keep it around for the rest of
+    // the game so that clients can join late, and let the handler clean it
+    // up.
+    mListenSocket->SetDeleteByHandler();
+    mSocketHandler.Add(mListenSocket);
 
     // We want to wait until we've accepted the desired number of connections.
-    // Note that we want GetNumActiveSockets() to be one more than our desired
-    // number of clients, because the handler is holding onto the ListenSocket
-    // too.
-    while (mSocketHandler.GetNumActiveSockets() < mNumClientsExpected + 1)
+    while (mSocketHandler.GetNumPeers() < mNumClientsExpected)
         mSocketHandler.Select(1,0);
 }
 
 void
 Communicator::Synchronize()
 {
-    // Queue up any input we might have, but don't wait
+    // Send anything we've been holding back, and queue up any input we might
+    // have, but don't wait
+    mSocketHandler.SendDelayed();
     mSocketHandler.Select(0, 0);
 
+    // Welcome anybody who just connected, see off anybody who left, and
+    // figure out who's near whom
+    if (mMode == COMMUNICATOR_MODE_SERVER) {
+        UpdateClients();
+        mInterest.Update(*mWorld);
+    }
+
     // Read in all payloads
     while (mSocketHandler.HasPayload()) {
 
@@ -349,18 +593,46 @@ Communicator::Synchronize()
             // Worldstate dumps should only come from the server.
             case PAYLOAD_TYPE_WORLDSTATE:
                 assert(mMode == COMMUNICATOR_MODE_CLIENT);
-                assert(0); // We don't send these yet
-                //model.SetState(*(WorldState*)incoming.data);
+                ApplyWorldState(incoming);
                 break;
 
             // User inputs can come from anyone. The server forwards received
-            // inputs to everyone else.
+            // inputs to everyone else. Only the server adds and removes
+            // players, though.
             case PAYLOAD_TYPE_USERINPUT:
+                if (mMode == COMMUNICATOR_MODE_SERVER &&
+                    (((UserInput*)incoming.data)->inputs & USERINPUT_ROSTER_MASK)) {
+                    printf("Warning - Player %u tried to add or remove a "
+                           "player. Dropping.\n",
+                           ((UserInput*)incoming.data)->playerID);
+                    break;
+                }
                 mTimeline->AddInput(*(UserInput*)incoming.data);
                 if (mMode == COMMUNICATOR_MODE_SERVER)
-                    mSocketHandler.SendToAllExcept(incoming,
-                                                   ((UserInput*)incoming.data)
-                                                   ->playerID);
+                    mSocketHandler.RelayInput(*(UserInput*)incoming.data,
+                                              mInterest);
+                break;
+
+            // Batches of inputs only come from the server, for players that
+            // are far away from us.
+            case PAYLOAD_TYPE_USERINPUT_BATCH: {
+                assert(mMode == COMMUNICATOR_MODE_CLIENT);
+                UserInput* inputs = (UserInput*)incoming.data;
+                unsigned count = incoming.GetDataSize() / sizeof(UserInput);
+                for (unsigned i = 0; i < count; ++i)
+                    mTimeline->AddInput(inputs[i]);
+                break;
+            }
+
+            // Clock synchronization pings go back and forth
+            case PAYLOAD_TYPE_CLOCKSYNC:
+                HandleClockSync(*(ClockSyncMessage*)incoming.data);
+                break;
+
+            // Checksums go to the server, to be checked once it's ready
+            case PAYLOAD_TYPE_CHECKSUM:
+                assert(mMode == COMMUNICATOR_MODE_SERVER);
+                mPendingChecksums.push_back(*(ChecksumMessage*)incoming.data);
                 break;
 
             default:
@@ -368,25 +640,40 @@ Communicator::Synchronize()
                 break;
         }
     }
+
+    // Compare notes on what the world looks like
+    if (mMode == COMMUNICATOR_MODE_CLIENT)
+        SendChecksums();
+    else
+        CheckChecksums();
+
+    // Every so often, check our clock against the server's
+    if (mMode == COMMUNICATOR_MODE_CLIENT && mClock &&
+        mClock->Now() >= mLastClockSync + CLOCKSYNC_INTERVAL)
+        SendClockSync();
+
+    // Every so often, send far away players what they've been missing
+    if (mMode == COMMUNICATOR_MODE_SERVER &&
+        mWorld->GetCurrentTimestamp() >= mLastFarFlush + INTEREST_FAR_INTERVAL) {
+        mSocketHandler.FlushDeferredInputs();
+        mLastFarFlush = mWorld->GetCurrentTimestamp();
+    }
 }
 
 void
 Communicator::Bootstrap(WorldModel& world)
 {
+    mWorld = &world;
+
     // If we're the server
     if (mMode == COMMUNICATOR_MODE_SERVER) {
 
-        // Add the server player
+        // Add the server player, and start our timeline
         world.AddPlayer(mPlayerID);
+        mTimeline->Init(world, mMode);
 
-        // Add the client players
-        mSocketHandler.AddPlayers(world);
-
-        // Send the state to all clients
-        WorldState state;
-        world.GetState(state);
-        Payload payload(PAYLOAD_TYPE_WORLDSTATE, &state);
-        mSocketHandler.SendToAll(payload);
+        // Everybody who has connected so far is a new client
+        UpdateClients();
     }
 
     // If we're the client
@@ -400,25 +687,297 @@ Communicator::Bootstrap(WorldModel& world)
         assert(received.type == PAYLOAD_TYPE_WORLDSTATE);
 
         // Apply it
-        world.SetState(*(WorldState*)received.data);
+        WorldState state;
+        if (!state.Deserialize((char*)received.data, received.GetDataSize())) {
+            printf("Received malformed world state from server!\n");
+            exit(-1);
+        }
+        world.SetState(state);
+
+        // Start our timeline
+        mTimeline->Init(world, mMode);
+
+        // We only have history from here on
+        mNextChecksum = (world.GetCurrentTimestamp() / KEYFRAME_STEP + 1) *
+                        KEYFRAME_STEP;
     }
+}
 
-    // Start our timeline
-    mTimeline->Init(world, mMode);
+void
+Communicator::UpdateClients()
+{
+    assert(mMode == COMMUNICATOR_MODE_SERVER);
+
+    // Remove the players whose connections closed
+    vector<unsigned> departed;
+    mSocketHandler.TakeDepartedPeers(departed);
+    for (unsigned i = 0; i < departed.size(); ++i) {
+        ChangeRoster(departed[i], USERINPUT_LEAVE);
+        mClientRoundTrips.erase(departed[i]);
+        printf("Player %u left\n", departed[i]);
+    }
+
+    // Add a player for each new connection. The new clients aren't sent
+    // the join inputs, since they start from a snapshot with everybody in
+    // it.
+    bool anyNew = false;
+    const vector<GrowblesSocket*>& peers = mSocketHandler.GetPeers();
+    for (unsigned i = 0; i < peers.size(); ++i) {
+        if (peers[i]->NeedsBootstrap()) {
+            ChangeRoster(peers[i]->GetRemoteID(), USERINPUT_JOIN);
+            printf("Player %u joined\n", peers[i]->GetRemoteID());
+            anyNew = true;
+        }
+    }
+    if (!anyNew)
+        return;
+
+    // Get the new clients started
+    SendWorldState();
+    for (unsigned i = 0; i < peers.size(); ++i)
+        peers[i]->SetNeedsBootstrap(false);
+}
+
+void
+Communicator::ChangeRoster(unsigned playerID, uint32_t change)
+{
+    assert(mMode == COMMUNICATOR_MODE_SERVER);
+
+    // This goes through our timeline like any other input, so it happens at
+    // the same tick for everybody and our history stays good
+    UserInput input(playerID, mWorld->GetCurrentTimestamp());
+    input.inputs = change;
+    mTimeline->AddInput(input);
+
+    Payload payload(PAYLOAD_TYPE_USERINPUT, &input);
+    mSocketHandler.SendToAll(payload);
+}
+
+void
+Communicator::SendWorldState(unsigned playerID)
+{
+    assert(mMode == COMMUNICATOR_MODE_SERVER);
+
+    // Grab and flatten the state
+    WorldState state;
+    mWorld->GetState(state);
+    vector<char> buffer;
+    state.Serialize(buffer);
+
+    // Send
+    Payload payload(PAYLOAD_TYPE_WORLDSTATE, &buffer[0], buffer.size());
+    if (playerID == 0)
+        mSocketHandler.SendToNewPeers(payload);
+    else
+        mSocketHandler.SendTo(payload, playerID);
+}
+
+void
+Communicator::SendChecksums()
+{
+    assert(mMode == COMMUNICATOR_MODE_CLIENT);
+
+    unsigned now = mWorld->GetCurrentTimestamp();
+    if (now < CHECKSUM_CONFIRM_TICKS)
+        return;
+
+    // Send everything that's settled. We may not have some of them if we've
+    // resynchronized, in which case there's nothing to compare.
+    unsigned settled = now - CHECKSUM_CONFIRM_TICKS;
+    while (mNextChecksum <= settled) {
+        ChecksumMessage message;
+        message.playerID = mPlayerID;
+        message.timestamp = mNextChecksum;
+        if (mTimeline->GetChecksum(mNextChecksum, message.checksum)) {
+            Payload payload(PAYLOAD_TYPE_CHECKSUM, &message);
+            mSocketHandler.SendToAll(payload);
+        }
+        mNextChecksum += KEYFRAME_STEP;
+    }
+}
+
+void
+Communicator::CheckChecksums()
+{
+    assert(mMode == COMMUNICATOR_MODE_SERVER);
+
+    unsigned now = mWorld->GetCurrentTimestamp();
+    if (now < CHECKSUM_CONFIRM_TICKS)
+        return;
+    unsigned settled = now - CHECKSUM_CONFIRM_TICKS;
+
+    // Clients run ahead of us, so some of these may not have settled for us
+    // yet. We hang on to those for later.
+    std::deque<ChecksumMessage> notYet;
+    while (!mPendingChecksums.empty()) {
+        ChecksumMessage message = mPendingChecksums.front();
+        mPendingChecksums.pop_front();
+        if (message.timestamp > settled) {
+            notYet.push_back(message);
+            continue;
+        }
+
+        // If we've resynchronized them since, this is old news. And if we
+        // don't have the keyframe any more, there's nothing to compare.
+        unsigned playerID = message.playerID;
+        if (mLastResync.count(playerID) &&
+            message.timestamp <= mLastResync[playerID])
+            continue;
+        uint32_t ours;
+        if (!mTimeline->GetChecksum(message.timestamp, ours))
+            continue;
+
+        if (ours == message.checksum) {
+            mLastAgreed[playerID] = message.timestamp;
+            continue;
+        }
+
+        // They've diverged. Checksums arrive in order, so this is the first
+        // one that's wrong.
+        printf("Warning - Player %u diverged between ticks %u and %u "
+               "(checksum %08x, expected %08x). Resynchronizing.\n", playerID,
+               mLastAgreed.count(playerID) ? mLastAgreed[playerID] : 0,
+               message.timestamp, message.checksum, ours);
+        SendWorldState(playerID);
+        mLastResync[playerID] = now;
+    }
+    mPendingChecksums.swap(notYet);
+}
+
+void
+Communicator::ApplyWorldState(Payload& payload)
+{
+    assert(mMode == COMMUNICATOR_MODE_CLIENT);
+
+    // Unpack
+    WorldState state;
+    if (!state.Deserialize((char*)payload.data, payload.GetDataSize())) {
+        printf("Warning - Received malformed world state. Dropping.\n");
+        return;
+    }
+
+    // Take the server's word for it. The snapshot spent some time on the
+    // wire, so the timeline rebuilds from it up to our present, keeping the
+    // inputs it has since then.
+    mTimeline->Resync(state);
+
+    // Keyframes from before the snapshot are gone, so our checksums pick
+    // up at the next one after it
+    mNextChecksum = (state.timestamp / KEYFRAME_STEP + 1) * KEYFRAME_STEP;
+}
+
+void
+Communicator::SendClockSync()
+{
+    assert(mMode == COMMUNICATOR_MODE_CLIENT);
+    assert(mClock);
+
+    ClockSyncMessage message;
+    message.playerID = mPlayerID;
+    message.clientSend = mClock->NowPrecise();
+    message.serverReceive = message.serverSend = 0.0;
+    message.roundTrip = mRoundTrip;
+    message.maxRoundTrip = 0.0;
+
+    Payload payload(PAYLOAD_TYPE_CLOCKSYNC, &message);
+    mSocketHandler.SendToAll(payload);
+
+    mLastClockSync = mClock->Now();
+}
+
+void
+Communicator::HandleClockSync(ClockSyncMessage& message)
+{
+    // Without a clock, we have nothing to offer
+    if (!mClock)
+        return;
+
+    // Servers fill in their time and send it right back. We don't spend any
+    // meaningful time between receiving and sending.
+    if (mMode == COMMUNICATOR_MODE_SERVER) {
+
+        // Keep track of everybody's round trip, and let them know the worst
+        mClientRoundTrips[message.playerID] = message.roundTrip;
+        double maxRoundTrip = 0.0;
+        for (std::map<unsigned, double>::iterator it = mClientRoundTrips.begin();
+             it != mClientRoundTrips.end(); ++it)
+            maxRoundTrip = MAX(maxRoundTrip, it->second);
+        AdaptInputDelay(maxRoundTrip);
+
+        message.serverReceive = message.serverSend = mClock->NowPrecise();
+        message.maxRoundTrip = maxRoundTrip;
+        Payload payload(PAYLOAD_TYPE_CLOCKSYNC, &message);
+        mSocketHandler.SendTo(payload, message.playerID);
+        return;
+    }
+
+    // Clients compute the round trip and offset the same way NTP does
+    double now = mClock->NowPrecise();
+    ClockSample sample;
+    sample.roundTrip = (now - message.clientSend) -
+                       (message.serverSend - message.serverReceive);
+    sample.offset = ((message.serverReceive - message.clientSend) +
+                     (message.serverSend - now)) / 2.0;
+    sample.slewAtSample = mClock->GetTotalSlew();
+
+    // Keep a window of recent samples
+    mClockSamples.push_back(sample);
+    if (mClockSamples.size() > CLOCKSYNC_WINDOW)
+        mClockSamples.pop_front();
+
+    // Trust the sample with the shortest round trip. It had the least time
+    // to pick up queueing delay in one direction but not the other, so its
+    // offset is the most accurate.
+    const ClockSample* best = &mClockSamples[0];
+    for (unsigned i = 1; i < mClockSamples.size(); ++i)
+        if (mClockSamples[i].roundTrip < best->roundTrip)
+            best = &mClockSamples[i];
+    mRoundTrip = best->roundTrip;
+
+    // Work out how far off we are now, taking into account any slewing we've
+    // done since that sample was taken.
+    double offset = best->offset - (mClock->GetTotalSlew() - best->slewAtSample);
+
+    // We want our inputs to arrive at the server just before it needs them,
+    // so we run ahead of it by the one-way trip plus a little margin.
+    double lead = best->roundTrip / 2.0 + CLOCKSYNC_MARGIN_TICKS;
+    mClock->Slew(offset + lead);
+
+    // Our input delay depends on the worst round trip out there, which may
+    // well be ours.
+    AdaptInputDelay(MAX(message.maxRoundTrip, mRoundTrip));
+}
+
+void
+Communicator::AdaptInputDelay(double maxRoundTrip)
+{
+    if (!mAdaptiveInputDelay)
+        return;
+
+    // With synchronized clocks, input we send reaches any given client about
+    // one of that client's round trips after we stamp it. So if we stamp
+    // inputs the worst round trip (plus the sync margin) into the future,
+    // they reach everybody in time.
+    double delay = ceil(maxRoundTrip + CLOCKSYNC_MARGIN_TICKS);
+    mInputDelay = (unsigned) MIN(delay, (double) INPUT_DELAY_MAX);
 }
 
 void
 Communicator::ApplyInput(UserInput& input)
 {
+    // Number it, so that it can be told apart from others on the same tick
+    input.sequence = mNextInputSequence++;
+
     // Apply it to our timeline
     mTimeline->AddInput(input);
 
-    // Create the payload
-    Payload outgoing;
-    outgoing.type = PAYLOAD_TYPE_USERINPUT;
-    outgoing.data = &input;
+    // Servers send it to all clients, subject to interest management
+    if (mMode == COMMUNICATOR_MODE_SERVER) {
+        mSocketHandler.RelayInput(input, mInterest);
+        return;
+    }
 
-    // Send to all. For servers, this means all clients. For clients, this
-    // means just the server.
+    // Clients just send it to the server
+    Payload outgoing(PAYLOAD_TYPE_USERINPUT, &input);
     mSocketHandler.SendToAll(outgoing);
 }
@@ -2,40 +2,154 @@
 #define COMMUNICATOR_H
 
 #include "UserInput.h"
+#include "InterestManager.h"
 #include <Sockets/SocketHandler.h>
 #include <Sockets/TcpSocket.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
 
 #define GROWBLES_PORT 9323
 
+// Number of ticks between clock synchronization pings
+#define CLOCKSYNC_INTERVAL 16
+
+// Number of recent clock synchronization samples we choose from
+#define CLOCKSYNC_WINDOW 8
+
+// How far ahead of the server's clock we want our inputs to arrive, in ticks,
+// on top of the one-way trip time.
+#define CLOCKSYNC_MARGIN_TICKS 1.0
+
+// The largest input delay we'll pick adaptively, in ticks
+#define INPUT_DELAY_MAX 8
+
+// How old a tick has to be before we consider it settled and compare
+// checksums for it. Input arriving later than this for a tick will look
+// like a desync.
+#define CHECKSUM_CONFIRM_TICKS 64
+
+// When simulating packet loss, how much later a lost packet shows up. We're
+// on TCP, so nothing is ever really lost; it just gets retransmitted.
+#define NETCONDITIONS_RETRANSMIT_MS 200.0f
+
 class WorldModel;
 class UserInput;
 class GrowblesSocket;
+class GrowblesHandler;
 struct SceneGraph;
 class Communicator;
 class Timeline;
+class Gameclock;
+template <class X> class ListenSocket;
 
 typedef enum {
     PAYLOAD_TYPE_NONE = 0,
     PAYLOAD_TYPE_WORLDSTATE,
-    PAYLOAD_TYPE_USERINPUT
+    PAYLOAD_TYPE_USERINPUT,
+    PAYLOAD_TYPE_USERINPUT_BATCH,
+    PAYLOAD_TYPE_CLOCKSYNC,
+    PAYLOAD_TYPE_CHECKSUM
 } PayloadType;
 
+/*
+ * Clock synchronization ping. Clients fill in the send time and send it to
+ * the server, which fills in its receive and send times and sends it back.
+ * All times are in (fractional) ticks.
+ */
+struct ClockSyncMessage {
+    uint32_t playerID;
+    double clientSend;
+    double serverReceive;
+    double serverSend;
+
+    // The client's current round trip estimate, so the server knows
+    double roundTrip;
+
+    // Filled in by the server: the worst round trip of any client
+    double maxRoundTrip;
+};
+
+/*
+ * A client's checksum of its world state at a settled tick, sent to the
+ * server for comparison.
+ */
+struct ChecksumMessage {
+    uint32_t playerID;
+    uint32_t timestamp;
+    uint32_t checksum;
+};
+
+/*
+ * A completed clock synchronization exchange, from the client's point of
+ * view.
+ */
+struct ClockSample {
+
+    // Round trip time, not counting time spent on the server
+    double roundTrip;
+
+    // How far ahead of us the server's clock was
+    double offset;
+
+    // Gameclock::GetTotalSlew() when we took the sample. Any slewing we've
+    // done since then has to be taken out of the offset.
+    double slewAtSample;
+};
+
+/*
+ * Artificial network conditions, applied to everything we send. Used for
+ * testing.
+ */
+struct NetConditions {
+
+    NetConditions() : latencyMS(0.0f), jitterMS(0.0f), lossPercent(0.0f) {};
+
+    // Are we messing with anything?
+    bool IsActive() const {
+        return latencyMS > 0.0f || jitterMS > 0.0f || lossPercent > 0.0f;
+    };
+
+    // Fixed one-way delay
+    float latencyMS;
+
+    // Extra random delay, up to this much
+    float jitterMS;
+
+    // Chance of a send being "lost" and showing up
+    // NETCONDITIONS_RETRANSMIT_MS late
+    float lossPercent;
+};
+
 struct Payload {
 
-    Payload() : type(PAYLOAD_TYPE_NONE), data(NULL), ownData(false) {};
-    Payload(PayloadType t, void* d) : type(t), data(d), ownData(false) {};
+    Payload() : type(PAYLOAD_TYPE_NONE), data(NULL), size(0), ownData(false) {};
+    Payload(PayloadType t, void* d) : type(t), data(d), size(0), ownData(false) {};
+    Payload(PayloadType t, void* d, unsigned s) : type(t), data(d), size(s)
+                                                , ownData(false) {};
 
     ~Payload();
 
     // Gets the data size for a given type
     unsigned GetDataSize();
 
+    // Does this type of payload have a variable size?
+    static bool IsVariableSize(PayloadType t);
+
+    // Appends the wire encoding of this payload (header and data) to
+    // the given buffer.
+    void Encode(std::string& buffer);
+
     // The type of the payload
     PayloadType type;
 
     // Pointer to the payload data
     void* data;
 
+    // Size of the data. Only used for variable-size types.
+    unsigned size;
+
     // Is the data owned by us? Default no.
     bool ownData;
 
@@ -58,6 +172,9 @@ class GrowblesSocket : public TcpSocket {
     // When we accept a client connection as server
     virtual void OnAccept();
 
+    // When the handler is about to delete us
+    virtual void OnDelete();
+
     // Gets/Sets the ID of the remote player this socket connects
     // us to.
     unsigned GetRemoteID();
@@ -66,6 +183,10 @@ class GrowblesSocket : public TcpSocket {
     // Sends a payload
     void SendPayload(Payload& payload);
 
+    // Sends a payload that has already been encoded with Payload::Encode().
+    // This lets us encode once when sending the same thing to many sockets.
+    void SendEncoded(const std::string& encoded);
+
     // Do we have a payload ready for reading?
     bool HasPayload();
 
@@ -73,11 +194,39 @@ class GrowblesSocket : public TcpSocket {
     // HasPayload() must return true first;
     void GetPayload(Payload& payload);
 
+    // Queues an input to be sent later, in a batch with others.
+    void DeferInput(const UserInput& input);
+
+    // Sends any queued inputs as a single batch.
+    void FlushDeferredInputs();
+
+    // Sends anything held back by artificial network conditions whose time
+    // has come.
+    void SendDelayed(double now);
+
+    // Has this connection been accepted, but not yet been sent the world?
+    // We hold off on sending anything else to such sockets.
+    bool NeedsBootstrap() { return mNeedsBootstrap; };
+    void SetNeedsBootstrap(bool needsBootstrap) { mNeedsBootstrap = needsBootstrap; };
+
     protected:
 
+    // Our handler, looked up once so that sending doesn't have to cast
+    GrowblesHandler* mHandler;
+
     // The ID of the remote player this socket connects us to.
     unsigned mRemoteID;
 
+    // See NeedsBootstrap()
+    bool mNeedsBootstrap;
+
+    // Inputs waiting to go out in the next batch
+    std::vector<UserInput> mDeferredInputs;
+
+    // Encoded payloads held back by artificial network conditions, along
+    // with the time to send them, in order.
+    std::deque<std::pair<double, std::string> > mDelayed;
+
     // Incoming payload
     Payload mIncoming;
 };
@@ -89,10 +238,17 @@ class GrowblesHandler : public SocketHandler {
     // Constructor
     GrowblesHandler(Communicator& c);
 
-    // Adds each connection as a player in the world.
-    //
-    // Should only be called on the server.
-    void AddPlayers(WorldModel& model);
+    // Registers/unregisters an established connection to another player.
+    void AddPeer(GrowblesSocket* socket);
+    void RemovePeer(GrowblesSocket* socket);
+
+    // Gets our established connections
+    const std::vector<GrowblesSocket*>& GetPeers() { return mPeers; };
+
+    // Gets the IDs of players whose connections closed since we last
+    // asked, and forgets them. Only players who got the world count.
+    void TakeDepartedPeers(std::vector<unsigned>& departedOut);
+    unsigned GetNumPeers() { return mPeers.size(); };
 
     // Sends a payload to all connected sockets
     void SendToAll(Payload& payload);
@@ -104,6 +260,28 @@ class GrowblesHandler : public SocketHandler {
     // Sends a payload to a specific player
     void SendTo(Payload& payload, unsigned playerID);
 
+    // Sends a payload to the sockets still waiting for the world
+    void SendToNewPeers(Payload& payload);
+
+    // Forwards an input to everybody but the player it came from. Players
+    // near the source get it immediately, and everybody else gets it with
+    // the next call to FlushDeferredInputs().
+    void RelayInput(UserInput& input, InterestManager& interest);
+
+    // Sends all the inputs held back by RelayInput().
+    void FlushDeferredInputs();
+
+    // Sets/gets the artificial network conditions for everything we send.
+    void SetNetConditions(const NetConditions& conditions);
+    const NetConditions& GetNetConditions() { return mNetConditions; };
+
+    // Gets the time a payload sent now should go out, given our network
+    // conditions, in seconds.
+    double GetReleaseTime();
+
+    // Sends everything held back by network conditions that's due.
+    void SendDelayed();
+
     // Do any of the sockets have a payload?
     bool HasPayload();
 
@@ -114,15 +292,28 @@ class GrowblesHandler : public SocketHandler {
     // Gets our Communicator
     Communicator* GetCommunicator() { return mCommunicator; };
 
-    // For some dumb reason SocketHandler has a staging area for sockets (m_add),
-    // and includes the number of staged sockets in GetCount(). We want to know
-    // how many sockets are actually active.
-    unsigned GetNumActiveSockets() { return m_sockets.size(); };
-
     protected:
 
     // The Communicator possessing this handler
     Communicator* mCommunicator;
+
+    // Our connections to other players. We keep these separately from
+    // m_sockets, which also holds the listen socket on servers, so that
+    // we don't have to filter and cast on every send.
+    std::vector<GrowblesSocket*> mPeers;
+    std::map<unsigned, GrowblesSocket*> mPeersByID;
+
+    // Index into mPeers where we last found a payload. We resume searching
+    // from here, so that draining every socket is linear in the number of
+    // sockets.
+    unsigned mReadCursor;
+
+    // See TakeDepartedPeers()
+    std::vector<unsigned> mDepartedPeers;
+
+    // Artificial network conditions, and the clock we use for them
+    NetConditions mNetConditions;
+    sf::Clock mNetClock;
 };
 
 typedef enum {
@@ -148,8 +339,52 @@ class Communicator {
     void SetServer(const char* server);
 
     /*
-     * Sets the number of clients we're expecting. Only valid
-     * for server mode.
+     * Gives us a clock to keep synchronized. Clients slew their clock to run
+     * just ahead of the server's, and servers use theirs as the reference.
+     * Without a clock, we don't do clock synchronization.
+     */
+    void SetClock(Gameclock& clock);
+
+    /*
+     * Gets our most recent estimate of the round trip time to the server,
+     * in ticks. Only valid for clients.
+     */
+    double GetRoundTrip() { return mRoundTrip; };
+
+    /*
+     * Sets a fixed input delay, in ticks. Local input is stamped this far
+     * in the future, which gives it time to reach everybody else before
+     * they need it, at the cost of making it feel less responsive.
+     */
+    void SetInputDelay(unsigned ticks);
+
+    /*
+     * Enables or disables picking the input delay automatically, based on
+     * the worst round trip time of anybody in the game.
+     */
+    void SetAdaptiveInputDelay(bool enabled);
+
+    /*
+     * Gets the current input delay, in ticks.
+     */
+    unsigned GetInputDelay() { return mInputDelay; };
+
+    /*
+     * Gets the timestamp to stamp local input with at the given time,
+     * taking the input delay into account. The result never goes
+     * backwards, even if the input delay shrinks, so that our inputs
+     * stay in order.
+     */
+    unsigned GetInputTimestamp(unsigned now);
+
+    /*
+     * Applies artificial latency, jitter and loss to everything we send.
+     */
+    void SetNetConditions(const NetConditions& conditions);
+
+    /*
+     * Sets the number of clients we wait for before starting the game. More
+     * clients may join once the game is running. Only valid for server mode.
      */
     void SetNumClientsExpected(unsigned n);
 
@@ -159,7 +394,8 @@ class Communicator {
      * For client mode, this establishes a connection to the server.
      *
      * For server mode, this waits until the appropriate number of clients
-     * have connected.
+     * have connected. We keep listening afterwards, so that others can join
+     * late.
      */
     void Connect();
 
@@ -179,6 +415,12 @@ class Communicator {
      */
     unsigned GetPlayerID() { return mPlayerID; } ;
 
+    /*
+     * Gets the sequence number the next input passed to ApplyInput() will
+     * be given.
+     */
+    unsigned GetNextInputSequence() { return mNextInputSequence; };
+
     /*
      * Applies input. This adds the input to our timeline, and forwards
      * it to all connected sockets as well.
@@ -193,9 +435,98 @@ class Communicator {
     void ConnectAsClient();
     void ConnectAsServer();
 
+    /*
+     * Server only. Adds any newly connected clients to the world and
+     * removes any whose connections have closed, telling everybody already
+     * playing with join and leave inputs. The new clients get a snapshot of
+     * the result.
+     */
+    void UpdateClients();
+
+    /*
+     * Server only. Adds a join or leave input for the given player to our
+     * timeline, and sends it to everybody already playing.
+     */
+    void ChangeRoster(unsigned playerID, uint32_t change);
+
+    /*
+     * Server only. Sends a snapshot of the world to the given player, or to
+     * all new clients if playerID is 0.
+     */
+    void SendWorldState(unsigned playerID = 0);
+
+    /*
+     * Client only. Resynchronizes our timeline with a snapshot from the
+     * server.
+     */
+    void ApplyWorldState(Payload& payload);
+
+    /*
+     * Client only. Sends the server a clock synchronization ping.
+     */
+    void SendClockSync();
+
+    /*
+     * Servers answer clock synchronization pings, and clients use the
+     * answers to adjust their clocks.
+     */
+    void HandleClockSync(ClockSyncMessage& message);
+
+    /*
+     * If we're choosing the input delay automatically, updates it for the
+     * given worst-case round trip.
+     */
+    void AdaptInputDelay(double maxRoundTrip);
+
+    /*
+     * Client only. Sends the server checksums for any keyframes that have
+     * settled since last time.
+     */
+    void SendChecksums();
+
+    /*
+     * Server only. Compares the checksums clients have sent us against our
+     * own, once we've settled those ticks too. Clients that have diverged
+     * get a fresh snapshot.
+     */
+    void CheckChecksums();
+
     // Timeline
     Timeline* mTimeline;
 
+    // World. Valid once we've bootstrapped.
+    WorldModel* mWorld;
+
+    // Clock. May be NULL.
+    Gameclock* mClock;
+
+    // Valid for clients. Clock synchronization state.
+    std::deque<ClockSample> mClockSamples;
+    unsigned mLastClockSync;
+    double mRoundTrip;
+
+    // Valid for servers. The latest round trip reported by each client.
+    std::map<unsigned, double> mClientRoundTrips;
+
+    // Input delay state
+    unsigned mInputDelay;
+    bool mAdaptiveInputDelay;
+    unsigned mLastInputTimestamp;
+
+    // Sequence number for the next input we send
+    unsigned mNextInputSequence;
+
+    // Valid for clients. The next keyframe we'll send a checksum for.
+    unsigned mNextChecksum;
+
+    // Valid for servers. Checksums we haven't been able to check yet.
+    std::deque<ChecksumMessage> mPendingChecksums;
+
+    // Valid for servers. For each client, the last tick we know they agreed
+    // with us at, and the tick we last resynchronized them at.
+    std::map<unsigned, unsigned> mLastAgreed;
+    std::map<unsigned, unsigned> mLastResync;
+
     // Client or server?
     CommunicatorMode mMode;
 
@@ -211,8 +542,18 @@ class Communicator {
     // Valid for clients
     unsigned mNumClientsExpected;
 
+    // Valid for servers. Accepts late joiners.
+    ListenSocket<GrowblesSocket>* mListenSocket;
+
     // Our socket handler
     GrowblesHandler mSocketHandler;
+
+    // Valid for servers. Decides who gets which inputs at full rate.
+    InterestManager mInterest;
+
+    // Valid for servers. Timestamp of the last time we sent far-away players
+    // their batched inputs.
+    unsigned mLastFarFlush;
 };
 
 #endif /* COMMUNICATOR_H */
@@ -0,0 +1,146 @@
+#include "FrameProfiler.h"
+#include <math.h>
+#include <string.h>
+
+// Phase names, for reporting
+static const char* sPhaseNames[FRAMEPHASE_COUNT] = {
+    "input", "network", "wait", "physics", "shadow", "scene", "swap", "frame",
+    "gpushadow", "gpuscene", "gpuenvmap"
+};
+
+/*
+ * Which bucket does a duration go in?
+ */
+static unsigned
+BucketForSeconds(float seconds)
+{
+    float micros = seconds * 1000000.0f;
+    if (micros <= 1.0f)
+        return 0;
+
+    unsigned bucket = (unsigned) (log(micros) / log(2.0) *
+                                  FRAMEPROFILER_BUCKETS_PER_OCTAVE);
+    return MIN(bucket, FRAMEPROFILER_NUM_BUCKETS - 1);
+}
+
+/*
+ * Upper edge of a bucket, in seconds.
+ */
+static float
+SecondsForBucket(unsigned bucket)
+{
+    return pow(2.0, (bucket + 1) / (double) FRAMEPROFILER_BUCKETS_PER_OCTAVE) /
+           1000000.0;
+}
+
+/*
+ * FrameProfiler methods.
+ */
+
+FrameProfiler::FrameProfiler() : mName("Frame")
+                               , mFrames(0)
+                               , mReportInterval(FRAMEPROFILER_REPORT_INTERVAL)
+{
+    Reset();
+}
+
+void
+FrameProfiler::Record(FramePhase phase, float seconds)
+{
+    AddSample(mPhases[phase], seconds);
+}
+
+void
+FrameProfiler::RecordNamed(const std::string& name, float seconds)
+{
+    AddSample(mNamed[name], seconds);
+}
+
+void
+FrameProfiler::EndFrame()
+{
+    ++mFrames;
+    if (mReportInterval == 0 || mFrames < mReportInterval)
+        return;
+
+    Report();
+    Reset();
+}
+
+float
+FrameProfiler::GetPercentile(FramePhase phase, float percentile)
+{
+    return GetPercentile(mPhases[phase], percentile);
+}
+
+void
+FrameProfiler::AddSample(PhaseHistogram& histogram, float seconds)
+{
+    ++histogram.count;
+    histogram.max = MAX(histogram.max, seconds);
+    ++histogram.buckets[BucketForSeconds(seconds)];
+}
+
+float
+FrameProfiler::GetPercentile(PhaseHistogram& histogram, float percentile)
+{
+    if (histogram.count == 0)
+        return 0.0f;
+
+    // Walk the buckets until we've seen enough samples
+    unsigned target = (unsigned) ceil(histogram.count * percentile / 100.0f);
+    unsigned seen = 0;
+    for (unsigned i = 0; i < FRAMEPROFILER_NUM_BUCKETS; ++i) {
+        seen += histogram.buckets[i];
+        if (seen >= target && seen > 0)
+            return MIN(SecondsForBucket(i), histogram.max);
+    }
+
+    return histogram.max;
+}
+
+void
+FrameProfiler::Report()
+{
+    printf("%s timing over %u frames (ms):\n", mName.c_str(), mFrames);
+    printf("    %-16s %8s %8s %8s %8s\n", "phase", "count", "p50", "p99", "max");
+    for (unsigned i = 0; i < FRAMEPHASE_COUNT; ++i)
+        if (mPhases[i].count > 0)
+            ReportLine(sPhaseNames[i], mPhases[i]);
+    for (std::map<std::string, PhaseHistogram>::iterator it = mNamed.begin();
+         it != mNamed.end(); ++it)
+        ReportLine(it->first.c_str(), it->second);
+}
+
+void
+FrameProfiler::ReportLine(const char* name, PhaseHistogram& histogram)
+{
+    printf("    %-16s %8u %8.3f %8.3f %8.3f\n", name, histogram.count,
+           GetPercentile(histogram, 50.0f) * 1000.0f,
+           GetPercentile(histogram, 99.0f) * 1000.0f,
+           histogram.max * 1000.0f);
+}
+
+void
+FrameProfiler::Reset()
+{
+    memset(mPhases, 0, sizeof(mPhases));
+    mNamed.clear();
+    mFrames = 0;
+}
+
+/*
+ * ScopedPhase methods.
+ */
+
+ScopedPhase::ScopedPhase(FrameProfiler* profiler, FramePhase phase)
+                                                  : mProfiler(profiler)
+                                                  , mPhase(phase)
+{
+}
+
+ScopedPhase::~ScopedPhase()
+{
+    if (mProfiler != NULL)
+        mProfiler->Record(mPhase, mTimer.GetElapsedTime());
+}
@@ -0,0 +1,156 @@
+#ifndef FRAMEPROFILER_H
+#define FRAMEPROFILER_H
+
+#include "Framework.h"
+#include <map>
+#include <string>
+
+// Number of histogram buckets. Buckets are logarithmic, with
+// FRAMEPROFILER_BUCKETS_PER_OCTAVE buckets for every doubling of duration,
+// starting at one microsecond.
+#define FRAMEPROFILER_BUCKETS_PER_OCTAVE 4
+#define FRAMEPROFILER_NUM_BUCKETS 96
+
+// Number of frames between reports
+#define FRAMEPROFILER_REPORT_INTERVAL 300
+
+/*
+ * The phases of a frame we keep track of.
+ */
+typedef enum {
+    FRAMEPHASE_INPUT = 0,
+    FRAMEPHASE_NETWORK,
+    FRAMEPHASE_WAIT,
+    FRAMEPHASE_PHYSICS,
+    FRAMEPHASE_SHADOW,
+    FRAMEPHASE_SCENE,
+    FRAMEPHASE_SWAP,
+    FRAMEPHASE_FRAME,
+    FRAMEPHASE_GPU_SHADOW,
+    FRAMEPHASE_GPU_SCENE,
+    FRAMEPHASE_GPU_ENVMAP,
+    FRAMEPHASE_COUNT
+} FramePhase;
+
+/*
+ * Keeps a histogram of how long each phase of the frame takes, and logs
+ * percentiles every so often.
+ *
+ * CPU render phases only include the time it takes to submit the work to
+ * the GPU. The GPU phases, and anything recorded by name (such as
+ * individual meshes), come from a GpuTimer.
+ */
+class FrameProfiler {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    FrameProfiler();
+
+    /*
+     * Records that a phase took the given number of seconds.
+     */
+    void Record(FramePhase phase, float seconds);
+
+    /*
+     * Records a duration for something that isn't a standard phase.
+     */
+    void RecordNamed(const std::string& name, float seconds);
+
+    /*
+     * Marks the end of a frame. Reports and starts over every
+     * reportInterval frames.
+     */
+    void EndFrame();
+
+    /*
+     * Sets the number of frames between reports. 0 disables reporting.
+     */
+    void SetReportInterval(unsigned frames) { mReportInterval = frames; };
+
+    /*
+     * Sets what reports call this profiler, for telling several apart.
+     * Defaults to "Frame".
+     */
+    void SetName(const char* name) { mName = name; };
+
+    /*
+     * Gets the given percentile (0-100) of the durations recorded for a
+     * phase since the last report, in seconds. This is the upper edge of
+     * the histogram bucket it falls in.
+     */
+    float GetPercentile(FramePhase phase, float percentile);
+
+    /*
+     * Gets the longest duration recorded for a phase since the last report,
+     * in seconds.
+     */
+    float GetMax(FramePhase phase) { return mPhases[phase].max; };
+
+    /*
+     * Prints percentiles for every phase to stdout.
+     */
+    void Report();
+
+    /*
+     * Clears all recorded durations.
+     */
+    void Reset();
+
+    protected:
+
+    struct PhaseHistogram {
+        unsigned count;
+        float max;
+        unsigned buckets[FRAMEPROFILER_NUM_BUCKETS];
+    };
+
+    /*
+     * Histogram helpers.
+     */
+    static void AddSample(PhaseHistogram& histogram, float seconds);
+    static float GetPercentile(PhaseHistogram& histogram, float percentile);
+    static void ReportLine(const char* name, PhaseHistogram& histogram);
+
+    // A histogram for each phase
+    PhaseHistogram mPhases[FRAMEPHASE_COUNT];
+
+    // Histograms for anything else
+    std::map<std::string, PhaseHistogram> mNamed;
+
+    // What we call ourselves in reports
+    std::string mName;
+
+    // Frames since the last report
+    unsigned mFrames;
+    unsigned mReportInterval;
+};
+
+/*
+ * Times the enclosing scope as the given phase. A NULL profiler is allowed,
+ * and does nothing.
+ */
+class ScopedPhase {
+
+    public:
+
+    /*
+     * Constructor. Starts timing.
+     */
+    ScopedPhase(FrameProfiler* profiler, FramePhase phase);
+
+    /*
+     * Destructor. Records the time.
+     */
+    ~ScopedPhase();
+
+    protected:
+
+    FrameProfiler* mProfiler;
+    FramePhase mPhase;
+    sf::Clock mTimer;
+};
+
+#endif /* FRAMEPROFILER_H */
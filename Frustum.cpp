@@ -0,0 +1,65 @@
+#include "Frustum.h"
+#include <math.h>
+
+Frustum::Frustum() : mInfinite(true)
+{
+}
+
+void
+Frustum::Set(const Matrix& clip)
+{
+    // A point is inside when -w <= x, y, z <= w in clip space. Each of those
+    // is a plane made of the w row plus or minus one of the others.
+    const Vector& w = clip[3];
+    for (unsigned i = 0; i < 3; ++i) {
+        const Vector& row = clip[i];
+        mPlanes[2 * i].Set(w.x + row.x, w.y + row.y, w.z + row.z, w.w + row.w);
+        mPlanes[2 * i + 1].Set(w.x - row.x, w.y - row.y, w.z - row.z,
+                               w.w - row.w);
+    }
+
+    // Normalize, so that the sphere test can work in distances
+    for (unsigned i = 0; i < 6; ++i) {
+        Vector& plane = mPlanes[i];
+        float length = plane.Norm3();
+        assert(length > 0.0f);
+        plane.Set(plane.x / length, plane.y / length, plane.z / length,
+                  plane.w / length);
+    }
+
+    mInfinite = false;
+}
+
+bool
+Frustum::TestSphere(const Vector& center, float radius) const
+{
+    if (mInfinite)
+        return true;
+
+    for (unsigned i = 0; i < 6; ++i) {
+        const Vector& plane = mPlanes[i];
+        if (plane.x * center.x + plane.y * center.y + plane.z * center.z +
+            plane.w < -radius)
+            return false;
+    }
+    return true;
+}
+
+bool
+Frustum::TestBox(const Vector& boundsMin, const Vector& boundsMax) const
+{
+    if (mInfinite)
+        return true;
+
+    // The box is out if even its corner furthest along a plane's normal is
+    // behind that plane
+    for (unsigned i = 0; i < 6; ++i) {
+        const Vector& plane = mPlanes[i];
+        float x = plane.x >= 0.0f ? boundsMax.x : boundsMin.x;
+        float y = plane.y >= 0.0f ? boundsMax.y : boundsMin.y;
+        float z = plane.z >= 0.0f ? boundsMax.z : boundsMin.z;
+        if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
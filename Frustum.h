@@ -0,0 +1,56 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "Framework.h"
+#include "Vector.h"
+#include "Matrix.h"
+
+/*
+ * The six planes bounding what a projection can see, for culling things
+ * before we draw them.
+ *
+ * Planes are pulled straight out of a projection * view matrix (see Gribb
+ * and Hartmann, "Fast Extraction of Viewing Frustum Planes from the
+ * World-View-Projection Matrix"), so this works for perspective and
+ * orthographic projections alike. The tests are conservative: they can
+ * pass things that are just outside a corner, but never fail anything
+ * that's visible.
+ */
+class Frustum {
+
+    public:
+
+    /*
+     * Constructor. Everything is visible until we're given a matrix.
+     */
+    Frustum();
+
+    /*
+     * Extracts the planes from a matrix taking world space to clip space.
+     */
+    void Set(const Matrix& clip);
+
+    /*
+     * Makes everything visible.
+     */
+    void SetInfinite() { mInfinite = true; };
+
+    /*
+     * Tests a bounding sphere, and an axis-aligned bounding box, in world
+     * space. Returns false if it's definitely out of view.
+     */
+    bool TestSphere(const Vector& center, float radius) const;
+    bool TestBox(const Vector& boundsMin, const Vector& boundsMax) const;
+
+    protected:
+
+    // Left, right, bottom, top, near and far. Each is (a, b, c, d), with a
+    // unit normal pointing inwards, so a point p is inside when
+    // a*p.x + b*p.y + c*p.z + d >= 0.
+    Vector mPlanes[6];
+
+    // Whether we cull nothing
+    bool mInfinite;
+};
+
+#endif /* FRUSTUM_H */
@@ -5,16 +5,23 @@ Gameclock::Gameclock(unsigned tickMS) : mTimestamp(0)
                                       , mLastStep(0)
                                       , mTickDuration(tickMS / 1000.0)
                                       , mClockRemainder(0.0f)
+                                      , mPendingSlew(0.0)
+                                      , mTotalSlew(0.0)
 {
 }
 
 void
 Gameclock::Start()
 {
-    assert(mTimestamp == 0);
     mClock.Reset();
 }
 
+void
+Gameclock::Set(unsigned timestamp)
+{
+    mTimestamp = timestamp;
+}
+
 unsigned
 Gameclock::Then() const
 {
@@ -23,6 +30,19 @@ Gameclock::Then() const
     return mTimestamp - mLastStep;
 }
 
+double
+Gameclock::NowPrecise() const
+{
+    return mTimestamp +
+           (mClock.GetElapsedTime() + mClockRemainder) / mTickDuration;
+}
+
+void
+Gameclock::Slew(double ticks)
+{
+    mPendingSlew = ticks;
+}
+
 float
 Gameclock::GetDeltaTime() const
 {
@@ -33,10 +53,29 @@ void
 Gameclock::Tick()
 {
     // Busywait until a tick has passed
-    float elapsedTime;
-    do {
-        elapsedTime = mClock.GetElapsedTime() + mClockRemainder;
-    } while (elapsedTime < mTickDuration);
+    while (!TryTick());
+}
+
+bool
+Gameclock::TryTick()
+{
+    // If we're slewing, pretend a little more or less time has passed than
+    // really has, up to a fraction of a tick.
+    float slewTicks = (float) mPendingSlew;
+    if (slewTicks > GAMECLOCK_MAX_SLEW)
+        slewTicks = GAMECLOCK_MAX_SLEW;
+    if (slewTicks < -GAMECLOCK_MAX_SLEW)
+        slewTicks = -GAMECLOCK_MAX_SLEW;
+    float slewSeconds = slewTicks * mTickDuration;
+
+    // Has a tick passed?
+    float elapsedTime = mClock.GetElapsedTime() + mClockRemainder + slewSeconds;
+    if (elapsedTime < mTickDuration)
+        return false;
+
+    // Only now is the slew used up
+    mPendingSlew -= slewTicks;
+    mTotalSlew += slewTicks;
 
     // Reset the clock
     mClock.Reset();
@@ -55,4 +94,5 @@ Gameclock::Tick()
 
     // Remember the step we took
     mLastStep = nTicks;
+    return true;
 }
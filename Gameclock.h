@@ -5,18 +5,23 @@
 
 #define GAMECLOCK_TICK_MS 32
 
+// The largest fraction of a tick we'll speed up or slow down by in a single
+// tick when slewing the clock.
+#define GAMECLOCK_MAX_SLEW 0.25f
+
 class Gameclock {
 
     public:
     /*
      * Constructor.
      *
-     * We start at t=0.
+     * We start at t=0, unless told otherwise with Set().
      */
     Gameclock(unsigned tickMS);
 
     /*
-     * Starts the clock.
+     * Starts the clock. Clients joining a game in progress should Set()
+     * the clock to the world's timestamp first.
      */
     void Start();
 
@@ -34,11 +39,38 @@ class Gameclock {
      */
     void Tick();
 
+    /*
+     * Like Tick(), but never waits. Returns false, leaving the clock alone,
+     * if a whole tick hasn't passed yet.
+     */
+    bool TryTick();
+
     /*
      * Gets the current timestamp.
      */
     unsigned Now() const { return mTimestamp; };
 
+    /*
+     * Gets the current time in ticks, including the fraction of a tick
+     * elapsed since the last Tick(). Used for clock synchronization.
+     */
+    double NowPrecise() const;
+
+    /*
+     * Gradually moves the clock forward (or backward, if negative) by the
+     * given number of ticks. Rather than jumping, subsequent Tick()s run
+     * slightly faster or slower until the adjustment has been made, so
+     * the timestamp never goes backwards.
+     *
+     * This replaces any adjustment still in progress.
+     */
+    void Slew(double ticks);
+
+    /*
+     * Gets the total number of ticks we've been moved by Slew() so far.
+     */
+    double GetTotalSlew() const { return mTotalSlew; };
+
     /*
      * Gets the timestamp before the most recent Tick() call.
      */
@@ -68,6 +100,12 @@ class Gameclock {
 
     // The remainder on the clock after the last tick
     float mClockRemainder;
+
+    // Number of ticks we still have to slew by
+    double mPendingSlew;
+
+    // Number of ticks we've slewed by so far
+    double mTotalSlew;
 };
 
 #endif /* GAMECLOCK_H */
@@ -0,0 +1,174 @@
+#include "GpuTimer.h"
+
+/*
+ * GpuTimer methods.
+ */
+
+GpuTimer::GpuTimer() : mCurrent(0)
+                     , mProfiler(NULL)
+                     , mSupported(false)
+                     , mPerMesh(false)
+                     , mWarnedNotReady(false)
+{
+    mFrames[0].queriesUsed = mFrames[1].queriesUsed = 0;
+}
+
+GpuTimer::~GpuTimer()
+{
+    for (unsigned i = 0; i < 2; ++i)
+        if (mFrames[i].queries.size() > 0)
+            glDeleteQueries(mFrames[i].queries.size(), &mFrames[i].queries[0]);
+}
+
+void
+GpuTimer::Init()
+{
+    // Timestamp queries are core in 3.3, and we only get at them through
+    // GLEW.
+#ifdef FRAMEWORK_USE_GLEW
+    mSupported = GLEW_ARB_timer_query;
+#endif
+    if (!mSupported)
+        printf("Warning - GPU timer queries not supported. GPU timing disabled.\n");
+}
+
+int
+GpuTimer::Begin()
+{
+    if (!IsActive())
+        return GPUTIMER_NONE;
+
+    Span span;
+    span.begin = Timestamp();
+    span.end = 0;
+    span.phase = FRAMEPHASE_COUNT;
+    mFrames[mCurrent].spans.push_back(span);
+    return mFrames[mCurrent].spans.size() - 1;
+}
+
+void
+GpuTimer::End(int handle, FramePhase phase)
+{
+    if (handle == GPUTIMER_NONE)
+        return;
+
+    Span& span = mFrames[mCurrent].spans[handle];
+    span.end = Timestamp();
+    span.phase = phase;
+}
+
+void
+GpuTimer::End(int handle, const std::string& name)
+{
+    if (handle == GPUTIMER_NONE)
+        return;
+
+    Span& span = mFrames[mCurrent].spans[handle];
+    span.end = Timestamp();
+    span.name = name;
+}
+
+void
+GpuTimer::EndFrame()
+{
+    if (!mSupported)
+        return;
+
+    // Switch buffers, and collect what we issued a frame ago
+    mCurrent = 1 - mCurrent;
+    Collect(mFrames[mCurrent]);
+}
+
+GLuint
+GpuTimer::Timestamp()
+{
+    // Grow our query pool if we need to
+    Frame& frame = mFrames[mCurrent];
+    if (frame.queriesUsed == frame.queries.size()) {
+        GLuint query;
+        GL_CHECK(glGenQueries(1, &query));
+        frame.queries.push_back(query);
+    }
+
+    GLuint query = frame.queries[frame.queriesUsed++];
+    GL_CHECK(glQueryCounter(query, GL_TIMESTAMP));
+    return query;
+}
+
+void
+GpuTimer::Collect(Frame& frame)
+{
+    // Queries complete in order, so if the last one is ready, they all are
+    bool ready = true;
+    if (frame.queriesUsed > 0) {
+        GLint available = 0;
+        GL_CHECK(glGetQueryObjectiv(frame.queries[frame.queriesUsed - 1],
+                                    GL_QUERY_RESULT_AVAILABLE, &available));
+        ready = (available != 0);
+    }
+
+    // A GPU that runs a frame behind will do this every frame, so we only
+    // say so once
+    if (!ready && !mWarnedNotReady) {
+        printf("Warning - GPU timer results not ready after a frame. Dropping "
+               "them when this happens.\n");
+        mWarnedNotReady = true;
+    }
+
+    for (unsigned i = 0; ready && mProfiler && i < frame.spans.size(); ++i) {
+        Span& span = frame.spans[i];
+
+        // Spans that were never ended are ignored
+        if (span.end == 0)
+            continue;
+
+        GLuint64 begin, end;
+        GL_CHECK(glGetQueryObjectui64v(span.begin, GL_QUERY_RESULT, &begin));
+        GL_CHECK(glGetQueryObjectui64v(span.end, GL_QUERY_RESULT, &end));
+        float seconds = (end - begin) / 1000000000.0f;
+
+        if (span.phase != FRAMEPHASE_COUNT)
+            mProfiler->Record((FramePhase) span.phase, seconds);
+        else
+            mProfiler->RecordNamed(span.name, seconds);
+    }
+
+    // Start afresh
+    frame.queriesUsed = 0;
+    frame.spans.clear();
+}
+
+/*
+ * ScopedGpuPhase methods.
+ */
+
+ScopedGpuPhase::ScopedGpuPhase(GpuTimer* timer, FramePhase phase)
+                                                 : mTimer(timer)
+                                                 , mHandle(GPUTIMER_NONE)
+                                                 , mPhase(phase)
+                                                 , mName(NULL)
+{
+    if (mTimer != NULL)
+        mHandle = mTimer->Begin();
+}
+
+ScopedGpuPhase::ScopedGpuPhase(GpuTimer* timer, const std::string& name)
+                                                 : mTimer(timer)
+                                                 , mHandle(GPUTIMER_NONE)
+                                                 , mPhase(FRAMEPHASE_COUNT)
+                                                 , mName(&name)
+{
+    if (mTimer != NULL)
+        mHandle = mTimer->Begin();
+}
+
+ScopedGpuPhase::~ScopedGpuPhase()
+{
+    if (mTimer == NULL)
+        return;
+
+    if (mName != NULL)
+        mTimer->End(mHandle, *mName);
+    else
+        mTimer->End(mHandle, mPhase);
+}
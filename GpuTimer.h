@@ -0,0 +1,141 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include "Framework.h"
+#include "FrameProfiler.h"
+#include <string>
+#include <vector>
+
+// Handle returned by Begin() when we're not timing anything
+#define GPUTIMER_NONE (-1)
+
+/*
+ * Measures how long the GPU spends on things, using timestamp queries.
+ *
+ * Each span gets a pair of timestamps, so spans can nest. Queries are
+ * double-buffered: the results for a frame are collected at the end of the
+ * following frame, by which point the GPU has long since finished with
+ * them. If they somehow aren't ready, we drop them rather than stall.
+ *
+ * Timestamp queries need ARB_timer_query. Without it, everything here does
+ * nothing.
+ */
+class GpuTimer {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    GpuTimer();
+
+    /*
+     * Destructor.
+     */
+    ~GpuTimer();
+
+    /*
+     * Checks for support and sets things up. Must be called with a current
+     * GL context.
+     */
+    void Init();
+
+    /*
+     * Sets the profiler to report to. May be NULL, which disables timing.
+     */
+    void SetProfiler(FrameProfiler* profiler) { mProfiler = profiler; };
+
+    /*
+     * Enables or disables timing individual meshes.
+     */
+    void SetPerMeshEnabled(bool enabled) { mPerMesh = enabled; };
+    bool IsPerMeshEnabled() { return mPerMesh && IsActive(); };
+
+    /*
+     * Are we timing anything?
+     */
+    bool IsActive() { return mSupported && mProfiler != NULL; };
+
+    /*
+     * Starts a span. Returns a handle to pass to End(), or GPUTIMER_NONE.
+     */
+    int Begin();
+
+    /*
+     * Ends a span, to be reported as the given phase or name.
+     */
+    void End(int handle, FramePhase phase);
+    void End(int handle, const std::string& name);
+
+    /*
+     * Marks the end of a frame, and reports the results from the previous
+     * one.
+     */
+    void EndFrame();
+
+    protected:
+
+    struct Span {
+        GLuint begin;
+        GLuint end;
+        int phase;
+        std::string name;
+    };
+
+    struct Frame {
+        std::vector<GLuint> queries;
+        unsigned queriesUsed;
+        std::vector<Span> spans;
+    };
+
+    /*
+     * Issues a timestamp query, and returns it.
+     */
+    GLuint Timestamp();
+
+    /*
+     * Reports the results for a frame and gets it ready for reuse.
+     */
+    void Collect(Frame& frame);
+
+    // Double-buffered query state
+    Frame mFrames[2];
+    unsigned mCurrent;
+
+    // Where we report
+    FrameProfiler* mProfiler;
+
+    // Flags
+    bool mSupported;
+    bool mPerMesh;
+    bool mWarnedNotReady;
+};
+
+/*
+ * Times the GPU work issued in the enclosing scope. A NULL timer is allowed,
+ * and does nothing.
+ */
+class ScopedGpuPhase {
+
+    public:
+
+    /*
+     * Constructors. Start timing.
+     */
+    ScopedGpuPhase(GpuTimer* timer, FramePhase phase);
+    ScopedGpuPhase(GpuTimer* timer, const std::string& name);
+
+    /*
+     * Destructor. Stops timing.
+     */
+    ~ScopedGpuPhase();
+
+    protected:
+
+    GpuTimer* mTimer;
+    int mHandle;
+    FramePhase mPhase;
+    const std::string* mName;
+};
+
+#endif /* GPUTIMER_H */
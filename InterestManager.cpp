@@ -0,0 +1,29 @@
+#include "InterestManager.h"
+#include "WorldModel.h"
+#include <math.h>
+#include <stdlib.h>
+
+void
+InterestManager::Update(WorldModel& world)
+{
+    mPlayerCells.clear();
+    for (unsigned i = 0; i < world.GetNumPlayers(); ++i) {
+        Player* player = world.GetPlayerByIndex(i);
+        Vector pos = player->getPosition();
+        mPlayerCells[player->GetPlayerID()] =
+            Cell((int) floor(pos.x / INTEREST_CELL_SIZE),
+                 (int) floor(pos.z / INTEREST_CELL_SIZE));
+    }
+}
+
+bool
+InterestManager::IsNear(unsigned playerA, unsigned playerB)
+{
+    std::map<unsigned, Cell>::iterator a = mPlayerCells.find(playerA);
+    std::map<unsigned, Cell>::iterator b = mPlayerCells.find(playerB);
+    if (a == mPlayerCells.end() || b == mPlayerCells.end())
+        return true;
+
+    return abs(a->second.first - b->second.first) <= INTEREST_NEAR_CELLS &&
+           abs(a->second.second - b->second.second) <= INTEREST_NEAR_CELLS;
+}
@@ -0,0 +1,64 @@
+#ifndef INTERESTMANAGER_H
+#define INTERESTMANAGER_H
+
+#include <map>
+#include <utility>
+
+class WorldModel;
+
+// Size of a grid cell, in world units
+#define INTEREST_CELL_SIZE 8.0f
+
+// Players within this many cells of each other (in each direction) get
+// each other's traffic at full rate
+#define INTEREST_NEAR_CELLS 1
+
+// Number of ticks between sending batches of traffic to far-away players
+#define INTEREST_FAR_INTERVAL 8
+
+/*
+ * Server-side interest management.
+ *
+ * We bucket players into a uniform grid over the ground plane. Players in
+ * neighbouring cells are "near" each other, and get each other's inputs as
+ * soon as they arrive. Everybody else is "far", and gets batched up inputs
+ * every INTEREST_FAR_INTERVAL ticks, whatever they're stamped with. Far
+ * inputs usually arrive late, so clients roll back for far players more
+ * often, but only by up to INTEREST_FAR_INTERVAL extra ticks. Nothing is
+ * dropped, so every client still ends up with the same history.
+ *
+ * Only relayed inputs are filtered. World states and checksums still go to
+ * everybody.
+ */
+class InterestManager {
+
+    public:
+
+    /*
+     * Dummy constructor.
+     */
+    InterestManager() {};
+
+    /*
+     * Rebuilds the grid from the current player positions.
+     */
+    void Update(WorldModel& world);
+
+    /*
+     * Should the given players get each other's traffic at full rate?
+     *
+     * Players we don't know about yet are considered near, so that nothing
+     * is ever delayed by mistake.
+     */
+    bool IsNear(unsigned playerA, unsigned playerB);
+
+    protected:
+
+    // Grid coordinates (x, z) of a cell
+    typedef std::pair<int, int> Cell;
+
+    // The cell each player is in
+    std::map<unsigned, Cell> mPlayerCells;
+};
+
+#endif /* INTERESTMANAGER_H */
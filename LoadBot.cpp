@@ -0,0 +1,170 @@
+#include "LoadBot.h"
+#include "BenchCommon.h"
+#include <stdlib.h>
+
+// Inputs older than this, in seconds, are assumed to have reached everybody
+#define LATENCY_TRACKER_MAX_AGE 10.0
+
+// How we report latency to our profiler
+#define LATENCY_TRACKER_NAME "input-to-remote"
+
+/*
+ * LatencyTracker methods.
+ */
+
+LatencyTracker::LatencyTracker()
+{
+    // We report when we're told to
+    mProfiler.SetReportInterval(0);
+}
+
+void
+LatencyTracker::RecordSend(UserInput& input)
+{
+    mSendTimes[InputKey(input.playerID, input.sequence)] =
+        mClock.GetElapsedTime();
+}
+
+void
+LatencyTracker::RecordApply(UserInput& input)
+{
+    std::map<InputKey, double>::iterator it =
+        mSendTimes.find(InputKey(input.playerID, input.sequence));
+    if (it == mSendTimes.end())
+        return;
+
+    mProfiler.RecordNamed(LATENCY_TRACKER_NAME,
+                          mClock.GetElapsedTime() - it->second);
+}
+
+void
+LatencyTracker::Report()
+{
+    mProfiler.Report();
+    mProfiler.Reset();
+
+    // Forget about old inputs
+    double now = mClock.GetElapsedTime();
+    std::map<InputKey, double>::iterator it = mSendTimes.begin();
+    while (it != mSendTimes.end()) {
+        if (now - it->second > LATENCY_TRACKER_MAX_AGE)
+            mSendTimes.erase(it++);
+        else
+            ++it;
+    }
+}
+
+/*
+ * LoadBot methods.
+ */
+
+LoadBot::LoadBot(CommunicatorMode mode) : mClock(GAMECLOCK_TICK_MS)
+                                        , mCommunicator(mTimeline, mode)
+                                        , mMode(mode)
+                                        , mInputMode(LOADBOT_INPUT_SCRIPTED)
+                                        , mInputsPerSecond(0.0f)
+                                        , mInputDebt(0.0f)
+                                        , mHeldDirection(-1)
+                                        , mNextDirection(0)
+                                        , mNumInputsSent(0)
+                                        , mTracker(NULL)
+{
+}
+
+void
+LoadBot::SetInput(LoadBotInputMode mode, float inputsPerSecond)
+{
+    mInputMode = mode;
+    mInputsPerSecond = inputsPerSecond;
+}
+
+void
+LoadBot::SetLatencyTracker(LatencyTracker* tracker)
+{
+    mTracker = tracker;
+    mTimeline.SetInputListener(tracker ? this : NULL);
+}
+
+void
+LoadBot::OnInputApplied(UserInput& input)
+{
+    // Our own inputs take effect as soon as we send them
+    if (mTracker && input.playerID != mCommunicator.GetPlayerID())
+        mTracker->RecordApply(input);
+}
+
+void
+LoadBot::Start(const char* server, unsigned numClientsExpected)
+{
+    // We don't draw anything
+    mWorld.InitHeadless();
+
+    // Connect and get on the same page as everybody else
+    mCommunicator.SetClock(mClock);
+    if (mMode == COMMUNICATOR_MODE_CLIENT)
+        mCommunicator.SetServer(server);
+    else
+        mCommunicator.SetNumClientsExpected(numClientsExpected);
+    mCommunicator.Connect();
+    mCommunicator.Bootstrap(mWorld);
+
+    // Start the clock where the world is
+    mClock.Set(mWorld.GetCurrentTimestamp());
+    mClock.Start();
+}
+
+void
+LoadBot::Update()
+{
+    // Our caller does the waiting, for all of the bots at once
+    if (!mClock.TryTick())
+        return;
+
+    // Step
+    mTimeline.Advance(mClock.Now() - mClock.Then());
+
+    // Steer
+    if (mMode == COMMUNICATOR_MODE_CLIENT)
+        GenerateInput();
+
+    // Talk to everybody
+    mCommunicator.Synchronize();
+}
+
+void
+LoadBot::GenerateInput()
+{
+    // We accumulate input "debt" as time passes, and send an input whenever
+    // we owe one. Only one per frame though.
+    mInputDebt += mInputsPerSecond * GAMECLOCK_TICK_MS / 1000.0f;
+    if (mInputDebt < 1.0f)
+        return;
+    mInputDebt -= 1.0f;
+
+    UserInput input(mCommunicator.GetPlayerID(),
+                    mCommunicator.GetInputTimestamp(mClock.Now()));
+
+    // Let go of whatever we're holding
+    if (mHeldDirection >= 0) {
+        input.inputs = GEN_INPUT_MASK(mHeldDirection, false);
+        mHeldDirection = -1;
+    }
+
+    // Or pick a new direction
+    else {
+        if (mInputMode == LOADBOT_INPUT_RANDOM)
+            mNextDirection = rand() % BENCH_NUM_DIRECTIONS;
+        mHeldDirection = gBenchDirections[mNextDirection];
+        mNextDirection = (mNextDirection + 1) % BENCH_NUM_DIRECTIONS;
+        input.inputs = GEN_INPUT_MASK(mHeldDirection, true);
+    }
+
+    // Start the latency clock before we apply the input ourselves, so that
+    // rolling back for it counts
+    if (mTracker) {
+        input.sequence = mCommunicator.GetNextInputSequence();
+        mTracker->RecordSend(input);
+    }
+    mCommunicator.ApplyInput(input);
+    ++mNumInputsSent;
+}
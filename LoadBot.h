@@ -0,0 +1,144 @@
+#ifndef LOADBOT_H
+#define LOADBOT_H
+
+#include "WorldModel.h"
+#include "Timeline.h"
+#include "Communicator.h"
+#include "Gameclock.h"
+#include "FrameProfiler.h"
+#include <map>
+
+/*
+ * How a bot decides which way to steer.
+ */
+typedef enum {
+    LOADBOT_INPUT_SCRIPTED = 0,
+    LOADBOT_INPUT_RANDOM
+} LoadBotInputMode;
+
+/*
+ * Measures how long it takes input to get from the bot that sent it into
+ * the simulations of the other bots in the same process. Everybody shares
+ * one wall clock, so there's no clock skew to worry about.
+ */
+class LatencyTracker {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    LatencyTracker();
+
+    /*
+     * Records that we just sent an input.
+     */
+    void RecordSend(UserInput& input);
+
+    /*
+     * Records how long an input took to take effect for another bot, if it
+     * came from one of ours.
+     */
+    void RecordApply(UserInput& input);
+
+    /*
+     * Prints latency percentiles since the last report, and forgets about
+     * inputs that are too old to still be in flight.
+     */
+    void Report();
+
+    protected:
+
+    // When each input was sent, keyed by player and sequence number. Two
+    // inputs can land on the same tick, so timestamps won't do.
+    typedef std::pair<unsigned, unsigned> InputKey;
+    std::map<InputKey, double> mSendTimes;
+
+    // Our wall clock
+    sf::Clock mClock;
+
+    // Latency histogram
+    FrameProfiler mProfiler;
+};
+
+/*
+ * A headless peer for load testing. Clients connect to a server and steer
+ * around at a configurable rate. Servers just run the game.
+ */
+class LoadBot : public InputListener {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    LoadBot(CommunicatorMode mode);
+
+    /*
+     * Sets how the bot steers, and how many inputs a second it sends.
+     */
+    void SetInput(LoadBotInputMode mode, float inputsPerSecond);
+
+    /*
+     * Sets the tracker to tell about sent and received inputs. May be NULL.
+     */
+    void SetLatencyTracker(LatencyTracker* tracker);
+
+    /*
+     * Gets our communicator, for configuration before Start().
+     */
+    Communicator& GetCommunicator() { return mCommunicator; };
+
+    /*
+     * Connects and bootstraps. Clients connect to the given server, and
+     * servers wait for the given number of clients.
+     */
+    void Start(const char* server, unsigned numClientsExpected);
+
+    /*
+     * Runs a single frame: simulation, input and networking. This doesn't
+     * wait for the clock, so it does nothing if our clock hasn't ticked
+     * since the last frame.
+     */
+    void Update();
+
+    /*
+     * Gets the number of inputs we've sent.
+     */
+    unsigned GetNumInputsSent() { return mNumInputsSent; };
+
+    /*
+     * InputListener method. Tells the tracker when other bots' inputs take
+     * effect in our world.
+     */
+    virtual void OnInputApplied(UserInput& input);
+
+    protected:
+
+    /*
+     * Generates input, if it's time.
+     */
+    void GenerateInput();
+
+    // Everything a peer needs
+    Gameclock mClock;
+    WorldModel mWorld;
+    Timeline mTimeline;
+    Communicator mCommunicator;
+
+    // Client or server?
+    CommunicatorMode mMode;
+
+    // Input generation
+    LoadBotInputMode mInputMode;
+    float mInputsPerSecond;
+    float mInputDebt;
+    int mHeldDirection;
+    unsigned mNextDirection;
+    unsigned mNumInputsSent;
+
+    // Where we report latency, if anywhere
+    LatencyTracker* mTracker;
+};
+
+#endif /* LOADBOT_H */
@@ -0,0 +1,142 @@
+/*
+ * Load generator.
+ *
+ * Runs a bunch of headless bot clients in a single process, all connected to
+ * the same server, or a headless server for them to connect to. Run several
+ * of these to spread bots over several processes.
+ *
+ * Usage: loadgen -m bots -s address [-b bots] [-r inputsPerSecond]
+ *                [-i scripted|random] [-l latencyMS] [-j jitterMS]
+ *                [-x lossPercent] [-t seconds]
+ *        loadgen -m server [-n minClients] [-t seconds]
+ */
+
+#include "LoadBot.h"
+#include "BenchCommon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define LOADGEN_DEFAULT_BOTS 8
+#define LOADGEN_DEFAULT_INPUT_RATE 4
+#define LOADGEN_DEFAULT_SECONDS 60
+
+// Seconds between latency reports
+#define LOADGEN_REPORT_INTERVAL 5.0f
+
+/*
+ * Sleeps until the next tick of the shared schedule every bot runs on.
+ * nextTick is in seconds on the given timer, and is moved on by a tick.
+ */
+static void waitForTick(const sf::Clock& timer, float& nextTick)
+{
+    nextTick += GAMECLOCK_TICK_MS / 1000.0f;
+    float wait = nextTick - timer.GetElapsedTime();
+    if (wait > 0.0f)
+        sf::Sleep(wait);
+
+    // If we fell behind, don't try to make up for it all at once
+    else
+        nextTick = timer.GetElapsedTime();
+}
+
+static void printUsageAndExit(char* programName)
+{
+    printf("Usage: %s -m bots -s address [-b bots] [-r inputsPerSecond]\n"
+           "           [-i scripted|random] [-l latencyMS] [-j jitterMS]\n"
+           "           [-x lossPercent] [-t seconds]\n"
+           "       %s -m server [-n minClients] [-t seconds]\n",
+           programName, programName);
+    exit(-1);
+}
+
+int main(int argc, char** argv)
+{
+    srand(123456);
+
+    const char* mode = GetBenchString(argc, argv, "-m", "");
+    int seconds = GetBenchOption(argc, argv, "-t", LOADGEN_DEFAULT_SECONDS);
+    if (seconds < 1)
+        printUsageAndExit(argv[0]);
+
+    // Headless server
+    if (!strcmp(mode, "server")) {
+        int numClients = GetBenchOption(argc, argv, "-n", 0);
+        if (numClients < 0)
+            printUsageAndExit(argv[0]);
+
+        LoadBot server(COMMUNICATOR_MODE_SERVER);
+        server.Start(NULL, numClients);
+        sf::Clock timer;
+        float nextTick = 0.0f;
+        while (timer.GetElapsedTime() < seconds) {
+            server.Update();
+            waitForTick(timer, nextTick);
+        }
+        return 0;
+    }
+
+    if (strcmp(mode, "bots"))
+        printUsageAndExit(argv[0]);
+
+    // Bots
+    const char* server = GetBenchString(argc, argv, "-s", NULL);
+    int numBots = GetBenchOption(argc, argv, "-b", LOADGEN_DEFAULT_BOTS);
+    int inputRate = GetBenchOption(argc, argv, "-r", LOADGEN_DEFAULT_INPUT_RATE);
+    const char* inputString = GetBenchString(argc, argv, "-i", "scripted");
+    NetConditions conditions;
+    conditions.latencyMS = GetBenchOption(argc, argv, "-l", 0);
+    conditions.jitterMS = GetBenchOption(argc, argv, "-j", 0);
+    conditions.lossPercent = GetBenchOption(argc, argv, "-x", 0);
+    if (server == NULL || numBots < 1 || inputRate < 0)
+        printUsageAndExit(argv[0]);
+
+    LoadBotInputMode inputMode = LOADBOT_INPUT_SCRIPTED;
+    if (!strcmp(inputString, "random"))
+        inputMode = LOADBOT_INPUT_RANDOM;
+    else if (strcmp(inputString, "scripted"))
+        printUsageAndExit(argv[0]);
+
+    // Bring everybody up. Each bot blocks until it has the world, so the
+    // ones already running stall for a moment while the others join.
+    LatencyTracker tracker;
+    std::vector<LoadBot*> bots;
+    for (int i = 0; i < numBots; ++i) {
+        LoadBot* bot = new LoadBot(COMMUNICATOR_MODE_CLIENT);
+        bot->SetInput(inputMode, inputRate);
+        bot->SetLatencyTracker(&tracker);
+        bot->GetCommunicator().SetNetConditions(conditions);
+        bot->Start(server, 0);
+        bots.push_back(bot);
+    }
+    printf("%d bots running\n", numBots);
+
+    // Run. All the bots share one tick, and we sleep in between. Each bot's
+    // own clock is slewed to the server's separately, so one that's just
+    // short of a tick sits this one out and takes two next time.
+    sf::Clock timer;
+    float lastReport = 0.0f;
+    float nextTick = 0.0f;
+    while (timer.GetElapsedTime() < seconds) {
+        for (unsigned i = 0; i < bots.size(); ++i)
+            bots[i]->Update();
+        waitForTick(timer, nextTick);
+
+        if (timer.GetElapsedTime() - lastReport >= LOADGEN_REPORT_INTERVAL) {
+            tracker.Report();
+            lastReport = timer.GetElapsedTime();
+        }
+    }
+
+    // Wrap up
+    unsigned numInputs = 0;
+    for (unsigned i = 0; i < bots.size(); ++i) {
+        numInputs += bots[i]->GetNumInputsSent();
+        delete bots[i];
+    }
+    printf("%d bots sent %u inputs in %d s\n", numBots, numInputs, seconds);
+    tracker.Report();
+
+    return 0;
+}
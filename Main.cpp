@@ -7,9 +7,13 @@
 #include "Player.h"
 #include "Timeline.h"
 #include "Gameclock.h"
+#include "FrameProfiler.h"
+#include "ReplayLog.h"
+#include "SimulationThread.h"
 #include <stdlib.h>
 
 char* getOption(int argc, char** argv, const char* flag);
+char* getOptionalOption(int argc, char** argv, const char* flag);
 void printUsageAndExit(char* programName);
 
 int main(int argc, char** argv) {
@@ -24,16 +28,41 @@ int main(int argc, char** argv) {
     // Gameclock
     Gameclock clock(GAMECLOCK_TICK_MS);
 
+    // Keeps track of where our frame time goes
+    FrameProfiler profiler;
+
     // Declare and initialize our rendering context
     RenderContext renderContext;
     renderContext.Init();
+    renderContext.SetProfiler(&profiler);
+
+    // Time individual meshes on the GPU, as well as whole passes?
+    char* gpuString = getOptionalOption(argc, argv, "-g");
+    if (gpuString != NULL) {
+        if (!strcmp(gpuString, "mesh"))
+            renderContext.GetGpuTimer()->SetPerMeshEnabled(true);
+        else if (strcmp(gpuString, "pass"))
+            printUsageAndExit(argv[0]);
+    }
 
     // Declare an empty scenegraph
     SceneGraph sceneGraph(renderContext);
 
+    // How many threads should the physics get?
+    char* threadString = getOptionalOption(argc, argv, "-w");
+    if (threadString != NULL) {
+        int numThreads = atoi(threadString);
+        if (numThreads < 1)
+            printUsageAndExit(argv[0]);
+        WorldModel::SetPhysicsThreads((unsigned) numThreads);
+    }
+
     // Declare our world model, and point it to the scene graph
+    // The simulation runs on its own thread, so the world only updates the
+    // scenegraph when we hand it a snapshot.
     WorldModel world;
     world.Init(sceneGraph);
+    world.SetRenderFromSnapshots(true);
 
     // Client or server mode?
     char* modeString = getOption(argc, argv, "-m");
@@ -48,14 +77,16 @@ int main(int argc, char** argv) {
     // Declare our timeline. It will be initialized by the Communicator.
     Timeline timeline;
 
-    // Declare our communicator
+    // Declare our communicator, and give it the clock to keep in sync
     Communicator communicator(timeline, mode);
+    communicator.SetClock(clock);
 
     // If we're a client, who are we connecting to?
     if (mode == COMMUNICATOR_MODE_CLIENT)
         communicator.SetServer(getOption(argc, argv, "-s"));
 
-    // Otherwise, how many clients are we waiting for?
+    // Otherwise, how many clients are we waiting for before we start? More
+    // can join later.
     else {
         int numClients = atoi(getOption(argc, argv, "-n"));
         if (numClients < 0)
@@ -63,62 +94,148 @@ int main(int argc, char** argv) {
         communicator.SetNumClientsExpected((unsigned) numClients);
     }
 
+    // How long do we hold on to local input before applying it? Either a
+    // fixed number of ticks, or "auto" to pick based on round trip times.
+    char* delayString = getOptionalOption(argc, argv, "-d");
+    if (delayString != NULL) {
+        if (!strcmp(delayString, "auto"))
+            communicator.SetAdaptiveInputDelay(true);
+        else {
+            int delay = atoi(delayString);
+            if (delay < 0 || delay > TIMELINE_MAX_LEAD)
+                printUsageAndExit(argv[0]);
+            communicator.SetInputDelay((unsigned) delay);
+        }
+    }
+
+    // Do we want rollback stats written out as we go?
+    char* statsFile = getOptionalOption(argc, argv, "-r");
+    if (statsFile != NULL)
+        timeline.GetProfiler().SetDumpFile(statsFile,
+                                           ROLLBACK_PROFILER_DUMP_INTERVAL);
+
+    // Are we recording the match?
+    ReplayLog replayLog;
+    char* replayFile = getOptionalOption(argc, argv, "-o");
+    if (replayFile != NULL && replayLog.OpenForWriting(replayFile))
+        timeline.SetRecorder(&replayLog);
+
     // Connect to the server/clients
     communicator.Connect();
 
     // Put the players on the map and get people on the same page
     communicator.Bootstrap(world);
 
-    // Start the clock
+    // Start the clock. If we joined a game in progress, the clock
+    // starts at the world's current time.
+    clock.Set(world.GetCurrentTimestamp());
     clock.Start();
 
-    // Top level game loop
-    while (renderContext.GetWindow()->IsOpened()) {
-
-        // Handle input. Local input is applied immediately, global input
-        // is recorded so that we can send it over the network.
-        UserInput input(communicator.GetPlayerID(), clock.Now());
-        input.LoadInput(renderContext);
-        if (input.inputs != 0)
-            communicator.ApplyInput(input);
+    // Hand the clock, network and world over to the simulation thread. From
+    // here on, this thread just draws.
+    SimulationThread simulation(clock, communicator, timeline, world);
+    simulation.Start();
 
-        // Apply any state updates that may have come in, and send off any
-        // necessary updates.
-        communicator.Synchronize();
+    // We draw in between the two most recent snapshots, so that players
+    // move smoothly no matter how frames and ticks line up
+    RenderSnapshot previousSnapshot, currentSnapshot, drawnSnapshot;
+    bool haveSnapshot = false;
+    float snapshotSeconds = 0.0f;
+    sf::Clock snapshotTimer;
 
-        // Tick the clock
-        clock.Tick();
+    // The simulation keeps its own time, so nothing else holds this thread
+    // back. Pace it to the display rather than spinning.
+    renderContext.GetWindow()->UseVerticalSync(true);
+    renderContext.GetWindow()->SetFramerateLimit(RENDER_FRAMERATE_LIMIT);
 
-        // Step the world
-        world.Step(clock.Now() - clock.Then(), clock.GetDeltaTime());
+    // Top level game loop
+    while (renderContext.GetWindow()->IsOpened()) {
+        sf::Clock frameTimer;
+
+        // Handle input. Local input goes to the simulation, which stamps it
+        // and sends it over the network.
+        {
+            ScopedPhase phase(&profiler, FRAMEPHASE_INPUT);
+            UserInput input(0, 0);
+            input.LoadInput(renderContext);
+            if (input.inputs != 0)
+                simulation.QueueInput(input.inputs);
+        }
+
+        // Catch up with the simulation. Each new snapshot takes as long to
+        // blend in as the simulation took to get there from the last one.
+        const RenderSnapshot* snapshot = simulation.GetSnapshots().GetLatest();
+        if (snapshot != NULL &&
+            (!haveSnapshot || snapshot->timestamp != currentSnapshot.timestamp)) {
+            previousSnapshot = haveSnapshot ? currentSnapshot : *snapshot;
+            currentSnapshot = *snapshot;
+            haveSnapshot = true;
+            snapshotSeconds = (currentSnapshot.timestamp -
+                               previousSnapshot.timestamp) *
+                              GAMECLOCK_TICK_MS / 1000.0f;
+            snapshotTimer.Reset();
+        }
+        if (haveSnapshot) {
+            float t = 1.0f;
+            if (snapshotSeconds > 0.0f)
+                t = MIN(1.0f, snapshotTimer.GetElapsedTime() / snapshotSeconds);
+            InterpolateSnapshots(previousSnapshot, currentSnapshot, t,
+                                 drawnSnapshot);
+            world.ApplySnapshot(drawnSnapshot);
+        }
 
         // Render the scenegraph
         renderContext.Render(sceneGraph);
 
         // Display the window
-        renderContext.GetWindow()->Display();
-
+        {
+            ScopedPhase phase(&profiler, FRAMEPHASE_SWAP);
+            renderContext.GetWindow()->Display();
+        }
+        renderContext.EndFrame();
+
+        // That's a frame
+        profiler.Record(FRAMEPHASE_FRAME, frameTimer.GetElapsedTime());
+        profiler.EndFrame();
     }
 
+    // Stop simulating before we look at how it went
+    simulation.Stop();
+
+    // Report how the match went
+    printf("Input delay: %u ticks\n", communicator.GetInputDelay());
+    timeline.GetMetrics().Dump();
+
     return 0;
 }
 
 char* getOption(int argc, char** argv, const char* flag)
+{
+    char* option = getOptionalOption(argc, argv, flag);
+
+    // If the flag wasn't found, bail out.
+    if (option == NULL)
+        printUsageAndExit(argv[0]);
+
+    return option;
+}
+
+char* getOptionalOption(int argc, char** argv, const char* flag)
 {
     // Search for the flag
     for (int i = 0; i < argc - 1; ++i)
         if (!strcmp(argv[i], flag))
             return argv[i + 1];
 
-    // If the flag wasn't found, bail out.
-    printUsageAndExit(argv[0]);
-
-    // Not reached
+    // Not there
     return NULL;
 }
 
 void printUsageAndExit(char* programName)
 {
-    printf("Usage: %s -m [client,server] [-s address | -n numClients]\n", programName);
+    printf("Usage: %s -m [client,server] [-s address | -n minClients]\n"
+           "       [-d ticks|auto] [-r statsFile.{csv,json}] [-g pass|mesh]\n"
+           "       [-o replayFile] [-w physicsThreads]\n",
+           programName);
     exit(-1);
 }
@@ -2,6 +2,7 @@
 #include "RenderContext.h"
 #include <string>
 #include <fstream>
+#include <string.h>
 #include <assert.h>
 
 using std::string;
@@ -60,29 +61,65 @@ Material::Destroy()
 }
 
 void
-Material::SetEnabled(bool enabled)
+Material::GetBlock(bool enabled, Vector* blockOut)
 {
-    // Ambient
-    SET_UNIFORMV(mContext, 3fv, "Ka", enabled ? mAmbient.Get() : mBlack.Get());
-
-    // Diffuse
-    SET_UNIFORMV(mContext, 3fv, "Kd", enabled ? mDiffuse.Get() : mBlack.Get());
-
-    // Specular
-    SET_UNIFORMV(mContext, 3fv, "Ks", enabled ? mSpecular.Get() : mBlack.Get());
+    const Vector& ambient = enabled ? mAmbient : mBlack;
+    const Vector& diffuse = enabled ? mDiffuse : mBlack;
+    const Vector& specular = enabled ? mSpecular : mBlack;
+    blockOut[0].Set(ambient.x, ambient.y, ambient.z,
+                    enabled ? mShininess : SHININESS_DEFAULT);
+    blockOut[1].Set(diffuse.x, diffuse.y, diffuse.z, 0.0f);
+    blockOut[2].Set(specular.x, specular.y, specular.z, 0.0f);
+}
 
-    // Shininess
-    SET_UNIFORM(mContext, 1f, "alpha", enabled ? mShininess : SHININESS_DEFAULT);
+void
+Material::SetEnabled(bool enabled)
+{
+    // Colors and shininess, all at once
+    Vector block[MATERIAL_BLOCK_SIZE];
+    GetBlock(enabled, block);
+    SET_UNIFORMARRAY(mContext, 4fv, "materialBlock", MATERIAL_BLOCK_SIZE,
+                     (GLfloat*) block);
 
     // Textures
     mTextures[TEXTURETYPE_DIFFUSE].SetEnabled(enabled, DIFFUSE_TEXTURE_UNIT);
     mTextures[TEXTURETYPE_SPECULAR].SetEnabled(enabled, SPECULAR_TEXTURE_UNIT);
     mTextures[TEXTURETYPE_NORMAL].SetEnabled(enabled, NORMAL_TEXTURE_UNIT);
+}
 
-    // Are we doing normal mapping?
-    SET_UNIFORM(mContext, 1i, "mapNormals",
-                enabled && mTextures[TEXTURETYPE_NORMAL].IsInitialized() ? 1 : 0);
+// The texture unit for each type of texture
+static const GLenum sTextureUnits[] = {
+    DIFFUSE_TEXTURE_UNIT, SPECULAR_TEXTURE_UNIT, NORMAL_TEXTURE_UNIT
+};
 
+void
+Material::SetEnabledFrom(Material* previous, bool newProgram)
+{
+    if (previous == this && !newProgram)
+        return;
+    if (previous == NULL) {
+        SetEnabled(true);
+        return;
+    }
+
+    // Colors and shininess. Packing is cheap; it's the upload we want to
+    // avoid, unless the program has never seen them.
+    Vector block[MATERIAL_BLOCK_SIZE], previousBlock[MATERIAL_BLOCK_SIZE];
+    GetBlock(true, block);
+    previous->GetBlock(true, previousBlock);
+    if (newProgram || memcmp(block, previousBlock, sizeof(block)))
+        SET_UNIFORMARRAY(mContext, 4fv, "materialBlock", MATERIAL_BLOCK_SIZE,
+                         (GLfloat*) block);
+
+    // Textures. Disabling leaves 0 bound wherever previous had a texture,
+    // so that's what we'd have where we don't.
+    for (unsigned i = 0; i < TEXTURETYPE_COUNT; ++i) {
+        GLuint textureID = mTextures[i].GetID();
+        if (textureID != previous->mTextures[i].GetID()) {
+            GL_CHECK(glActiveTexture(sTextureUnits[i]));
+            GL_CHECK(glBindTexture(GL_TEXTURE_2D, textureID));
+        }
+    }
 }
 
 static const char* sSuffixes[] = {"_d.jpg", "_s.jpg", "_n.jpg"};
@@ -17,6 +17,11 @@ typedef enum {
     TEXTURETYPE_COUNT
 } TextureType;
 
+// A material goes to the shader as one array of vectors, "materialBlock":
+// ambient color and shininess, diffuse color, then specular color. The
+// spare components are zero. Normal mapping is a shader variant instead.
+#define MATERIAL_BLOCK_SIZE 3
+
 /*
  * Class to encapsulate the management and activation/deactivation
  * of a material (mostly for textures).
@@ -31,6 +36,29 @@ public:
 
     void SetEnabled(bool enabled);
 
+    /*
+     * Enables us in place of previous, which is currently enabled (or NULL
+     * if nothing is). Leaves things just as previous->SetEnabled(false)
+     * followed by SetEnabled(true) would, but only uploads our block if it
+     * differs, and only binds the texture units that differ. If the shader
+     * program changed since previous was enabled, pass newProgram so that
+     * our block goes to the new one regardless.
+     */
+    void SetEnabledFrom(Material* previous, bool newProgram = false);
+
+    /*
+     * Whether we have a normal map, and so want the normal mapping shader
+     * variant.
+     */
+    bool HasNormalMap() {
+        return mTextures[TEXTURETYPE_NORMAL].IsInitialized();
+    };
+
+    /*
+     * Gets the texture of a given type we bind, or 0 if we don't have one.
+     */
+    GLuint GetTextureID(TextureType type) { return mTextures[type].GetID(); };
+
     /*
      * Destroy our data.
      */
@@ -51,6 +79,12 @@ protected:
 
     void TryLoadTexture(const char* prefix, TextureType type);
 
+    /*
+     * Packs our colors up for the shader. Disabled materials are
+     * black, with the default shininess.
+     */
+    void GetBlock(bool enabled, Vector* blockOut);
+
     // Our rendering context
     RenderContext* mContext;
 
@@ -177,6 +177,23 @@ Matrix::Ortho(float left, float right,
     *this = MMProduct(ortho);
 }
 
+void
+Matrix::Perspective(float fovy, float aspect, float near, float far)
+{
+    // See the gluPerspective() man page
+    float f = 1.0f / tan(fovy * M_PI / 360.0f);
+    Matrix perspective;
+    perspective.a.x = f / aspect;
+    perspective.b.y = f;
+    perspective.c.z = (far + near) / (near - far);
+    perspective.c.w = 2.0f * far * near / (near - far);
+    perspective.d.z = -1.0f;
+    perspective.d.w = 0.0f;
+
+    // Apply the matrix
+    *this = MMProduct(perspective);
+}
+
 void
 Matrix::LookAt(Vector& eye, Vector& center, Vector& up)
 {
@@ -211,20 +228,63 @@ Matrix::LookAt(Vector& eye, Vector& center, Vector& up)
     *this = MMProduct(lookAt);
 }
 
+#ifdef VECTOR_USE_SSE
+/*
+ * One row of a matrix product: row * mat, where the rows of mat are given.
+ * Each element of the row scales the corresponding row of mat.
+ */
+static inline __m128
+RowProduct(__m128 row, __m128 m0, __m128 m1, __m128 m2, __m128 m3)
+{
+    __m128 x = _mm_shuffle_ps(row, row, _MM_SHUFFLE(0, 0, 0, 0));
+    __m128 y = _mm_shuffle_ps(row, row, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(row, row, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 w = _mm_shuffle_ps(row, row, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m0), _mm_mul_ps(y, m1)),
+                      _mm_add_ps(_mm_mul_ps(z, m2), _mm_mul_ps(w, m3)));
+}
+#endif
+
 Vector
 Matrix::MVProduct(Vector& vec)
 {
     Vector rv;
+#ifdef VECTOR_USE_SSE
+    // Multiply every row by the vector, then transpose so that adding the
+    // rows gives all four dot products at once.
+    __m128 v = VectorLoad(vec);
+    __m128 r0 = _mm_mul_ps(VectorLoad(a), v);
+    __m128 r1 = _mm_mul_ps(VectorLoad(b), v);
+    __m128 r2 = _mm_mul_ps(VectorLoad(c), v);
+    __m128 r3 = _mm_mul_ps(VectorLoad(d), v);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    VectorStore(rv, _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+#else
     rv.x = a.Dot(vec);
     rv.y = b.Dot(vec);
     rv.z = c.Dot(vec);
     rv.w = d.Dot(vec);
+#endif
     return rv;
 }
 
 Matrix
 Matrix::MMProduct(Matrix& mat)
 {
+#ifdef VECTOR_USE_SSE
+    // Row i of the product is the sum of mat's rows, weighted by row i of
+    // this matrix. No transposes needed.
+    Matrix rv;
+    __m128 m0 = VectorLoad(mat.a);
+    __m128 m1 = VectorLoad(mat.b);
+    __m128 m2 = VectorLoad(mat.c);
+    __m128 m3 = VectorLoad(mat.d);
+    VectorStore(rv.a, RowProduct(VectorLoad(a), m0, m1, m2, m3));
+    VectorStore(rv.b, RowProduct(VectorLoad(b), m0, m1, m2, m3));
+    VectorStore(rv.c, RowProduct(VectorLoad(c), m0, m1, m2, m3));
+    VectorStore(rv.d, RowProduct(VectorLoad(d), m0, m1, m2, m3));
+    return rv;
+#else
     // We work with transposes to use our dot product routines
     Matrix rvPrime;
     Matrix matPrime = mat.Transpose();
@@ -235,16 +295,79 @@ Matrix::MMProduct(Matrix& mat)
     rvPrime.d = this->MVProduct(matPrime.d);
 
     return rvPrime.Transpose();
+#endif
+}
+
+void
+Matrix::MVProductBatch(const Matrix& mat, const Vector* in, Vector* out,
+                       unsigned count)
+{
+#ifdef VECTOR_USE_SSE
+    // Keep the matrix in registers, transposed, so each vector is just four
+    // splats and four multiply-adds
+    __m128 c0 = VectorLoad(mat.a);
+    __m128 c1 = VectorLoad(mat.b);
+    __m128 c2 = VectorLoad(mat.c);
+    __m128 c3 = VectorLoad(mat.d);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    for (unsigned i = 0; i < count; ++i)
+        VectorStore(out[i], RowProduct(VectorLoad(in[i]), c0, c1, c2, c3));
+#else
+    for (unsigned i = 0; i < count; ++i) {
+        Vector vec = in[i];
+        out[i].Set(mat.a.Dot(vec), mat.b.Dot(vec), mat.c.Dot(vec),
+                   mat.d.Dot(vec));
+    }
+#endif
+}
+
+void
+Matrix::MMProductBatch(const Matrix* lhs, const Matrix* rhs, Matrix* out,
+                       unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i) {
+#ifdef VECTOR_USE_SSE
+        // Load everything before storing, in case out aliases an input
+        __m128 m0 = VectorLoad(rhs[i].a);
+        __m128 m1 = VectorLoad(rhs[i].b);
+        __m128 m2 = VectorLoad(rhs[i].c);
+        __m128 m3 = VectorLoad(rhs[i].d);
+        __m128 r0 = RowProduct(VectorLoad(lhs[i].a), m0, m1, m2, m3);
+        __m128 r1 = RowProduct(VectorLoad(lhs[i].b), m0, m1, m2, m3);
+        __m128 r2 = RowProduct(VectorLoad(lhs[i].c), m0, m1, m2, m3);
+        __m128 r3 = RowProduct(VectorLoad(lhs[i].d), m0, m1, m2, m3);
+        VectorStore(out[i].a, r0);
+        VectorStore(out[i].b, r1);
+        VectorStore(out[i].c, r2);
+        VectorStore(out[i].d, r3);
+#else
+        Matrix left = lhs[i];
+        Matrix right = rhs[i];
+        out[i] = left.MMProduct(right);
+#endif
+    }
 }
 
 Matrix
 Matrix::Transpose()
 {
     Matrix rv;
+#ifdef VECTOR_USE_SSE
+    __m128 r0 = VectorLoad(a);
+    __m128 r1 = VectorLoad(b);
+    __m128 r2 = VectorLoad(c);
+    __m128 r3 = VectorLoad(d);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    VectorStore(rv.a, r0);
+    VectorStore(rv.b, r1);
+    VectorStore(rv.c, r2);
+    VectorStore(rv.d, r3);
+#else
     rv.a.Set(a.x, b.x, c.x, d.x);
     rv.b.Set(a.y, b.y, c.y, d.y);
     rv.c.Set(a.z, b.z, c.z, d.z);
     rv.d.Set(a.w, b.w, c.w, d.w);
+#endif
     return rv;
 }
 
@@ -287,3 +410,101 @@ Matrix::Inverse()
     // All done!
     return rv;
 }
+
+Matrix
+Matrix::Inverse4()
+{
+    // Cofactor expansion, sharing the 2x2 determinants of the top two rows
+    // (s) and the bottom two rows (t) between all the cofactors. See:
+    // http://www.geometrictools.com/Documentation/LaplaceExpansionTheorem.pdf
+    GLfloat s0 = a.x * b.y - b.x * a.y;
+    GLfloat s1 = a.x * b.z - b.x * a.z;
+    GLfloat s2 = a.x * b.w - b.x * a.w;
+    GLfloat s3 = a.y * b.z - b.y * a.z;
+    GLfloat s4 = a.y * b.w - b.y * a.w;
+    GLfloat s5 = a.z * b.w - b.z * a.w;
+
+    GLfloat t5 = c.z * d.w - d.z * c.w;
+    GLfloat t4 = c.y * d.w - d.y * c.w;
+    GLfloat t3 = c.y * d.z - d.y * c.z;
+    GLfloat t2 = c.x * d.w - d.x * c.w;
+    GLfloat t1 = c.x * d.z - d.x * c.z;
+    GLfloat t0 = c.x * d.y - d.x * c.y;
+
+    GLfloat det = s0 * t5 - s1 * t4 + s2 * t3 + s3 * t2 - s4 * t1 + s5 * t0;
+    assert(det != 0.0f);
+    GLfloat idet = 1.0f / det;
+
+    Matrix rv;
+    rv.a.x = ( b.y * t5 - b.z * t4 + b.w * t3) * idet;
+    rv.a.y = (-a.y * t5 + a.z * t4 - a.w * t3) * idet;
+    rv.a.z = ( d.y * s5 - d.z * s4 + d.w * s3) * idet;
+    rv.a.w = (-c.y * s5 + c.z * s4 - c.w * s3) * idet;
+
+    rv.b.x = (-b.x * t5 + b.z * t2 - b.w * t1) * idet;
+    rv.b.y = ( a.x * t5 - a.z * t2 + a.w * t1) * idet;
+    rv.b.z = (-d.x * s5 + d.z * s2 - d.w * s1) * idet;
+    rv.b.w = ( c.x * s5 - c.z * s2 + c.w * s1) * idet;
+
+    rv.c.x = ( b.x * t4 - b.y * t2 + b.w * t0) * idet;
+    rv.c.y = (-a.x * t4 + a.y * t2 - a.w * t0) * idet;
+    rv.c.z = ( d.x * s4 - d.y * s2 + d.w * s0) * idet;
+    rv.c.w = (-c.x * s4 + c.y * s2 - c.w * s0) * idet;
+
+    rv.d.x = (-b.x * t3 + b.y * t1 - b.z * t0) * idet;
+    rv.d.y = ( a.x * t3 - a.y * t1 + a.z * t0) * idet;
+    rv.d.z = (-d.x * s3 + d.y * s1 - d.z * s0) * idet;
+    rv.d.w = ( c.x * s3 - c.y * s1 + c.z * s0) * idet;
+
+    return rv;
+}
+
+/*
+ * Fills in the translation and bottom row of an affine inverse, given the
+ * inverse 3x3 in its upper left and the original translation.
+ */
+static void
+FinishAffineInverse(Matrix& inverse, const Vector& translation)
+{
+    // Plain arithmetic beats Dot3() here, since it's only three lanes
+    for (int i = 0; i < 3; ++i)
+        inverse[i].w = -(inverse[i].x * translation.x +
+                         inverse[i].y * translation.y +
+                         inverse[i].z * translation.z);
+    inverse[3].Set(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+Matrix
+Matrix::InverseAffine()
+{
+    assert(d.x == 0.0f && d.y == 0.0f && d.z == 0.0f && d.w == 1.0f);
+
+    // Adjugate over determinant, written out rather than going through
+    // Inverse(), which transposes and works in double
+    GLfloat c0 = b.y * c.z - b.z * c.y;
+    GLfloat c1 = b.z * c.x - b.x * c.z;
+    GLfloat c2 = b.x * c.y - b.y * c.x;
+    GLfloat det = a.x * c0 + a.y * c1 + a.z * c2;
+    assert(det != 0.0f);
+    GLfloat idet = 1.0f / det;
+
+    Matrix rv;
+    rv.a.Set(c0 * idet, (a.z * c.y - a.y * c.z) * idet,
+             (a.y * b.z - a.z * b.y) * idet, 0.0f);
+    rv.b.Set(c1 * idet, (a.x * c.z - a.z * c.x) * idet,
+             (a.z * b.x - a.x * b.z) * idet, 0.0f);
+    rv.c.Set(c2 * idet, (a.y * c.x - a.x * c.y) * idet,
+             (a.x * b.y - a.y * b.x) * idet, 0.0f);
+
+    FinishAffineInverse(rv, Vector(a.w, b.w, c.w, 0.0f));
+    return rv;
+}
+
+Matrix
+Matrix::InverseRigid()
+{
+    assert(d.x == 0.0f && d.y == 0.0f && d.z == 0.0f && d.w == 1.0f);
+    Matrix rv = Transpose();
+    FinishAffineInverse(rv, Vector(a.w, b.w, c.w, 0.0f));
+    return rv;
+}
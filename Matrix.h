@@ -89,6 +89,12 @@ class Matrix {
                float bottom, float top,
                float near, float far);
 
+    /*
+     * Postmultiply by a perspective projection matrix equivalent to the one
+     * obtained with gluPerspective(). fovy is in degrees.
+     */
+    void Perspective(float fovy, float aspect, float near, float far);
+
     /*
      * Postmultiply by a view matrix equivalent to the one
      * obtained with gluLookAt().
@@ -106,6 +112,22 @@ class Matrix {
     */
     Matrix MMProduct(Matrix& mat);
 
+    /*
+     * Batch matrix-vector product: out[i] = mat * in[i], for count vectors.
+     * For many points at once, see VectorArray::Transform().
+     */
+    static void MVProductBatch(const Matrix& mat, const Vector* in,
+                               Vector* out, unsigned count);
+
+    /*
+     * Batch composition: out[i] = lhs[i] * rhs[i], for count matrices. out
+     * may be the same array as either input. Rows are already one SSE
+     * register each, so unlike vectors there's nothing to gain from
+     * splitting matrices up into separate arrays.
+     */
+    static void MMProductBatch(const Matrix* lhs, const Matrix* rhs,
+                               Matrix* out, unsigned count);
+
     /*
      * Sets us to our transpose.
      */
@@ -123,6 +145,27 @@ class Matrix {
     */
     Matrix Inverse();
 
+    /*
+     * Full 4x4 inverse, computed directly from the cofactors. The matrix
+     * must be invertible.
+     */
+    Matrix Inverse4();
+
+    /*
+     * Inverse of an affine matrix (bottom row 0 0 0 1): the 3x3 inverse,
+     * with the translation run back through it. Only about 20% faster
+     * than Inverse4() in bench_matrix, since both are a few dozen
+     * multiplies either way.
+     */
+    Matrix InverseAffine();
+
+    /*
+     * Inverse of a rigid matrix, which only rotates and translates: the
+     * transposed rotation, with the translation run back through it. The
+     * cheapest of the lot, but gives garbage for anything that scales.
+     */
+    Matrix InverseRigid();
+
     /*
     * For debugging, dumps a matrix to stdout.
     */
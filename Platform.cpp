@@ -73,7 +73,7 @@ Platform::update()
     {
 		dropVelocity += GRAVITY;
 		dropY+=dropVelocity;
-		if(dropY > 30.0) // If done dropping, go back to being idle
+		if(dropY > DROP_DISTANCE) // If done dropping, go back to being idle
         {
 			dropY=0;
 			dropVelocity = 0;
@@ -171,3 +171,33 @@ Platform::getFallingRingPos()
 {
     return -dropY;
 }
+
+void
+Platform::getState(PlatformState& stateOut)
+{
+    stateOut.dropTimer = dropTimer;
+    stateOut.blinkTimer = blinkTimer;
+    stateOut.dropCount = dropCount;
+    stateOut.fallingRing = fallingRing;
+    stateOut.dropState = dropState;
+    stateOut.blinkOn = blinkOn;
+    stateOut.curRadius = curRadius;
+    stateOut.curDrawRadius = curDrawRadius;
+    stateOut.dropVelocity = dropVelocity;
+    stateOut.dropY = dropY;
+}
+
+void
+Platform::setState(const PlatformState& stateIn)
+{
+    dropTimer = stateIn.dropTimer;
+    blinkTimer = stateIn.blinkTimer;
+    dropCount = stateIn.dropCount;
+    fallingRing = stateIn.fallingRing;
+    dropState = stateIn.dropState;
+    blinkOn = stateIn.blinkOn;
+    curRadius = stateIn.curRadius;
+    curDrawRadius = stateIn.curDrawRadius;
+    dropVelocity = stateIn.dropVelocity;
+    dropY = stateIn.dropY;
+}
@@ -10,9 +10,18 @@ const float RADIUS_DECREASE = 3.0f;  // Radius of each ring that falls
 const int NUM_DROPS = 4;            // Number of drops
 const int BLINK_TICKS = 10;         // Time to switch blink color
 const float GRAVITY = 0.05f;         // Gravity
+const float DROP_DISTANCE = 30.0f;   // Distance a ring falls before it's gone
 
 enum {IDLE, BLINKING, FALLING};
 
+// Snapshot of the mutable platform state, for world state dumps
+struct PlatformState {
+    int dropTimer, blinkTimer, dropCount, fallingRing, dropState;
+    bool blinkOn;
+    float curRadius, curDrawRadius;
+    float dropVelocity, dropY;
+};
+
 class Platform
 {
 public:
@@ -24,6 +33,8 @@ public:
     float getRadius();
     int getFallingRing();
     float getFallingRingPos();
+    void getState(PlatformState& stateOut);
+    void setState(const PlatformState& stateIn);
 
 private:
     int dropTicks, dropTimer, blinkTimer, dropCount, fallingRing; // Timers and counters
@@ -42,4 +53,4 @@ private:
     int dropState;
 };
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -13,7 +13,7 @@
 Player::Player(unsigned playerID,
                SceneNode* playerSceneNode,
                Vector initialPosition,
-               Matrix initialRotation) : mPlayerID(playerID)
+               Quaternion initialRotation) : mPlayerID(playerID)
                                        , mPlayerNode(playerSceneNode)
                                        , mRotation()
                                        , mActiveInputs(0)
@@ -24,11 +24,15 @@ Player::Player(unsigned playerID,
 
 void
 Player::updateTransform(){
+    // Headless players have nothing to update
+    if (mPlayerNode == NULL)
+        return;
+
     Matrix translationMatrix;
     translationMatrix.Translate(mPosition.x, mPosition.y, mPosition.z);
     mPlayerNode->LoadIdentityTransform();
     mPlayerNode->ApplyTransform(translationMatrix);
-    mPlayerNode->ApplyTransform(mRotation);
+    mPlayerNode->ApplyTransform(mRotation.ToMatrix());
 }
 
 void
@@ -37,18 +41,26 @@ Player::setPosition(Vector pos) {
     updateTransform();
 }
 
+void
+Player::setPose(Vector pos, Quaternion rotation, bool updateNode) {
+    mPosition = pos;
+    mRotation = rotation;
+    if (updateNode)
+        updateTransform();
+}
+
 Vector
 Player::getPosition() {
     return mPosition;
 }
 
 void 
-Player::setRotation(Matrix rotation){
+Player::setRotation(Quaternion rotation){
     mRotation = rotation;
     updateTransform();
 }
 
-Matrix
+Quaternion
 Player::getRotation(){
     return mRotation;
 }
@@ -12,6 +12,7 @@
 
 #include "Framework.h"
 #include "SceneGraph.h"
+#include "Quaternion.h"
 #ifdef _WIN32
 #include <stdint.h>
 #endif
@@ -26,7 +27,7 @@ public:
      * constructor
      */
     Player(unsigned playerID, SceneNode* playerSceneNode, Vector initialPosition, 
-        Matrix initialRotation);
+        Quaternion initialRotation);
     
     /*
      * move the player to a specified location
@@ -39,14 +40,26 @@ public:
     Vector getPosition();
     
     /*
-     * move the player to a specified location
+     * rotate the player to a specified orientation
      */
-    void setRotation(Matrix rotation);
+    void setRotation(Quaternion rotation);
     
     /*
-     * Get the current position of the player
+     * Get the current orientation of the player
+     */
+    Quaternion getRotation();
+
+    /*
+     * Moves and rotates the player at once. If updateNode is false, the
+     * scenegraph node stays where it was until the next updateTransform().
      */
-    Matrix getRotation();
+    void setPose(Vector pos, Quaternion rotation, bool updateNode = true);
+
+    /*
+     * Updates player's transformation matrix.
+     * Used after setting the player's position and/or rotation.
+     */
+    void updateTransform();
 
     /*
      * Apply an input.
@@ -58,28 +71,35 @@ public:
      */
     unsigned GetPlayerID() { return mPlayerID; } ;
 
+    /*
+     * Gets our scenegraph node, or NULL if we don't have one.
+     */
+    SceneNode* GetSceneNode() { return mPlayerNode; };
+
     /*
      * Get the active inputs.
      */
     uint32_t GetActiveInputs() { return mActiveInputs; };
 
-protected:
+    /*
+     * Overwrite the active inputs. Used when restoring a state snapshot.
+     */
+    void setActiveInputs(uint32_t activeInputs) { mActiveInputs = activeInputs; };
 
-    // Updates player's transformation matrix.
-    // Used after setting the player's position and/or rotation.
-    void updateTransform();
+protected:
 
     // The ID of the player
     unsigned mPlayerID;
 
-    // the node in the scene that contains the mesh for the player
+    // the node in the scene that contains the mesh for the player. NULL for
+    // headless worlds.
     SceneNode* mPlayerNode;
 
     // The current position of the player
     Vector mPosition;
 
     // Quaternion representing player's rotation
-    Matrix mRotation;
+    Quaternion mRotation;
 
     // The current active inputs applied to this player.
     // This is a bitfield of the USERINPUT_* variety, with only begin
@@ -0,0 +1,204 @@
+#include "Quaternion.h"
+#ifdef _WIN32
+#define _USE_MATH_DEFINES
+#endif
+#include <math.h>
+#include <assert.h>
+
+// When two quaternions are this close, Slerp() falls back to Nlerp()
+#define QUATERNION_SLERP_THRESHOLD 0.9995f
+
+// Largest magnitude of any but the largest component of a unit quaternion
+#define QUATERNION_SMALL_MAX 0.70710678f
+
+Quaternion::Quaternion(const btQuaternion& quat) : x(quat.x())
+                                                 , y(quat.y())
+                                                 , z(quat.z())
+                                                 , w(quat.w())
+{
+}
+
+Quaternion::Quaternion(const Matrix& mat)
+{
+    // Shepperd's method. We pick whichever of w, x, y and z is largest to
+    // divide by, to keep things stable.
+    float trace = mat[0][0] + mat[1][1] + mat[2][2];
+    if (trace > 0.0f) {
+        float s = sqrt(trace + 1.0f) * 2.0f;
+        w = 0.25f * s;
+        x = (mat[2][1] - mat[1][2]) / s;
+        y = (mat[0][2] - mat[2][0]) / s;
+        z = (mat[1][0] - mat[0][1]) / s;
+    }
+    else if (mat[0][0] > mat[1][1] && mat[0][0] > mat[2][2]) {
+        float s = sqrt(1.0f + mat[0][0] - mat[1][1] - mat[2][2]) * 2.0f;
+        w = (mat[2][1] - mat[1][2]) / s;
+        x = 0.25f * s;
+        y = (mat[0][1] + mat[1][0]) / s;
+        z = (mat[0][2] + mat[2][0]) / s;
+    }
+    else if (mat[1][1] > mat[2][2]) {
+        float s = sqrt(1.0f + mat[1][1] - mat[0][0] - mat[2][2]) * 2.0f;
+        w = (mat[0][2] - mat[2][0]) / s;
+        x = (mat[0][1] + mat[1][0]) / s;
+        y = 0.25f * s;
+        z = (mat[1][2] + mat[2][1]) / s;
+    }
+    else {
+        float s = sqrt(1.0f + mat[2][2] - mat[0][0] - mat[1][1]) * 2.0f;
+        w = (mat[1][0] - mat[0][1]) / s;
+        x = (mat[0][2] + mat[2][0]) / s;
+        y = (mat[1][2] + mat[2][1]) / s;
+        z = 0.25f * s;
+    }
+}
+
+Quaternion
+Quaternion::FromAxisAngle(float angle, float x, float y, float z)
+{
+    float l = sqrt(x * x + y * y + z * z);
+    assert(l != 0.0f);
+    float half = angle * M_PI / 360.0f;
+    float s = sin(half) / l;
+    return Quaternion(x * s, y * s, z * s, cos(half));
+}
+
+Matrix
+Quaternion::ToMatrix() const
+{
+    Matrix rv;
+    float xx = x * x, yy = y * y, zz = z * z;
+    float xy = x * y, xz = x * z, yz = y * z;
+    float wx = w * x, wy = w * y, wz = w * z;
+
+    rv[0].Set(1.0f - 2.0f * (yy + zz), 2.0f * (xy - wz), 2.0f * (xz + wy), 0.0f);
+    rv[1].Set(2.0f * (xy + wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz - wx), 0.0f);
+    rv[2].Set(2.0f * (xz - wy), 2.0f * (yz + wx), 1.0f - 2.0f * (xx + yy), 0.0f);
+    return rv;
+}
+
+btQuaternion
+Quaternion::ToBullet() const
+{
+    return btQuaternion(x, y, z, w);
+}
+
+Quaternion
+Quaternion::operator*(const Quaternion& other) const
+{
+    return Quaternion(w * other.x + x * other.w + y * other.z - z * other.y,
+                      w * other.y - x * other.z + y * other.w + z * other.x,
+                      w * other.z + x * other.y - y * other.x + z * other.w,
+                      w * other.w - x * other.x - y * other.y - z * other.z);
+}
+
+float
+Quaternion::Dot(const Quaternion& other) const
+{
+    return x * other.x + y * other.y + z * other.z + w * other.w;
+}
+
+Quaternion
+Quaternion::Normalized() const
+{
+    float l = sqrt(Dot(*this));
+    assert(l != 0.0f);
+    return Quaternion(x / l, y / l, z / l, w / l);
+}
+
+Vector
+Quaternion::Rotate(const Vector& vec) const
+{
+    // v' = v + 2w(q x v) + 2q x (q x v), with q the vector part
+    Vector q(x, y, z, 0.0f);
+    Vector v(vec.x, vec.y, vec.z, 0.0f);
+    Vector t = q.Cross(v).Scale(2.0f);
+    Vector rv = v + t.Scale(w) + q.Cross(t);
+    rv.w = vec.w;
+    return rv;
+}
+
+Quaternion
+Quaternion::Nlerp(const Quaternion& a, const Quaternion& b, float t)
+{
+    // q and -q are the same rotation. Pick whichever is closer.
+    float sign = a.Dot(b) < 0.0f ? -1.0f : 1.0f;
+    float s = 1.0f - t;
+    t *= sign;
+    return Quaternion(a.x * s + b.x * t, a.y * s + b.y * t,
+                      a.z * s + b.z * t, a.w * s + b.w * t).Normalized();
+}
+
+Quaternion
+Quaternion::Slerp(const Quaternion& a, const Quaternion& b, float t)
+{
+    float cosine = a.Dot(b);
+    float sign = 1.0f;
+    if (cosine < 0.0f) {
+        cosine = -cosine;
+        sign = -1.0f;
+    }
+
+    // Too close to tell the difference, and sin() would blow up
+    if (cosine > QUATERNION_SLERP_THRESHOLD)
+        return Nlerp(a, b, t);
+
+    float angle = acos(cosine);
+    float sine = sin(angle);
+    float s = sin((1.0f - t) * angle) / sine;
+    float u = sign * sin(t * angle) / sine;
+    return Quaternion(a.x * s + b.x * u, a.y * s + b.y * u,
+                      a.z * s + b.z * u, a.w * s + b.w * u);
+}
+
+uint64_t
+Quaternion::Pack() const
+{
+    const float components[4] = { x, y, z, w };
+
+    // Find the largest component
+    unsigned largest = 0;
+    for (unsigned i = 1; i < 4; ++i)
+        if (fabs(components[i]) > fabs(components[largest]))
+            largest = i;
+
+    // We always reconstruct it as positive, so flip the whole thing if it
+    // isn't. Same rotation either way.
+    float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+
+    const uint64_t maxValue = (1 << QUATERNION_PACK_BITS) - 1;
+    uint64_t packed = largest;
+    for (unsigned i = 0; i < 4; ++i) {
+        if (i == largest)
+            continue;
+        float value = sign * components[i];
+        float normalized = (value / QUATERNION_SMALL_MAX + 1.0f) * 0.5f;
+        normalized = MAX(0.0f, MIN(1.0f, normalized));
+        packed = (packed << QUATERNION_PACK_BITS) |
+                 (uint64_t) (normalized * maxValue + 0.5f);
+    }
+    return packed;
+}
+
+Quaternion
+Quaternion::Unpack(uint64_t packed)
+{
+    const uint64_t maxValue = (1 << QUATERNION_PACK_BITS) - 1;
+    unsigned largest = (unsigned) (packed >> (3 * QUATERNION_PACK_BITS)) & 3;
+
+    // The three small ones come out in reverse order
+    float components[4];
+    float sumSquares = 0.0f;
+    for (int i = 3; i >= 0; --i) {
+        if ((unsigned) i == largest)
+            continue;
+        float normalized = (float) (packed & maxValue) / maxValue;
+        components[i] = (normalized * 2.0f - 1.0f) * QUATERNION_SMALL_MAX;
+        sumSquares += components[i] * components[i];
+        packed >>= QUATERNION_PACK_BITS;
+    }
+    components[largest] = sqrt(MAX(0.0f, 1.0f - sumSquares));
+
+    return Quaternion(components[0], components[1], components[2],
+                      components[3]);
+}
@@ -0,0 +1,98 @@
+#ifndef QUATERNION_H
+#define QUATERNION_H
+
+#include "Framework.h"
+#include "Vector.h"
+#include "Matrix.h"
+#include <stdint.h>
+
+// Bits per component when packing a quaternion with Pack(). Three of these
+// plus two bits of index fit in 64 bits.
+#define QUATERNION_PACK_BITS 20
+
+/*
+ * Unit quaternion representing a rotation.
+ *
+ * Composes with a single multiply, interpolates smoothly, and packs into
+ * 8 bytes, where a rotation Matrix takes 64.
+ */
+struct Quaternion {
+
+    float x, y, z, w;
+
+    /*
+     * Constructors. The default is the identity rotation.
+     */
+    Quaternion() : x(0.0f), y(0.0f), z(0.0f), w(1.0f) {};
+    Quaternion(float xx, float yy, float zz, float ww)
+        : x(xx), y(yy), z(zz), w(ww) {};
+    Quaternion(const btQuaternion& quat);
+
+    /*
+     * Builds the rotation in the upper 3x3 of a matrix, which must be a
+     * pure rotation.
+     */
+    Quaternion(const Matrix& mat);
+
+    /*
+     * Builds a rotation of angle degrees around an axis.
+     */
+    static Quaternion FromAxisAngle(float angle, float x, float y, float z);
+
+    /*
+     * Conversions. ToMatrix() gives a rotation in the upper 3x3, and the
+     * identity elsewhere.
+     */
+    Matrix ToMatrix() const;
+    btQuaternion ToBullet() const;
+
+    /*
+     * Composition. (a * b) rotates by b, then by a, like Matrix products.
+     */
+    Quaternion operator*(const Quaternion& other) const;
+
+    /*
+     * The inverse rotation.
+     */
+    Quaternion Conjugate() const { return Quaternion(-x, -y, -z, w); };
+
+    /*
+     * 4D dot product.
+     */
+    float Dot(const Quaternion& other) const;
+
+    /*
+     * Gets a unit quaternion in the same direction.
+     */
+    Quaternion Normalized() const;
+
+    /*
+     * Rotates a vector. w is passed through.
+     */
+    Vector Rotate(const Vector& vec) const;
+
+    /*
+     * Normalized linear interpolation from a (t = 0) to b (t = 1), the short
+     * way round. Cheap, and close enough to Slerp() for small steps, like
+     * one tick to the next.
+     */
+    static Quaternion Nlerp(const Quaternion& a, const Quaternion& b, float t);
+
+    /*
+     * Spherical linear interpolation from a (t = 0) to b (t = 1), the short
+     * way round. Constant angular speed.
+     */
+    static Quaternion Slerp(const Quaternion& a, const Quaternion& b, float t);
+
+    /*
+     * Packs a unit quaternion into 64 bits with the "smallest three" scheme.
+     * We drop the largest component, which can be recovered since the
+     * quaternion has unit length, and store its index in the top two bits.
+     * The others all lie in [-1/sqrt(2), 1/sqrt(2)], and each gets
+     * QUATERNION_PACK_BITS bits, so the error is about 1e-6.
+     */
+    uint64_t Pack() const;
+    static Quaternion Unpack(uint64_t packed);
+};
+
+#endif /* QUATERNION_H */
@@ -6,12 +6,27 @@
 
 using std::vector;
 
+// The shader #defines for each SHADERVARIANT_* bit, in bit order
+static const char* sVariantDefines[SHADERVARIANT_DEFINE_COUNT] = {
+    "SHADOW_PASS", "MAP_NORMALS", "MAP_ENVIRONMENT", "RENDER_PARTICLES"
+};
+
+// The shader attributes, in SHADERATTRIB_* order
+static const char* sAttributeNames[SHADERATTRIB_COUNT] = {
+    "positionIn", "texcoordIn", "normalIn", "tangentIn", "bitangentIn",
+    "particleAgeIn"
+};
+
 RenderContext::RenderContext() : mDoingShadowPass(false)
                                , mShadowsDirty(true)
                                , mWindowSettings(24, 8, 2)
                                , mWindow(sf::VideoMode(800, 600), "Growbles",
                                          sf::Style::Close, mWindowSettings)
                                , mShader(SHADER_PATH)
+                               , mProgram(NULL)
+                               , mVariant(0)
+                               , mFrameVersion(1)
+                               , mProfiler(NULL)
 {
     /*
      * Lighting Defaults.
@@ -62,14 +77,17 @@ RenderContext::Init()
     }
 #endif
 
+    // Set up GPU timing
+    mGpuTimer.Init();
+
     // Common defaults
     GL_CHECK(glClearDepth(1.0f));
     GL_CHECK(glClearColor(0.6f, 0.56f, 1.0f, 1.0f));
     GL_CHECK(glEnable(GL_DEPTH_TEST));
 
-    // Initialize and use our shaders
-    mShader.Init();
-    GL_CHECK(glUseProgram(mShader.programID()));
+    // Initialize our shaders
+    mShader.Init(sVariantDefines, SHADERVARIANT_DEFINE_COUNT,
+                 sAttributeNames, SHADERATTRIB_COUNT);
 
     // Initialize the shadow buffer
     mShadowTarget.Init(SHADOW_TEXTURE_WIDTH, SHADOW_TEXTURE_HEIGHT);
@@ -77,14 +95,6 @@ RenderContext::Init()
     // Setup the view system
     SetViewportAndProjection();
 
-    // Set up the shader
-    SET_UNIFORM(this, 1i, "spriteMap", SPRITE_TEXTURE_SAMPLER);
-    SET_UNIFORM(this, 1i, "diffuseMap", DIFFUSE_TEXTURE_SAMPLER);
-    SET_UNIFORM(this, 1i, "specularMap", SPECULAR_TEXTURE_SAMPLER);
-    SET_UNIFORM(this, 1i, "normalMap", NORMAL_TEXTURE_SAMPLER);
-    SET_UNIFORM(this, 1i, "shadowMap", SHADOW_TEXTURE_SAMPLER);
-    SET_UNIFORM(this, 1i, "envMap", ENV_TEXTURE_SAMPLER);
-
     // Make sure the shadow pass starts disabled
     SetShadowPassEnabled(false);
 
@@ -93,14 +103,23 @@ RenderContext::Init()
 
     // Apply the camera
     SetViewToCamera();
+
+    // Start out with the plain variant
+    UseShaderVariant(0);
 }
 
 void
 RenderContext::Render(SceneGraph& sceneGraph)
 {
     // If our shadow buffer is dirty, do a shadow pass
-    if (mShadowsDirty)
+    if (mShadowsDirty) {
+        ScopedPhase phase(mProfiler, FRAMEPHASE_SHADOW);
+        ScopedGpuPhase gpuPhase(&mGpuTimer, FRAMEPHASE_GPU_SHADOW);
         ShadowPass(sceneGraph);
+    }
+
+    ScopedPhase phase(mProfiler, FRAMEPHASE_SCENE);
+    ScopedGpuPhase gpuPhase(&mGpuTimer, FRAMEPHASE_GPU_SCENE);
 
     // Clear the buffers
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -120,6 +139,19 @@ RenderContext::Render(SceneGraph& sceneGraph)
     glFlush();
 }
 
+void
+RenderContext::SetProfiler(FrameProfiler* profiler)
+{
+    mProfiler = profiler;
+    mGpuTimer.SetProfiler(profiler);
+}
+
+void
+RenderContext::EndFrame()
+{
+    mGpuTimer.EndFrame();
+}
+
 void
 RenderContext::ShadowPass(SceneGraph& sceneGraph)
 {
@@ -135,10 +167,14 @@ RenderContext::ShadowPass(SceneGraph& sceneGraph)
     // The viewport is set to the size of the target texture.
     GL_CHECK(glViewport(0, 0, SHADOW_TEXTURE_WIDTH, SHADOW_TEXTURE_HEIGHT));
 
+    // Only things the light can see cast shadows
+    mFrustum.Set(mLightMatrix);
+
     // Render the models
     sceneGraph.Render();
 
-    // Reset the viewport (and, incidentally, the projection matrix)
+    // Reset the viewport (and, incidentally, the projection matrix and
+    // frustum)
     SetViewportAndProjection();
 
     // Disable the shadow pass
@@ -155,11 +191,12 @@ void
 RenderContext::MoveCamera(float forward, float right)
 {
     // Looking down the -z axis, right is +x and forward is -z
-    Vector direction(right, 0.0, -forward, 1.0);
+    Vector direction(right, 0.0, -forward, 0.0);
 
     // This vector is a vector in view space. Put it in world space and
-    // apply it to our world space camera coordinates.
-    direction = GeneratePanMatrix().Inverse().MVProduct(direction);
+    // apply it to our world space camera coordinates. The pan matrix is
+    // just a rotation.
+    direction = GeneratePanMatrix().InverseRigid().MVProduct(direction);
     mCameraPos = mCameraPos + direction;
 
     // Re-send the camera info
@@ -200,15 +237,12 @@ void
 RenderContext::SetViewportAndProjection()
 {
     GL_CHECK(glViewport(0, 0, mWindow.GetWidth(), mWindow.GetHeight()));
-    GL_CHECK(glMatrixMode(GL_PROJECTION));
-    GL_CHECK(glLoadIdentity());
-    GL_CHECK(gluPerspective(60.0,
-                            ((GLfloat)mWindow.GetWidth()) /
-                            ((GLfloat)mWindow.GetHeight()),
-                            CAMERA_NEAR, CAMERA_FAR));
-
-    // Make sure to pass the viewport size to the shader
-    SET_UNIFORM(this, 1f, "viewportWidth", mWindow.GetWidth());
+    Matrix projection;
+    projection.Perspective(60.0f,
+                           ((GLfloat)mWindow.GetWidth()) /
+                           ((GLfloat)mWindow.GetHeight()),
+                           CAMERA_NEAR, CAMERA_FAR);
+    SetProjection(projection);
 }
 
 void
@@ -228,56 +262,158 @@ void
 RenderContext::SetShadowPassEnabled(bool enabled)
 {
     mDoingShadowPass = enabled;
-    SET_UNIFORM(this, 1i, "shadowPass", enabled ? 1 : 0);
+}
+
+unsigned
+RenderContext::ChooseShaderVariant(unsigned features)
+{
+    // Depth is all the shadow pass wants
+    if (mDoingShadowPass)
+        return SHADERVARIANT_SHADOW_PASS;
+    return features;
+}
+
+bool
+RenderContext::UseShaderVariant(unsigned variant)
+{
+    bool changed = (mProgram == NULL || variant != mVariant);
+    if (changed) {
+        ShaderProgram& program = mPrograms[variant];
+        bool firstUse = (program.programID == 0);
+        if (firstUse) {
+            program.programID = mShader.programID(variant);
+            if (!mShader.loaded()) {
+                printf("Warning - Shader variant %u didn't build:\n%s",
+                       variant, mShader.errors().c_str());
+                exit(-1);
+            }
+        }
+        GL_CHECK(glUseProgram(program.programID));
+        mProgram = &program;
+        mVariant = variant;
+
+        // Samplers never change, so they only need setting once
+        if (firstUse) {
+            SET_UNIFORM(this, 1i, "spriteMap", SPRITE_TEXTURE_SAMPLER);
+            SET_UNIFORM(this, 1i, "diffuseMap", DIFFUSE_TEXTURE_SAMPLER);
+            SET_UNIFORM(this, 1i, "specularMap", SPECULAR_TEXTURE_SAMPLER);
+            SET_UNIFORM(this, 1i, "normalMap", NORMAL_TEXTURE_SAMPLER);
+            SET_UNIFORM(this, 1i, "shadowMap", SHADOW_TEXTURE_SAMPLER);
+            SET_UNIFORM(this, 1i, "envMap", ENV_TEXTURE_SAMPLER);
+        }
+    }
+
+    // Catch up on anything that changed since this variant last drew
+    if (mProgram->frameVersion != mFrameVersion) {
+        SendFrameUniforms();
+        mProgram->frameVersion = mFrameVersion;
+    }
+
+    return changed;
+}
+
+void
+RenderContext::SendFrameUniforms()
+{
+    GLfloat projectionArray[16];
+    mProjection.Get(projectionArray);
+    SET_UNIFORMMATV(this, 4fv, "projectionMatrix", projectionArray);
+
+    // Views only ever rotate and translate
+    GLfloat invView[9];
+    mView.InverseRigid().Get3x3(invView);
+    SET_UNIFORMMATV(this, 3fv, "inverseViewMatrix", invView);
+
+    SET_UNIFORMARRAY(this, 4fv, "lightBlock", LIGHT_BLOCK_SIZE,
+                     (GLfloat*) mLightBlock);
+
+    GLfloat lightMatArray[16];
+    mLightMatrix.Get(lightMatArray);
+    SET_UNIFORMMATV(this, 4fv, "lightMatrix", lightMatArray);
+
+    SET_UNIFORM(this, 1f, "viewportWidth", mWindow.GetWidth());
+}
+
+GLint
+RenderContext::GetUniformLocation(const char* name)
+{
+    assert(mProgram);
+    std::map<const char*, GLint>& locations = mProgram->uniformLocations;
+    std::map<const char*, GLint>::iterator it = locations.find(name);
+    if (it != locations.end())
+        return it->second;
+
+    GLint location;
+    GL_CHECK(location = glGetUniformLocation(mProgram->programID, name));
+    locations[name] = location;
+    return location;
 }
 
 void
 RenderContext::SetLighting()
 {
-    // First light (directional)
-    glEnable(GL_LIGHT0);
-    glLightfv(GL_LIGHT0, GL_POSITION,
-              (GLfloat*) &mLights[SCENELIGHT_DIRECTIONAL].position);
-    glLightfv(GL_LIGHT0, GL_AMBIENT,
-              (GLfloat*) &mLights[SCENELIGHT_DIRECTIONAL].ambient);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE,
-              (GLfloat*) &mLights[SCENELIGHT_DIRECTIONAL].diffuse);
-    glLightfv(GL_LIGHT0, GL_SPECULAR,
-              (GLfloat*) &mLights[SCENELIGHT_DIRECTIONAL].specular);
-
-    // Second light (point)
-    glEnable(GL_LIGHT1);
-    glLightfv(GL_LIGHT1, GL_POSITION,
-              (GLfloat*) &mLights[SCENELIGHT_POINT].position);
-    glLightfv(GL_LIGHT1, GL_AMBIENT,
-              (GLfloat*) &mLights[SCENELIGHT_POINT].ambient);
-    glLightfv(GL_LIGHT1, GL_DIFFUSE,
-              (GLfloat*) &mLights[SCENELIGHT_POINT].diffuse);
-    glLightfv(GL_LIGHT1, GL_SPECULAR,
-              (GLfloat*) &mLights[SCENELIGHT_POINT].specular);
+    // Positions go to eye space, as glLightfv() would have done for us.
+    // Directional lights have w = 0, so they only get rotated.
+    for (unsigned i = 0; i < SCENELIGHT_COUNT; ++i) {
+        Vector* light = mLightBlock + i * LIGHT_BLOCK_VECTORS_PER_LIGHT;
+        light[0] = mView.MVProduct(mLights[i].position);
+        light[1] = mLights[i].ambient;
+        light[2] = mLights[i].diffuse;
+        light[3] = mLights[i].specular;
+    }
+    FrameUniformsChanged();
 }
 
 void
-RenderContext::SetView(Matrix& view)
+RenderContext::SetProjection(Matrix& projection)
 {
-    // Read the matrix out in OpenGL format
-    GLfloat viewArray[16];
-    view.Get(viewArray);
+    mProjection = projection;
+    UpdateFrustum();
+    FrameUniformsChanged();
+}
 
-    // Apply
-    GL_CHECK(glMatrixMode(GL_MODELVIEW));
-    GL_CHECK(glLoadIdentity());
-    GL_CHECK(glMultMatrixf(viewArray));
+void
+RenderContext::UpdateFrustum()
+{
+    mFrustum.Set(mProjection.MMProduct(mView));
+}
 
-    // Generate the inverse upper-3x3 view matrix for the shader.
-    GLfloat invView[9];
-    view.Inverse().Get3x3(invView);
-    SET_UNIFORMMATV(this, 3fv, "inverseViewMatrix", invView);
+void
+RenderContext::SetView(Matrix& view)
+{
+    // We can see something else now
+    mView = view;
+    UpdateFrustum();
 
-    // Reset the lighting using the new view matrix
+    // Reset the lighting using the new view matrix. This also lets the
+    // shaders know about the new view.
     SetLighting();
 }
 
+void
+RenderContext::SetModelMatrix(const Matrix& model)
+{
+    // The model matrix on its own is for shadow mapping
+    Matrix modelMatrix = model;
+    GLfloat modelArray[16];
+    modelMatrix.Get(modelArray);
+    SET_UNIFORMMATV(this, 4fv, "modelMatrix", modelArray);
+    if (mDoingShadowPass)
+        return;
+
+    // Eye space, for everything else
+    Matrix modelView = mView.MMProduct(modelMatrix);
+    GLfloat modelViewArray[16];
+    modelView.Get(modelViewArray);
+    SET_UNIFORMMATV(this, 4fv, "modelViewMatrix", modelViewArray);
+
+    // Normals take the inverse transpose, so that they stay perpendicular
+    // to surfaces under non-uniform scaling
+    GLfloat normalArray[9];
+    modelView.Inverse().Transpose().Get3x3(normalArray);
+    SET_UNIFORMMATV(this, 3fv, "normalMatrix", normalArray);
+}
+
 void
 RenderContext::SetViewToCamera()
 {
@@ -347,10 +483,9 @@ RenderContext::RegenerateLightMatrix()
     Vector up(0.0f, 1.0f, 0.0f, 1.0f);
     lightMat.LookAt(eye, center, up);
 
-    // Store the light-space matrix to the shader
-    GLfloat lightMatArray[16];
-    lightMat.Get(lightMatArray);
-    SET_UNIFORMMATV(this, 4fv, "lightMatrix", lightMatArray);
+    // Keep the light-space matrix for the shaders and for culling
+    mLightMatrix = lightMat;
+    FrameUniformsChanged();
 }
 
 void
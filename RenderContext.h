@@ -3,10 +3,14 @@
 
 #include "Framework.h"
 #include "Matrix.h"
+#include "Frustum.h"
 #include "DepthRenderTarget.h"
 #include "SceneGraph.h"
 #include "Shader.h"
+#include "FrameProfiler.h"
+#include "GpuTimer.h"
 #include <vector>
+#include <map>
 
 /*
  * General parameters.
@@ -17,6 +21,10 @@
 #define CAMERA_NEAR 0.1
 #define CAMERA_FAR 80.0
 
+// The most frames we draw per second. Vertical sync usually holds us to the
+// display's rate already; this catches drivers that ignore it.
+#define RENDER_FRAMERATE_LIMIT 60
+
 #define SHADOW_TEXTURE_WIDTH 3000
 #define SHADOW_TEXTURE_HEIGHT 3000
 
@@ -49,6 +57,55 @@ typedef enum {
     SCENELIGHT_COUNT
 } SceneLightType;
 
+// The lights go to the shader as one array of vectors, "lightBlock": for
+// each light, its eye space position, then its ambient, diffuse and
+// specular colors.
+#define LIGHT_BLOCK_VECTORS_PER_LIGHT 4
+#define LIGHT_BLOCK_SIZE (SCENELIGHT_COUNT * LIGHT_BLOCK_VECTORS_PER_LIGHT)
+
+/*
+ * Shader variants. A variant key is some combination of these, and each
+ * bit turns on the #define of the same name in the shaders.
+ */
+typedef enum {
+    SHADERVARIANT_SHADOW_PASS = 1 << 0,
+    SHADERVARIANT_MAP_NORMALS = 1 << 1,
+    SHADERVARIANT_MAP_ENVIRONMENT = 1 << 2,
+    SHADERVARIANT_RENDER_PARTICLES = 1 << 3
+} ShaderVariantFlag;
+
+#define SHADERVARIANT_DEFINE_COUNT 4
+
+/*
+ * Vertex attributes. Every shader variant has these at the same locations.
+ */
+typedef enum {
+    SHADERATTRIB_POSITION = 0,
+    SHADERATTRIB_TEXCOORD,
+    SHADERATTRIB_NORMAL,
+    SHADERATTRIB_TANGENT,
+    SHADERATTRIB_BITANGENT,
+    SHADERATTRIB_PARTICLE_AGE,
+    SHADERATTRIB_COUNT
+} ShaderAttrib;
+
+/*
+ * What we know about one shader variant.
+ */
+struct ShaderProgram {
+
+    ShaderProgram() : programID(0), frameVersion(0) {};
+
+    GLuint programID;
+
+    // Where its uniforms are, remembered by name address
+    std::map<const char*, GLint> uniformLocations;
+
+    // The RenderContext::mFrameVersion it last got the per-frame uniforms
+    // for
+    unsigned frameVersion;
+};
+
 class RenderContext {
 
 public:
@@ -85,14 +142,30 @@ public:
     void MoveLight(float x, float z);
 
     /*
-     * Sets a new view matrix.
-     *
-     * At the level of Scene, we assume that the modelview has
-     * only a view matrix, and that we can clobber it at will
-     * with something new.
+     * Sets a new view matrix. Call SetModelMatrix() again afterwards. The
+     * view, like the projection and lights, reaches the shaders the next
+     * time UseShaderVariant() is called.
      */
     void SetView(Matrix& view);
 
+    /*
+     * Sets the model matrix for whatever we draw next. We work out the
+     * model-view and normal matrices here too, rather than leaving it to
+     * the driver; the shadow pass only needs the model matrix.
+     */
+    void SetModelMatrix(const Matrix& model);
+
+    /*
+     * Sets a new projection matrix.
+     */
+    void SetProjection(Matrix& projection);
+
+    /*
+     * Gets the frustum for whatever we're drawing right now: the light's
+     * during the shadow pass, and the projection and view's otherwise.
+     */
+    const Frustum& GetFrustum() { return mFrustum; };
+
     /*
      * Sets the view matrix to the camera view.
      */
@@ -104,15 +177,58 @@ public:
     void SetViewportAndProjection();
 
     /*
-     * Gets the shader program ID.
+     * Picks the shader variant for drawing something with the given
+     * SHADERVARIANT_MAP_* features in the current pass. The shadow pass
+     * has a depth-only variant, whatever the features.
+     */
+    unsigned ChooseShaderVariant(unsigned features);
+
+    /*
+     * Switches to a shader variant, building it if need be, and brings its
+     * per-frame uniforms up to date. Returns true if the program changed,
+     * in which case the model matrix and material need setting again.
      */
-    GLint GetShaderID() { return mShader.programID(); };
+    bool UseShaderVariant(unsigned variant);
+
+    /*
+     * Whether we're drawing the shadow pass, which doesn't need materials.
+     */
+    bool IsShadowPass() { return mDoingShadowPass; };
+
+    /*
+     * Gets the current shader program ID.
+     */
+    GLint GetShaderID() { return mProgram->programID; };
+
+    /*
+     * Gets the location of a uniform in the current shader, looking it up
+     * the first time only. Names are remembered by address, so they should
+     * be string literals. Variants that don't use a uniform give -1, which
+     * OpenGL quietly ignores.
+     */
+    GLint GetUniformLocation(const char* name);
 
     /*
      * Gets the window.
      */
     sf::RenderWindow* GetWindow() { return &mWindow; };
 
+    /*
+     * Sets the profiler to report render phases to, on both the CPU and
+     * the GPU. May be NULL.
+     */
+    void SetProfiler(FrameProfiler* profiler);
+
+    /*
+     * Gets the GPU timer.
+     */
+    GpuTimer* GetGpuTimer() { return &mGpuTimer; };
+
+    /*
+     * Called once the frame has been displayed.
+     */
+    void EndFrame();
+
     // Publicly accessible vector of the materials loaded for this rendering
     // context.
     std::vector<Material> materials;
@@ -136,10 +252,22 @@ protected:
     void ShadowPass(SceneGraph& sceneGraph);
 
     /*
-     * Applies the current lighting scheme to OpenGL.
+     * Puts the lights in eye space for the current view.
      */
     void SetLighting();
 
+    /*
+     * Notes that a per-frame uniform changed, so every variant needs them
+     * again.
+     */
+    void FrameUniformsChanged() { ++mFrameVersion; };
+
+    /*
+     * Sends the per-frame uniforms to the current shader variant: the
+     * projection, inverse view, lights, light matrix and viewport width.
+     */
+    void SendFrameUniforms();
+
     /*
      * Generates the camera view matrix.
      */
@@ -158,11 +286,15 @@ protected:
     /*
      * Regenerates the a projection + view matrix
      * that transforms objects from world space into
-     * projected light space. Stores the result in
-     * the shader uniform.
+     * projected light space.
      */
     void RegenerateLightMatrix();
 
+    /*
+     * Recomputes the frustum from the projection and view matrices.
+     */
+    void UpdateFrustum();
+
     /*
      * Renders the shadow buffer to a quad.
      *
@@ -170,13 +302,20 @@ protected:
      */
     void RenderShadowQuad();
 
-    // Lighting
+    // Lighting, and the lights as we send them to the shader
     LightInfo mLights[SCENELIGHT_COUNT];
+    Vector mLightBlock[LIGHT_BLOCK_SIZE];
 
     // Camera Info
     float mPitch, mYaw;
     Vector mCameraPos;
 
+    // The matrices we're drawing with, and what they can see
+    Matrix mProjection;
+    Matrix mView;
+    Matrix mLightMatrix;
+    Frustum mFrustum;
+
     // Shadow texture
     DepthRenderTarget mShadowTarget;
 
@@ -190,8 +329,18 @@ protected:
     sf::WindowSettings mWindowSettings;
     sf::RenderWindow mWindow;
 
-    // Shader
+    // Shader, the variants of it we've used, and the current one
     Shader mShader;
+    std::map<unsigned, ShaderProgram> mPrograms;
+    ShaderProgram* mProgram;
+    unsigned mVariant;
+
+    // Bumped whenever a per-frame uniform changes
+    unsigned mFrameVersion;
+
+    // Where we report timing, if anywhere
+    FrameProfiler* mProfiler;
+    GpuTimer mGpuTimer;
 };
 
 /*
@@ -199,23 +348,22 @@ protected:
  */
 
 #define SET_UNIFORM(context, suffix, name, val) {\
-    GLint location; \
-    GL_CHECK(location = glGetUniformLocation((context)->GetShaderID(), name)); \
-    assert(location >= 0); \
+    GLint location = (context)->GetUniformLocation(name); \
     GL_CHECK(glUniform##suffix(location, val)); \
 }
 
 #define SET_UNIFORMV(context, suffix, name, val) {\
-    GLint location; \
-    GL_CHECK(location = glGetUniformLocation((context)->GetShaderID(), name)); \
-    assert(location >= 0); \
+    GLint location = (context)->GetUniformLocation(name); \
     GL_CHECK(glUniform##suffix(location, 1, val)); \
 }
 
+#define SET_UNIFORMARRAY(context, suffix, name, count, val) {\
+    GLint location = (context)->GetUniformLocation(name); \
+    GL_CHECK(glUniform##suffix(location, count, val)); \
+}
+
 #define SET_UNIFORMMATV(context, suffix, name, val) {\
-    GLint location; \
-    GL_CHECK(location = glGetUniformLocation((context)->GetShaderID(), name)); \
-    assert(location >= 0); \
+    GLint location = (context)->GetUniformLocation(name); \
     GL_CHECK(glUniformMatrix##suffix(location, 1, GL_FALSE, val)); \
 }
 
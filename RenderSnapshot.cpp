@@ -0,0 +1,86 @@
+#include "RenderSnapshot.h"
+
+void
+InterpolateSnapshots(const RenderSnapshot& from, const RenderSnapshot& to,
+                     float t, RenderSnapshot& out)
+{
+    out.timestamp = to.timestamp;
+    out.players.resize(to.players.size());
+    for (unsigned i = 0; i < to.players.size(); ++i) {
+        const PlayerPose& end = to.players[i];
+        PlayerPose& pose = out.players[i];
+        pose = end;
+
+        // Players hardly ever come and go, so they're usually in the same
+        // slot in both
+        const PlayerPose* start = NULL;
+        if (i < from.players.size() && from.players[i].playerID == end.playerID)
+            start = &from.players[i];
+        for (unsigned j = 0; start == NULL && j < from.players.size(); ++j)
+            if (from.players[j].playerID == end.playerID)
+                start = &from.players[j];
+        if (start == NULL)
+            continue;
+
+        Vector delta = end.position - start->position;
+        pose.position = start->position + delta.Scale(t);
+        pose.rotation = Quaternion::Nlerp(start->rotation, end.rotation, t);
+    }
+}
+
+SnapshotBuffer::SnapshotBuffer() : mWriting(0)
+                                 , mComplete(1)
+                                 , mReading(2)
+                                 , mFresh(false)
+                                 , mNumPublished(0)
+                                 , mNumSkipped(0)
+{
+}
+
+void
+SnapshotBuffer::Publish()
+{
+    sf::Lock lock(mMutex);
+
+    // If the renderer never picked up the last one, it's been skipped
+    if (mFresh)
+        ++mNumSkipped;
+
+    unsigned written = mWriting;
+    mWriting = mComplete;
+    mComplete = written;
+    mFresh = true;
+    ++mNumPublished;
+}
+
+const RenderSnapshot*
+SnapshotBuffer::GetLatest()
+{
+    sf::Lock lock(mMutex);
+
+    if (mFresh) {
+        unsigned complete = mComplete;
+        mComplete = mReading;
+        mReading = complete;
+        mFresh = false;
+    }
+
+    // Nothing to show until the first publish
+    if (mNumPublished == 0)
+        return NULL;
+    return &mSnapshots[mReading];
+}
+
+unsigned
+SnapshotBuffer::GetNumPublished()
+{
+    sf::Lock lock(mMutex);
+    return mNumPublished;
+}
+
+unsigned
+SnapshotBuffer::GetNumSkipped()
+{
+    sf::Lock lock(mMutex);
+    return mNumSkipped;
+}
@@ -0,0 +1,109 @@
+#ifndef RENDERSNAPSHOT_H
+#define RENDERSNAPSHOT_H
+
+#include "Framework.h"
+#include "Vector.h"
+#include "Quaternion.h"
+#include <vector>
+
+/*
+ * Where a player is drawn.
+ */
+struct PlayerPose {
+    unsigned playerID;
+    Vector position;
+    Quaternion rotation;
+};
+
+/*
+ * Everything the renderer needs from one step of the simulation. Once
+ * published, a snapshot isn't touched again until the renderer is done
+ * with it.
+ */
+struct RenderSnapshot {
+
+    RenderSnapshot() : timestamp(0) {};
+
+    // The tick this snapshot was taken at
+    unsigned timestamp;
+
+    // Every player in the world. The platform comes from the scene file
+    // and is drawn as is, so there's nothing to say about it.
+    std::vector<PlayerPose> players;
+};
+
+/*
+ * Blends two snapshots, for drawing in between simulation ticks. t is 0 for
+ * from and 1 for to. Players are matched up by ID; anybody who isn't in
+ * from is drawn where to has them.
+ */
+void InterpolateSnapshots(const RenderSnapshot& from, const RenderSnapshot& to,
+                          float t, RenderSnapshot& out);
+
+/*
+ * Hands snapshots from the simulation thread to the render thread without
+ * either one waiting on the other.
+ *
+ * There are three snapshots: one the simulation is writing, one the
+ * renderer is reading, and the most recent complete one. Publishing swaps
+ * the written snapshot with the complete one, and the renderer swaps the
+ * complete one for the one it's reading whenever a new one is available.
+ * The lock is only held for the swaps. If the simulation publishes several
+ * times between frames, the renderer just sees the last one.
+ *
+ * Snapshots are reused, so after the first few ticks filling one in
+ * doesn't allocate.
+ */
+class SnapshotBuffer {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    SnapshotBuffer();
+
+    /*
+     * Simulation thread only. Gets the snapshot to fill in next.
+     */
+    RenderSnapshot& GetWriteSnapshot() { return mSnapshots[mWriting]; };
+
+    /*
+     * Simulation thread only. Makes the snapshot from GetWriteSnapshot() the
+     * latest one.
+     */
+    void Publish();
+
+    /*
+     * Render thread only. Gets the latest snapshot, which stays valid until
+     * the next call. Returns NULL if nothing has been published yet.
+     */
+    const RenderSnapshot* GetLatest();
+
+    /*
+     * Gets the number of snapshots published, and the number the renderer
+     * skipped over because a newer one came along first.
+     */
+    unsigned GetNumPublished();
+    unsigned GetNumSkipped();
+
+    protected:
+
+    // The snapshots, and which one is which
+    RenderSnapshot mSnapshots[3];
+    unsigned mWriting;
+    unsigned mComplete;
+    unsigned mReading;
+
+    // Whether mComplete is newer than mReading
+    bool mFresh;
+
+    // Counters
+    unsigned mNumPublished;
+    unsigned mNumSkipped;
+
+    // Guards the swaps
+    sf::Mutex mMutex;
+};
+
+#endif /* RENDERSNAPSHOT_H */
@@ -0,0 +1,181 @@
+/*
+ * Replays a match recorded with "main -o replayFile", headless and as fast
+ * as we can.
+ *
+ * Every state, input and step the recording Timeline was given is fed to a
+ * fresh Timeline in the same order, so rollbacks happen just as they did in
+ * the match. At the end we print a checksum of the final world state; two
+ * replays of the same log should always agree.
+ *
+ * With -w, the log is replayed twice: once with physics on one thread, and
+ * once with the given number of threads. The keyframe checksums of the two
+ * runs are compared, tick by tick, to check that multithreaded physics gets
+ * the same answer.
+ *
+ * Usage: replay [-w physicsThreads] replayFile
+ */
+
+#include "WorldModel.h"
+#include "Timeline.h"
+#include "ReplayLog.h"
+#include "BenchCommon.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+
+// Keyframe checksums from a replay, by tick
+typedef std::map<unsigned, uint32_t> ChecksumMap;
+
+/*
+ * FNV-1a hash of a serialized world state.
+ */
+static uint32_t
+HashState(const WorldState& state)
+{
+    std::vector<char> buffer;
+    state.Serialize(buffer);
+    uint32_t hash = 2166136261u;
+    for (unsigned i = 0; i < buffer.size(); ++i) {
+        hash ^= (uint8_t) buffer[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Replays a log over a fresh headless world and reports how it went,
+ * collecting the checksums of keyframes as they settle just like a client
+ * would. Returns false if the log can't be read or has no world state in it.
+ */
+static bool
+ReplayFile(const char* filename, ChecksumMap& checksumsOut)
+{
+    ReplayLog log;
+    if (!log.OpenForReading(filename))
+        return false;
+
+    WorldModel world;
+    world.InitHeadless();
+    Timeline timeline;
+    bool started = false;
+    unsigned nextChecksum = 0;
+
+    // Counters
+    unsigned numRecords = 0, numStates = 0, numInputs = 0;
+    unsigned long numTicks = 0;
+
+    // Go
+    sf::Clock timer;
+    ReplayRecord record;
+    while (log.ReadRecord(record)) {
+        ++numRecords;
+        switch (record.type) {
+
+            // The world was started, or resynchronized, from this state
+            case REPLAYLOG_RECORD_STATE:
+                ++numStates;
+                if (!started) {
+                    world.SetState(record.state);
+                    timeline.Init(world, COMMUNICATOR_MODE_CLIENT);
+                    started = true;
+                }
+                else
+                    timeline.Resync(record.state);
+                nextChecksum = (record.state.timestamp / KEYFRAME_STEP + 1) *
+                               KEYFRAME_STEP;
+                break;
+
+            case REPLAYLOG_RECORD_INPUT:
+                if (!started)
+                    break;
+                ++numInputs;
+                timeline.AddInput(record.input);
+                break;
+
+            case REPLAYLOG_RECORD_ADVANCE: {
+                if (!started)
+                    break;
+                numTicks += record.numTicks;
+                timeline.Advance(record.numTicks);
+
+                unsigned now = world.GetCurrentTimestamp();
+                while (now >= CHECKSUM_CONFIRM_TICKS &&
+                       nextChecksum <= now - CHECKSUM_CONFIRM_TICKS) {
+                    uint32_t checksum;
+                    if (timeline.GetChecksum(nextChecksum, checksum))
+                        checksumsOut[nextChecksum] = checksum;
+                    nextChecksum += KEYFRAME_STEP;
+                }
+                break;
+            }
+
+            default:
+                assert(0); // Not reached
+                break;
+        }
+    }
+    double seconds = timer.GetElapsedTime();
+
+    if (!started) {
+        printf("%s has no world state in it.\n", filename);
+        return false;
+    }
+
+    // Report
+    WorldState finalState;
+    world.GetState(finalState);
+    printf("Replayed %u records (%u states, %u inputs, %lu ticks) in %.3f s\n",
+           numRecords, numStates, numInputs, numTicks, seconds);
+    printf("    ticks/sec:   %.1f\n", numTicks / seconds);
+    printf("    final tick:  %u\n", finalState.timestamp);
+    printf("    final state: %08x\n", HashState(finalState));
+    timeline.GetMetrics().Dump();
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int numThreads = GetBenchOption(argc, argv, "-w", 1);
+    if (argc < 2 || numThreads < 1) {
+        printf("Usage: %s [-w physicsThreads] replayFile\n", argv[0]);
+        return -1;
+    }
+    const char* filename = argv[argc - 1];
+
+    // The reference run
+    ChecksumMap checksums;
+    if (!ReplayFile(filename, checksums))
+        return -1;
+    if (numThreads == 1)
+        return 0;
+
+    // And again, with threads
+    WorldModel::SetPhysicsThreads((unsigned) numThreads);
+    printf("\nWith %d physics threads:\n", numThreads);
+    ChecksumMap threadedChecksums;
+    if (!ReplayFile(filename, threadedChecksums))
+        return -1;
+
+    // Keyframes are compared in order, so the first mismatch is where the
+    // two runs diverged
+    unsigned numCompared = 0;
+    for (ChecksumMap::iterator it = checksums.begin();
+         it != checksums.end(); ++it) {
+        ChecksumMap::iterator other = threadedChecksums.find(it->first);
+        if (other == threadedChecksums.end())
+            continue;
+        if (other->second != it->second) {
+            printf("\nPhysics threads diverged at tick %u (checksum %08x with "
+                   "1 thread, %08x with %d).\n", it->first, it->second,
+                   other->second, numThreads);
+            return -1;
+        }
+        ++numCompared;
+    }
+    printf("\n%u keyframe checksums agree between 1 and %d physics threads.\n",
+           numCompared, numThreads);
+
+    return 0;
+}
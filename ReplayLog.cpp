@@ -0,0 +1,132 @@
+#include "ReplayLog.h"
+#include <stdint.h>
+
+ReplayLog::ReplayLog() : mFile(NULL)
+{
+}
+
+ReplayLog::~ReplayLog()
+{
+    if (mFile)
+        fclose(mFile);
+}
+
+bool
+ReplayLog::OpenForWriting(const char* filename)
+{
+    assert(mFile == NULL);
+    mFile = fopen(filename, "wb");
+    if (mFile == NULL) {
+        printf("Warning - Couldn't open %s for recording.\n", filename);
+        return false;
+    }
+
+    uint32_t header[2] = { REPLAYLOG_MAGIC, REPLAYLOG_VERSION };
+    fwrite(header, sizeof(header), 1, mFile);
+    return true;
+}
+
+bool
+ReplayLog::OpenForReading(const char* filename)
+{
+    assert(mFile == NULL);
+    mFile = fopen(filename, "rb");
+    if (mFile == NULL) {
+        printf("Couldn't open %s.\n", filename);
+        return false;
+    }
+
+    uint32_t header[2];
+    if (fread(header, sizeof(header), 1, mFile) != 1 ||
+        header[0] != REPLAYLOG_MAGIC) {
+        printf("%s isn't a replay log.\n", filename);
+        return false;
+    }
+    if (header[1] != REPLAYLOG_VERSION) {
+        printf("%s is version %u, but we only understand version %u.\n",
+               filename, header[1], REPLAYLOG_VERSION);
+        return false;
+    }
+
+    return true;
+}
+
+void
+ReplayLog::WriteType(ReplayRecordType type)
+{
+    uint8_t byte = type;
+    fwrite(&byte, sizeof(byte), 1, mFile);
+}
+
+void
+ReplayLog::RecordState(const WorldState& state)
+{
+    if (mFile == NULL)
+        return;
+
+    state.Serialize(mBuffer);
+    uint32_t size = mBuffer.size();
+    WriteType(REPLAYLOG_RECORD_STATE);
+    fwrite(&size, sizeof(size), 1, mFile);
+    fwrite(&mBuffer[0], size, 1, mFile);
+}
+
+void
+ReplayLog::RecordInput(const UserInput& input)
+{
+    if (mFile == NULL)
+        return;
+
+    WriteType(REPLAYLOG_RECORD_INPUT);
+    fwrite(&input, sizeof(input), 1, mFile);
+}
+
+void
+ReplayLog::RecordAdvance(int numTicks)
+{
+    if (mFile == NULL)
+        return;
+
+    int32_t ticks = numTicks;
+    WriteType(REPLAYLOG_RECORD_ADVANCE);
+    fwrite(&ticks, sizeof(ticks), 1, mFile);
+}
+
+bool
+ReplayLog::ReadRecord(ReplayRecord& record)
+{
+    assert(mFile);
+
+    uint8_t type;
+    if (fread(&type, sizeof(type), 1, mFile) != 1)
+        return false;
+    record.type = (ReplayRecordType) type;
+
+    switch (record.type) {
+
+        case REPLAYLOG_RECORD_STATE: {
+            uint32_t size;
+            if (fread(&size, sizeof(size), 1, mFile) != 1 || size == 0)
+                return false;
+            mBuffer.resize(size);
+            if (fread(&mBuffer[0], size, 1, mFile) != 1)
+                return false;
+            return record.state.Deserialize(&mBuffer[0], size);
+        }
+
+        case REPLAYLOG_RECORD_INPUT:
+            return fread(&record.input, sizeof(record.input), 1, mFile) == 1;
+
+        case REPLAYLOG_RECORD_ADVANCE: {
+            int32_t ticks;
+            if (fread(&ticks, sizeof(ticks), 1, mFile) != 1)
+                return false;
+            record.numTicks = ticks;
+            return true;
+        }
+
+        default:
+            printf("Warning - Unknown replay record type %u.\n", type);
+            return false;
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef REPLAYLOG_H
+#define REPLAYLOG_H
+
+#include "WorldModel.h"
+#include "UserInput.h"
+#include <stdio.h>
+#include <vector>
+
+// Identifies replay files, and which version of the format they use
+#define REPLAYLOG_MAGIC 0x47524C47
+#define REPLAYLOG_VERSION 1
+
+/*
+ * The kinds of record in a replay log.
+ */
+typedef enum {
+    REPLAYLOG_RECORD_NONE = 0,
+    REPLAYLOG_RECORD_STATE,
+    REPLAYLOG_RECORD_INPUT,
+    REPLAYLOG_RECORD_ADVANCE
+} ReplayRecordType;
+
+/*
+ * A record read back from a replay log. Only the fields for the record's
+ * type are valid.
+ */
+struct ReplayRecord {
+
+    ReplayRecord() : type(REPLAYLOG_RECORD_NONE), input(0, 0)
+                   , numTicks(0) {};
+
+    ReplayRecordType type;
+
+    // REPLAYLOG_RECORD_STATE
+    WorldState state;
+
+    // REPLAYLOG_RECORD_INPUT
+    UserInput input;
+
+    // REPLAYLOG_RECORD_ADVANCE
+    int numTicks;
+};
+
+/*
+ * An append-only binary log of everything that goes into a Timeline: the
+ * world states it starts and resynchronizes from, every input it's given, and
+ * every step it takes, in order. Feeding the same things to a fresh Timeline
+ * over a headless world reproduces the match.
+ *
+ * The file starts with a magic word and version. Each record is a one byte
+ * type followed by:
+ *   STATE:   a uint32 size, then the output of WorldState::Serialize()
+ *   INPUT:   a UserInput
+ *   ADVANCE: an int32 tick count
+ *
+ * Everything is in host byte order.
+ */
+class ReplayLog {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    ReplayLog();
+
+    /*
+     * Destructor. Closes the file.
+     */
+    ~ReplayLog();
+
+    /*
+     * Opens a log for recording, replacing anything already there. Returns
+     * false on failure.
+     */
+    bool OpenForWriting(const char* filename);
+
+    /*
+     * Opens a log for replaying. Returns false on failure, or if the file
+     * isn't a replay log we understand.
+     */
+    bool OpenForReading(const char* filename);
+
+    /*
+     * Recording methods.
+     */
+    void RecordState(const WorldState& state);
+    void RecordInput(const UserInput& input);
+    void RecordAdvance(int numTicks);
+
+    /*
+     * Reads the next record. Returns false at the end of the file, or if
+     * the file is truncated or corrupt.
+     */
+    bool ReadRecord(ReplayRecord& record);
+
+    protected:
+
+    /*
+     * Writes a record type byte.
+     */
+    void WriteType(ReplayRecordType type);
+
+    // The log file
+    FILE* mFile;
+
+    // Scratch space for serializing states
+    std::vector<char> mBuffer;
+};
+
+#endif /* REPLAYLOG_H */
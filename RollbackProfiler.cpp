@@ -0,0 +1,140 @@
+#include "RollbackProfiler.h"
+#include <assert.h>
+#include <string.h>
+
+/*
+ * RollbackFrameStats methods.
+ */
+
+RollbackFrameStats::RollbackFrameStats() : timestamp(0)
+                                         , numRollbacks(0)
+                                         , maxDepth(0)
+                                         , liveTicks(0)
+                                         , resimTicks(0)
+                                         , liveStepSeconds(0.0f)
+                                         , resimStepSeconds(0.0f)
+                                         , snapshotSeconds(0.0f)
+                                         , applyInputSeconds(0.0f)
+                                         , numKeyframes(0)
+{
+}
+
+/*
+ * RollbackProfiler methods.
+ */
+
+RollbackProfiler::RollbackProfiler() : mHistory(ROLLBACK_PROFILER_HISTORY)
+                                     , mNext(0)
+                                     , mNumFrames(0)
+                                     , mDumpFile(NULL)
+                                     , mDumpJSON(false)
+                                     , mDumpInterval(0)
+                                     , mUndumped(0)
+{
+}
+
+RollbackProfiler::~RollbackProfiler()
+{
+    if (mDumpFile == NULL)
+        return;
+
+    Flush();
+    fclose(mDumpFile);
+}
+
+void
+RollbackProfiler::EndFrame(unsigned timestamp, unsigned numKeyframes)
+{
+    // Fill in the last details and file it away
+    mCurrent.timestamp = timestamp;
+    mCurrent.numKeyframes = numKeyframes;
+    mHistory[mNext] = mCurrent;
+    mNext = (mNext + 1) % ROLLBACK_PROFILER_HISTORY;
+    if (mNumFrames < ROLLBACK_PROFILER_HISTORY)
+        ++mNumFrames;
+
+    // Start afresh
+    mCurrent = RollbackFrameStats();
+
+    // Dump, if it's time
+    if (mDumpFile == NULL)
+        return;
+    ++mUndumped;
+    if (mUndumped >= mDumpInterval)
+        Flush();
+}
+
+const RollbackFrameStats&
+RollbackProfiler::GetFrame(unsigned age)
+{
+    assert(age < mNumFrames);
+    unsigned index = (mNext + ROLLBACK_PROFILER_HISTORY - 1 - age) %
+                     ROLLBACK_PROFILER_HISTORY;
+    return mHistory[index];
+}
+
+bool
+RollbackProfiler::SetDumpFile(const char* filename, unsigned intervalFrames)
+{
+    assert(mDumpFile == NULL);
+
+    // We can't dump more frames than we keep
+    assert(intervalFrames > 0 && intervalFrames <= ROLLBACK_PROFILER_HISTORY);
+
+    mDumpFile = fopen(filename, "w");
+    if (mDumpFile == NULL) {
+        printf("Warning - Couldn't open %s for rollback stats.\n", filename);
+        return false;
+    }
+
+    size_t length = strlen(filename);
+    mDumpJSON = length >= 5 && !strcmp(filename + length - 5, ".json");
+    mDumpInterval = intervalFrames;
+    mUndumped = 0;
+
+    // CSV files get a header
+    if (!mDumpJSON)
+        fprintf(mDumpFile, "timestamp,rollbacks,maxDepth,liveTicks,resimTicks,"
+                           "liveStepMS,resimStepMS,snapshotMS,applyInputMS,"
+                           "keyframes\n");
+
+    return true;
+}
+
+void
+RollbackProfiler::Flush()
+{
+    if (mDumpFile == NULL)
+        return;
+
+    // Oldest first
+    for (unsigned age = mUndumped; age > 0; --age)
+        WriteFrame(GetFrame(age - 1));
+    mUndumped = 0;
+    fflush(mDumpFile);
+}
+
+void
+RollbackProfiler::WriteFrame(const RollbackFrameStats& frame)
+{
+    if (mDumpJSON)
+        fprintf(mDumpFile, "{\"timestamp\": %u, \"rollbacks\": %u, "
+                           "\"maxDepth\": %u, \"liveTicks\": %u, "
+                           "\"resimTicks\": %u, \"liveStepMS\": %.3f, "
+                           "\"resimStepMS\": %.3f, \"snapshotMS\": %.3f, "
+                           "\"applyInputMS\": %.3f, \"keyframes\": %u}\n",
+                frame.timestamp, frame.numRollbacks, frame.maxDepth,
+                frame.liveTicks, frame.resimTicks,
+                frame.liveStepSeconds * 1000.0f,
+                frame.resimStepSeconds * 1000.0f,
+                frame.snapshotSeconds * 1000.0f,
+                frame.applyInputSeconds * 1000.0f, frame.numKeyframes);
+    else
+        fprintf(mDumpFile, "%u,%u,%u,%u,%u,%.3f,%.3f,%.3f,%.3f,%u\n",
+                frame.timestamp, frame.numRollbacks, frame.maxDepth,
+                frame.liveTicks, frame.resimTicks,
+                frame.liveStepSeconds * 1000.0f,
+                frame.resimStepSeconds * 1000.0f,
+                frame.snapshotSeconds * 1000.0f,
+                frame.applyInputSeconds * 1000.0f, frame.numKeyframes);
+}
@@ -0,0 +1,124 @@
+#ifndef ROLLBACKPROFILER_H
+#define ROLLBACKPROFILER_H
+
+#include <stdio.h>
+#include <vector>
+
+// Number of frames of stats we keep around
+#define ROLLBACK_PROFILER_HISTORY 1024
+
+// Default number of frames between dumps
+#define ROLLBACK_PROFILER_DUMP_INTERVAL 256
+
+/*
+ * What the timeline did during a single frame (one Timeline::Advance(),
+ * plus any rollbacks caused by input that arrived since the previous one).
+ */
+struct RollbackFrameStats {
+
+    /*
+     * Constructor. Zeroes everything.
+     */
+    RollbackFrameStats();
+
+    // World timestamp at the end of the frame
+    unsigned timestamp;
+
+    // Rollbacks this frame, and the deepest one, in ticks
+    unsigned numRollbacks;
+    unsigned maxDepth;
+
+    // Ticks stepped normally, and ticks resimulated during rollbacks
+    unsigned liveTicks;
+    unsigned resimTicks;
+
+    // Seconds spent stepping physics normally, and while resimulating
+    float liveStepSeconds;
+    float resimStepSeconds;
+
+    // Seconds spent taking and restoring state snapshots
+    float snapshotSeconds;
+
+    // Seconds spent applying inputs while resimulating
+    float applyInputSeconds;
+
+    // Keyframes in the timeline at the end of the frame
+    unsigned numKeyframes;
+};
+
+/*
+ * Collects per-frame rollback stats in a ring buffer, and optionally
+ * dumps them to a file every so often so they can be looked at offline.
+ */
+class RollbackProfiler {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    RollbackProfiler();
+
+    /*
+     * Destructor. Flushes anything not yet dumped.
+     */
+    ~RollbackProfiler();
+
+    /*
+     * Gets the stats for the frame in progress, to be added to.
+     */
+    RollbackFrameStats& Current() { return mCurrent; };
+
+    /*
+     * Finishes off the frame in progress and starts a new one.
+     */
+    void EndFrame(unsigned timestamp, unsigned numKeyframes);
+
+    /*
+     * Gets the number of finished frames we have stats for.
+     */
+    unsigned GetNumFrames() { return mNumFrames; };
+
+    /*
+     * Gets the stats for a finished frame. 0 is the most recent one, and
+     * GetNumFrames() - 1 the oldest.
+     */
+    const RollbackFrameStats& GetFrame(unsigned age);
+
+    /*
+     * Starts dumping stats to the given file every intervalFrames frames.
+     * Files ending in ".json" get one JSON object per line, and anything
+     * else gets CSV.
+     *
+     * Returns false if the file couldn't be opened.
+     */
+    bool SetDumpFile(const char* filename, unsigned intervalFrames);
+
+    /*
+     * Writes out any frames that haven't been dumped yet.
+     */
+    void Flush();
+
+    protected:
+
+    /*
+     * Writes a single frame to our dump file.
+     */
+    void WriteFrame(const RollbackFrameStats& frame);
+
+    // The frame in progress
+    RollbackFrameStats mCurrent;
+
+    // Finished frames, as a ring buffer
+    std::vector<RollbackFrameStats> mHistory;
+    unsigned mNext;
+    unsigned mNumFrames;
+
+    // Dump state
+    FILE* mDumpFile;
+    bool mDumpJSON;
+    unsigned mDumpInterval;
+    unsigned mUndumped;
+};
+
+#endif /* ROLLBACKPROFILER_H */
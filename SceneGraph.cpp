@@ -1,5 +1,8 @@
 #include "SceneGraph.h"
 #include "RenderContext.h"
+#include "VectorArray.h"
+#include <math.h>
+#include <algorithm>
 
 using std::list;
 using std::vector;
@@ -9,6 +12,7 @@ SceneMesh::SceneMesh(SceneGraph* scene, const char* name,
                      unsigned material) : mSceneGraph(scene)
                                         , mMaterial(material)
                                         , mName(name)
+                                        , mBoundsRadius(0.0f)
                                         , mCubeTextureID(0)
                                         , mDoingEnvMap(false)
 {
@@ -28,38 +32,32 @@ float sUpDirections[][3] = { {0.0, -1.0, 0.0}, {0.0, -1.0, 0.0},
                              {0.0, -1.0, 0.0}, {0.0, -1.0, 0.0} };
 
 void
-SceneMesh::Render(RenderContext& renderContext)
+SceneMesh::Draw(RenderContext& renderContext)
 {
     // If we're environment mapping this node and its descendants, we don't
     // want to render them.
     if (mDoingEnvMap)
         return;
 
+    // Time this mesh on the GPU, if we've been asked to
+    GpuTimer* gpuTimer = renderContext.GetGpuTimer();
+    ScopedGpuPhase gpuPhase(gpuTimer->IsPerMeshEnabled() ? gpuTimer : NULL,
+                            mName);
+
     // If we have an environment map, enable environment mapping
     if (mCubeTextureID != 0) {
 
-        // Bind the cube texture
+        // Bind the cube texture. The variant takes care of the rest.
         GL_CHECK(glActiveTexture(ENV_TEXTURE_UNIT));
         GL_CHECK(glBindTexture(GL_TEXTURE_CUBE_MAP, mCubeTextureID));
-
-        // Set the flag
-        SET_UNIFORM(&renderContext, 1i, "mapEnvironment", 1);
     }
 
-
-    // Enable the mesh material
-    assert(mMaterial < renderContext.materials.size());
-    renderContext.materials[mMaterial].SetEnabled(true);
-
-    // Grab the positions of our attributes
-    GLint positionPos, texcoordPos, normalPos, tangentPos, bitangentPos;
-    GLint shaderID = renderContext.GetShaderID();
-
-    GL_CHECK(positionPos = glGetAttribLocation(shaderID, "positionIn"));
-    GL_CHECK(texcoordPos = glGetAttribLocation(shaderID, "texcoordIn"));
-    GL_CHECK(normalPos = glGetAttribLocation(shaderID, "normalIn"));
-    GL_CHECK(tangentPos = glGetAttribLocation(shaderID, "tangentIn"));
-    GL_CHECK(bitangentPos = glGetAttribLocation(shaderID, "bitangentIn"));
+    // Every shader variant has our attributes in the same places
+    GLint positionPos = SHADERATTRIB_POSITION;
+    GLint texcoordPos = SHADERATTRIB_TEXCOORD;
+    GLint normalPos = SHADERATTRIB_NORMAL;
+    GLint tangentPos = SHADERATTRIB_TANGENT;
+    GLint bitangentPos = SHADERATTRIB_BITANGENT;
 
     // Enable the appropriate attribute arrays
     GL_CHECK(glEnableVertexAttribArray(positionPos));
@@ -90,12 +88,6 @@ SceneMesh::Render(RenderContext& renderContext)
     GL_CHECK(glDisableVertexAttribArray(normalPos));
     GL_CHECK(glDisableVertexAttribArray(tangentPos));
     GL_CHECK(glDisableVertexAttribArray(bitangentPos));
-
-    // Disable the material
-    renderContext.materials[mMaterial].SetEnabled(false);
-
-    // Disable any environment mapping
-    SET_UNIFORM(&renderContext, 1i, "mapEnvironment", 0);
 }
 
 void
@@ -143,6 +135,33 @@ SceneMesh::InitWithMesh(const aiMesh* mesh)
         // Add the triangle
         AddTriangle(triangle[0], triangle[1], triangle[2]);
     }
+
+    ComputeBounds();
+}
+
+void
+SceneMesh::ComputeBounds()
+{
+    if (mPositions.empty())
+        return;
+
+    VectorArray positions;
+    positions.SetInterleaved(&mPositions[0], mPositions.size() / 3);
+    positions.GetBounds(mBoundsMin, mBoundsMax);
+
+    // The sphere is centered on the box, and just big enough for the
+    // furthest vertex
+    mBoundsCenter.Set((mBoundsMin.x + mBoundsMax.x) * 0.5f,
+                      (mBoundsMin.y + mBoundsMax.y) * 0.5f,
+                      (mBoundsMin.z + mBoundsMax.z) * 0.5f, 1.0f);
+    float maxDistance2 = 0.0f;
+    for (unsigned i = 0; i < mPositions.size(); i += 3) {
+        float dx = mPositions[i] - mBoundsCenter.x;
+        float dy = mPositions[i + 1] - mBoundsCenter.y;
+        float dz = mPositions[i + 2] - mBoundsCenter.z;
+        maxDistance2 = MAX(maxDistance2, dx * dx + dy * dy + dz * dz);
+    }
+    mBoundsRadius = sqrt(maxDistance2);
 }
 
 void
@@ -207,14 +226,16 @@ SceneMesh::EnvironmentMap(Vector& eyePos)
                                   CUBEMAP_SIDE_SIZE, 0, GL_RGBA, GL_FLOAT, NULL));
     }
 
-    // Set the projection matrix and viewport
-    GL_CHECK(glMatrixMode(GL_PROJECTION));
-    GL_CHECK(glLoadIdentity());
-    GL_CHECK(gluPerspective(90.0, 1.0, CAMERA_NEAR, CAMERA_FAR));
+    // Set the projection matrix and viewport. Going through the render
+    // context means each face only draws what it can see.
+    Matrix projection;
+    projection.Perspective(90.0f, 1.0f, CAMERA_NEAR, CAMERA_FAR);
+    renderContext->SetProjection(projection);
     GL_CHECK(glViewport(0, 0, CUBEMAP_SIDE_SIZE, CUBEMAP_SIDE_SIZE));
 
 
     // Render each face of the cube
+    ScopedGpuPhase gpuPhase(renderContext->GetGpuTimer(), FRAMEPHASE_GPU_ENVMAP);
     for (unsigned i = 0; i < 6; ++i) {
 
         // Our view direction is a unit vector. Use it to compute the 'center'
@@ -311,6 +332,8 @@ SceneNode::SceneNode(SceneGraph* scene, Matrix transform,
                      const char* name) : mSceneGraph(scene)
                                        , mTransform(transform)
                                        , mName(name)
+                                       , mHasBounds(false)
+                                       , mWorldBoundsRadius(0.0f)
 {
 }
 
@@ -335,12 +358,25 @@ void
 SceneNode::AddChild(SceneNode* child)
 {
     mChildren.push_back(child);
+    mSceneGraph->InvalidateTransforms();
+}
+
+void
+SceneNode::RemoveChild(SceneNode* child)
+{
+    list<SceneNode*>::iterator it =
+        std::find(mChildren.begin(), mChildren.end(), child);
+    assert(it != mChildren.end());
+    mChildren.erase(it);
+    delete child;
+    mSceneGraph->InvalidateTransforms();
 }
 
 void
 SceneNode::AddMesh(unsigned mesh)
 {
     mMeshes.push_back(mesh);
+    mSceneGraph->InvalidateTransforms();
 }
 
 SceneNode*
@@ -366,43 +402,205 @@ SceneNode::FindNode(const string& name)
 void
 SceneNode::ApplyTransform(Matrix transform) {
     mTransform = mTransform.MMProduct(transform);
+    mSceneGraph->InvalidateTransforms();
 }
 
 void 
 SceneNode::LoadIdentityTransform()
 {
     mTransform.LoadIdentity();
+    mSceneGraph->InvalidateTransforms();
 }
 
-void
-SceneNode::Render(RenderContext& renderContext, Matrix base)
+/*
+ * Helpers for bounding volumes.
+ */
+
+/*
+ * The most a matrix scales anything by, ignoring the translation.
+ */
+static float
+MaxScale(const Matrix& mat)
+{
+    float maxLength2 = 0.0f;
+    for (unsigned col = 0; col < 3; ++col) {
+        float length2 = mat[0][col] * mat[0][col] + mat[1][col] * mat[1][col] +
+                        mat[2][col] * mat[2][col];
+        maxLength2 = MAX(maxLength2, length2);
+    }
+    return sqrt(maxLength2);
+}
+
+/*
+ * Transforms a bounding sphere.
+ */
+static void
+TransformSphere(Matrix& mat, const Vector& center, float radius,
+                Vector& centerOut, float& radiusOut)
+{
+    Vector modelCenter = center;
+    centerOut = mat.MVProduct(modelCenter);
+    radiusOut = radius * MaxScale(mat);
+}
+
+/*
+ * Transforms an axis-aligned box, giving the axis-aligned box around the
+ * result. See Arvo, "Transforming Axis-Aligned Bounding Boxes", Graphics
+ * Gems.
+ */
+static void
+TransformBox(const Matrix& mat, const Vector& boundsMin,
+             const Vector& boundsMax, Vector& minOut, Vector& maxOut)
+{
+    for (unsigned i = 0; i < 3; ++i) {
+        minOut[i] = maxOut[i] = mat[i][3];
+        for (unsigned j = 0; j < 3; ++j) {
+            float e = mat[i][j] * boundsMin[j];
+            float f = mat[i][j] * boundsMax[j];
+            minOut[i] += MIN(e, f);
+            maxOut[i] += MAX(e, f);
+        }
+    }
+    minOut.w = maxOut.w = 1.0f;
+}
+
+/*
+ * Grows a sphere to take in another.
+ */
+static void
+MergeSphere(Vector& center, float& radius, const Vector& otherCenter,
+            float otherRadius)
+{
+    float dx = otherCenter.x - center.x;
+    float dy = otherCenter.y - center.y;
+    float dz = otherCenter.z - center.z;
+    float distance = sqrt(dx * dx + dy * dy + dz * dz);
+
+    // One inside the other?
+    if (distance + otherRadius <= radius)
+        return;
+    if (distance + radius <= otherRadius) {
+        center = otherCenter;
+        radius = otherRadius;
+        return;
+    }
+
+    // The smallest sphere around both
+    float newRadius = (distance + radius + otherRadius) * 0.5f;
+    float t = (newRadius - radius) / distance;
+    center.Set(center.x + dx * t, center.y + dy * t, center.z + dz * t, 1.0f);
+    radius = newRadius;
+}
+
+/*
+ * Grows a box and sphere to take in another box and sphere. If we don't have
+ * any yet, we take the new ones.
+ */
+static void
+MergeBounds(bool& hasBounds, Vector& boundsMin, Vector& boundsMax,
+            Vector& center, float& radius, const Vector& otherMin,
+            const Vector& otherMax, const Vector& otherCenter,
+            float otherRadius)
 {
-    // Generate our transformation matrix
-    Matrix trans = base.MMProduct(mTransform);
-    GLfloat modelMat[16];
-    trans.Get(modelMat);
+    if (!hasBounds) {
+        boundsMin = otherMin;
+        boundsMax = otherMax;
+        center = otherCenter;
+        radius = otherRadius;
+        hasBounds = true;
+        return;
+    }
 
-    // Apply it to the modelview matrix
-    GL_CHECK(glMatrixMode(GL_MODELVIEW));
-    GL_CHECK(glPushMatrix());
-    GL_CHECK(glMultMatrixf(modelMat));
+    for (unsigned i = 0; i < 3; ++i) {
+        boundsMin[i] = MIN(boundsMin[i], otherMin[i]);
+        boundsMax[i] = MAX(boundsMax[i], otherMax[i]);
+    }
+    MergeSphere(center, radius, otherCenter, otherRadius);
+}
 
-    // Write it separately to the shader as well (for shadow mapping)
-    SET_UNIFORMMATV(&renderContext, 4fv, "modelMatrix", modelMat);
+void
+SceneNode::UpdateWorldBounds()
+{
+    mHasBounds = false;
 
-    // Draw the meshes at this node
+    // Our own meshes
     for (list<unsigned>::iterator it = mMeshes.begin();
-         it != mMeshes.end(); ++it)
-        mSceneGraph->meshes[*it].Render(renderContext);
+         it != mMeshes.end(); ++it) {
+        SceneMesh& mesh = mSceneGraph->meshes[*it];
+        if (!mesh.HasBounds())
+            continue;
+        Vector boundsMin, boundsMax, center;
+        float radius;
+        TransformBox(mWorldTransform, mesh.GetBoundsMin(), mesh.GetBoundsMax(),
+                     boundsMin, boundsMax);
+        TransformSphere(mWorldTransform, mesh.GetBoundsCenter(),
+                        mesh.GetBoundsRadius(), center, radius);
+        MergeBounds(mHasBounds, mWorldBoundsMin, mWorldBoundsMax,
+                    mWorldBoundsCenter, mWorldBoundsRadius,
+                    boundsMin, boundsMax, center, radius);
+    }
+
+    // And our children's
+    for (list<SceneNode*>::iterator it = mChildren.begin();
+         it != mChildren.end(); ++it) {
+        SceneNode* child = *it;
+        child->UpdateWorldBounds();
+        if (!child->mHasBounds)
+            continue;
+        MergeBounds(mHasBounds, mWorldBoundsMin, mWorldBoundsMax,
+                    mWorldBoundsCenter, mWorldBoundsRadius,
+                    child->mWorldBoundsMin, child->mWorldBoundsMax,
+                    child->mWorldBoundsCenter, child->mWorldBoundsRadius);
+    }
+}
 
-    // Get rid of the model matrix, leaving GL with just the view matrix
-    GL_CHECK(glMatrixMode(GL_MODELVIEW));
-    GL_CHECK(glPopMatrix());
+void
+SceneNode::CollectDraws(RenderContext& renderContext,
+                        vector<SceneDraw>& draws)
+{
+    // Skip the whole subtree if there's nothing in it, or none of it is in
+    // view. The sphere is the cheaper test, and the box the tighter one.
+    const Frustum& frustum = renderContext.GetFrustum();
+    if (!mHasBounds ||
+        !frustum.TestSphere(mWorldBoundsCenter, mWorldBoundsRadius) ||
+        !frustum.TestBox(mWorldBoundsMin, mWorldBoundsMax))
+        return;
+
+    // Add the meshes at this node that are in view
+    for (list<unsigned>::iterator it = mMeshes.begin();
+         it != mMeshes.end(); ++it) {
+        SceneMesh& mesh = mSceneGraph->meshes[*it];
+        if (!mesh.HasBounds())
+            continue;
+        Vector center;
+        float radius;
+        TransformSphere(mWorldTransform, mesh.GetBoundsCenter(),
+                        mesh.GetBoundsRadius(), center, radius);
+        if (!frustum.TestSphere(center, radius))
+            continue;
+
+        SceneDraw draw;
+        draw.material = mesh.GetMaterial();
+        assert(draw.material < renderContext.materials.size());
+        Material& material = renderContext.materials[draw.material];
+        unsigned features = 0;
+        if (material.HasNormalMap())
+            features |= SHADERVARIANT_MAP_NORMALS;
+        if (mesh.HasEnvironmentMap())
+            features |= SHADERVARIANT_MAP_ENVIRONMENT;
+        draw.variant = renderContext.ChooseShaderVariant(features);
+        for (unsigned i = 0; i < TEXTURETYPE_COUNT; ++i)
+            draw.textures[i] = material.GetTextureID((TextureType) i);
+        draw.mesh = *it;
+        draw.order = draws.size();
+        draw.node = this;
+        draws.push_back(draw);
+    }
 
-    // Draw child nodes
+    // And our children's
     for (list<SceneNode*>::iterator it = mChildren.begin();
          it != mChildren.end(); ++it)
-        (*it)->Render(renderContext, trans);
+        (*it)->CollectDraws(renderContext, draws);
 }
 
 /*
@@ -429,6 +627,7 @@ SceneNode::StoreGeometry(CollisionDetector& detector, Matrix modelMat)
 SceneGraph::SceneGraph(RenderContext& rc) : rootNode(this, Matrix(),
                                                      "248_SCENEGRAPH_ROOT")
                                                      , renderContext(&rc)
+                                                     , mTransformsDirty(true)
 {
 }
 
@@ -436,10 +635,107 @@ SceneGraph::~SceneGraph()
 {
 }
 
+bool
+SceneDraw::operator<(const SceneDraw& other) const
+{
+    if (variant != other.variant)
+        return variant < other.variant;
+    for (unsigned i = 0; i < TEXTURETYPE_COUNT; ++i)
+        if (textures[i] != other.textures[i])
+            return textures[i] < other.textures[i];
+    if (material != other.material)
+        return material < other.material;
+    if (mesh != other.mesh)
+        return mesh < other.mesh;
+    return order < other.order;
+}
+
 void
 SceneGraph::Render()
 {
-    rootNode.Render(*renderContext, Matrix());
+    if (mTransformsDirty)
+        UpdateWorldTransforms();
+
+    // Gather up everything in view, and put it in state order
+    mDraws.clear();
+    rootNode.CollectDraws(*renderContext, mDraws);
+    std::sort(mDraws.begin(), mDraws.end());
+
+    // Draw it, only changing the shader, transform and material when we
+    // have to. The shadow pass only wants depth, so it skips materials.
+    bool shadowPass = renderContext->IsShadowPass();
+    SceneNode* currentNode = NULL;
+    Material* currentMaterial = NULL;
+    for (unsigned i = 0; i < mDraws.size(); ++i) {
+        const SceneDraw& draw = mDraws[i];
+
+        // A new program has none of our per-draw uniforms yet. We always
+        // ask on the first draw, so the per-frame ones get caught up.
+        bool newProgram = false;
+        if (i == 0 || draw.variant != mDraws[i - 1].variant) {
+            newProgram = renderContext->UseShaderVariant(draw.variant);
+            if (newProgram)
+                currentNode = NULL;
+        }
+
+        if (draw.node != currentNode) {
+            currentNode = draw.node;
+            renderContext->SetModelMatrix(currentNode->GetWorldTransform());
+        }
+
+        if (!shadowPass) {
+            Material* material = &renderContext->materials[draw.material];
+            material->SetEnabledFrom(currentMaterial, newProgram);
+            currentMaterial = material;
+        }
+
+        meshes[draw.mesh].Draw(*renderContext);
+    }
+
+    // Leave things as we found them
+    if (currentMaterial != NULL)
+        currentMaterial->SetEnabled(false);
+}
+
+void
+SceneGraph::UpdateWorldTransforms()
+{
+    rootNode.SetWorldTransform(rootNode.GetTransform());
+
+    // Each pass gathers the children of the current level, along with their
+    // parents' world transforms, which are already done
+    mLevel.clear();
+    mLevel.push_back(&rootNode);
+    while (!mLevel.empty()) {
+        mNextLevel.clear();
+        mParentTransforms.clear();
+        mLocalTransforms.clear();
+        for (unsigned i = 0; i < mLevel.size(); ++i) {
+            const list<SceneNode*>& children = mLevel[i]->GetChildren();
+            for (list<SceneNode*>::const_iterator it = children.begin();
+                 it != children.end(); ++it) {
+                mNextLevel.push_back(*it);
+                mParentTransforms.push_back(mLevel[i]->GetWorldTransform());
+                mLocalTransforms.push_back((*it)->GetTransform());
+            }
+        }
+
+        // Compose them all at once, and hand them back
+        unsigned count = mNextLevel.size();
+        mWorldTransforms.resize(count);
+        if (count > 0)
+            Matrix::MMProductBatch(&mParentTransforms[0], &mLocalTransforms[0],
+                                   &mWorldTransforms[0], count);
+        for (unsigned i = 0; i < count; ++i)
+            mNextLevel[i]->SetWorldTransform(mWorldTransforms[i]);
+
+        mLevel.swap(mNextLevel);
+    }
+
+    // Bounds depend on the transforms, so they're out of date too
+    rootNode.UpdateWorldBounds();
+
+    mTransformsDirty = false;
 }
 
 SceneMesh*
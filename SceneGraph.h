@@ -11,6 +11,7 @@
 #define CUBEMAP_SIDE_SIZE 500
 
 class RenderContext;
+class SceneNode;
 struct SceneGraph;
 
 struct SceneVertex {
@@ -37,9 +38,20 @@ class SceneMesh {
     const std::string& GetName() { return mName; }
 
     /*
-     * Renders a Mesh.
+     * Draws the mesh. The caller has already picked the shader variant,
+     * enabled our material and set up the model transform.
      */
-    void Render(RenderContext& renderContext);
+    void Draw(RenderContext& renderContext);
+
+    /*
+     * Gets the index of our material in the render context.
+     */
+    unsigned GetMaterial() { return mMaterial; };
+
+    /*
+     * Whether we're drawn with an environment map.
+     */
+    bool HasEnvironmentMap() { return mCubeTextureID != 0; };
 
     /*
      * Add a triangle to the mesh.
@@ -56,6 +68,25 @@ class SceneMesh {
      */
     void EnvironmentMap(Vector& eyePos);
 
+    /*
+     * Gets the corners of the mesh's bounding box, in model space. Set up
+     * by InitWithMesh().
+     */
+    const Vector& GetBoundsMin() { return mBoundsMin; };
+    const Vector& GetBoundsMax() { return mBoundsMax; };
+
+    /*
+     * Gets the mesh's bounding sphere, in model space. Set up by
+     * InitWithMesh().
+     */
+    const Vector& GetBoundsCenter() { return mBoundsCenter; };
+    float GetBoundsRadius() { return mBoundsRadius; };
+
+    /*
+     * Whether we have any geometry to bound.
+     */
+    bool HasBounds() { return !mPositions.empty(); };
+
     /*
      * Store the geometry in worldspace.
      */
@@ -69,6 +100,11 @@ class SceneMesh {
      */
     void AddVertex(SceneVertex& v);
 
+    /*
+     * Computes our bounding box and sphere from our positions.
+     */
+    void ComputeBounds();
+
     // Pointer to our scene graph
     SceneGraph* mSceneGraph;
 
@@ -89,11 +125,40 @@ class SceneMesh {
     // The name of this mesh
     std::string mName;
 
+    // Model space bounding box and sphere
+    Vector mBoundsMin;
+    Vector mBoundsMax;
+    Vector mBoundsCenter;
+    float mBoundsRadius;
+
     // For environment mapping
     GLuint mCubeTextureID;
     bool mDoingEnvMap;
 };
 
+/*
+ * One mesh to draw at one node. SceneGraph::Render() collects these for
+ * everything in view, and sorts them so that draws sharing textures and
+ * materials end up next to each other.
+ */
+struct SceneDraw {
+
+    // Sort keys, most expensive to change first: the shader variant, the
+    // textures (in TextureType order), then the material, then the mesh.
+    // order breaks ties by scene order, to keep things stable from frame to
+    // frame.
+    unsigned variant;
+    GLuint textures[TEXTURETYPE_COUNT];
+    unsigned material;
+    unsigned mesh;
+    unsigned order;
+
+    // Where it's drawn
+    SceneNode* node;
+
+    bool operator<(const SceneDraw& other) const;
+};
+
 class SceneNode {
 
     public:
@@ -111,16 +176,24 @@ class SceneNode {
     void AddChild(SceneNode* child);
     void AddMesh(unsigned mesh);
 
+    /*
+     * Detaches and destroys a child node, along with its descendants.
+     * Their meshes stay loaded in the scenegraph.
+     */
+    void RemoveChild(SceneNode* child);
+
     /*
      * Recursive DFS to find a node with a given name.
      */
     SceneNode* FindNode(const std::string& name);
 
     /*
-     * Renders the node, starting from the coordinates
-     * induced by the base matrix.
+     * Adds draws for the meshes at this node and its children, using the
+     * bounds from the last SceneGraph::UpdateWorldTransforms(). Anything
+     * outside the render context's frustum is skipped.
      */
-    void Render(RenderContext& renderContext, Matrix base);
+    void CollectDraws(RenderContext& renderContext,
+                      std::vector<SceneDraw>& draws);
     
     /*
      * Applies a tranformation to the node, can be used
@@ -133,6 +206,26 @@ class SceneNode {
      */
     void LoadIdentityTransform();
 
+    /*
+     * Transform accessors. The world transform is this node's transform
+     * composed with all of its ancestors', and is kept up to date by the
+     * scenegraph.
+     */
+    const Matrix& GetTransform() { return mTransform; };
+    const Matrix& GetWorldTransform() { return mWorldTransform; };
+    void SetWorldTransform(const Matrix& world) { mWorldTransform = world; };
+
+    /*
+     * Gets our children.
+     */
+    const std::list<SceneNode*>& GetChildren() { return mChildren; };
+
+    /*
+     * Recomputes the world space bounds of this node's meshes and all of
+     * its descendants', from their world transforms.
+     */
+    void UpdateWorldBounds();
+
     /*
      * Stores the geometry of this node in worldspace.
      */
@@ -146,6 +239,9 @@ class SceneNode {
     // The transformation applied at this node
     Matrix mTransform;
 
+    // mTransform composed with all our ancestors' transforms
+    Matrix mWorldTransform;
+
     // The name of this node
     std::string mName;
 
@@ -154,6 +250,15 @@ class SceneNode {
 
     // meshes at this node
     std::list<unsigned> mMeshes;
+
+    // World space box and sphere around our meshes and our descendants'.
+    // Only meaningful if mHasBounds is set; otherwise there's nothing here
+    // to draw.
+    bool mHasBounds;
+    Vector mWorldBoundsMin;
+    Vector mWorldBoundsMax;
+    Vector mWorldBoundsCenter;
+    float mWorldBoundsRadius;
 };
 
 struct SceneGraph {
@@ -195,10 +300,24 @@ struct SceneGraph {
                    SceneNode* parent);
 
     /*
-     * Renders the scene graph.
+     * Renders the scene graph. Everything in view is drawn in an order that
+     * keeps texture binds and material changes to a minimum.
      */
     void Render();
 
+    /*
+     * Notes that a node's transform, or the shape of the graph, changed.
+     * The world transforms are recomputed before the next render.
+     */
+    void InvalidateTransforms() { mTransformsDirty = true; };
+
+    /*
+     * Recomputes every node's world transform, and then their bounds. We go
+     * one level of the tree at a time, composing all of a level's
+     * transforms in one batch.
+     */
+    void UpdateWorldTransforms();
+
     /*
      * Finds a mesh with the given name. NULL if not found.
      */
@@ -211,6 +330,19 @@ struct SceneGraph {
      */
     void LoadNode(SceneNode* parent, aiNode* node, const char* sceneName,
                   unsigned meshOffset);
+
+    // Whether any world transforms are out of date
+    bool mTransformsDirty;
+
+    // Scratch space for UpdateWorldTransforms(), kept to avoid allocating
+    std::vector<SceneNode*> mLevel;
+    std::vector<SceneNode*> mNextLevel;
+    std::vector<Matrix> mParentTransforms;
+    std::vector<Matrix> mLocalTransforms;
+    std::vector<Matrix> mWorldTransforms;
+
+    // The draws for the current pass, kept to avoid allocating
+    std::vector<SceneDraw> mDraws;
 };
 
 
@@ -10,68 +10,165 @@
 #include "Shader.h"
 #include "Framework.h"
 #include <fstream>
+#include <string.h>
 
 #define ERROR_BUFSIZE 1024
 
+// Identifies program cache files, and which version of the format they use
+#define SHADER_CACHE_MAGIC 0x47534843
+#define SHADER_CACHE_VERSION 1
+
+/*
+ * What a program cache file starts with. The driver's binary follows.
+ */
+struct ShaderCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sourceHash;
+    uint32_t driverHash;
+    uint32_t variant;
+    uint32_t binaryFormat;
+    uint32_t binaryLength;
+};
+
+/*
+ * FNV-1a, continuing from a previous hash.
+ */
+static uint32_t hashBytes(uint32_t hash, const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (uint8_t) data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hashString(uint32_t hash, const char* str) {
+    // Include the terminator, so that "ab" + "c" and "a" + "bc" differ
+    return str ? hashBytes(hash, str, strlen(str) + 1) : hash;
+}
+
 Shader::Shader(const std::string& path) :
     path_(path),
-    vertexShaderID_(0),
-    fragmentShaderID_(0),
-    programID_(0),
-    loaded_(false)
+    loaded_(true),
+    cacheEnabled_(false),
+    sourceHash_(0),
+    driverHash_(0)
 {
 }
 
 void
-Shader::Init()
+Shader::Init(const char* const* defines, unsigned numDefines,
+             const char* const* attributes, unsigned numAttributes)
+{
+    // Keep the sources around, since we build variants on demand
+    fragmentSource_ = readSource(path_ + ".frag");
+    vertexSource_ = readSource(path_ + ".vert");
+
+    defines_.assign(defines, defines + numDefines);
+    attributes_.assign(attributes, attributes + numAttributes);
+
+    // Only some drivers can hand us their binaries. Our OS X contexts
+    // (legacy OpenGL 2.1, no GLEW) never can.
+#ifdef FRAMEWORK_USE_GLEW
+    cacheEnabled_ = GLEW_ARB_get_program_binary;
+#endif
+    if (cacheEnabled_) {
+
+        // Everything that goes into building a program...
+        sourceHash_ = 2166136261u;
+        sourceHash_ = hashString(sourceHash_, &vertexSource_.front());
+        sourceHash_ = hashString(sourceHash_, &fragmentSource_.front());
+        for (unsigned i = 0; i < defines_.size(); ++i)
+            sourceHash_ = hashString(sourceHash_, defines_[i].c_str());
+        for (unsigned i = 0; i < attributes_.size(); ++i)
+            sourceHash_ = hashString(sourceHash_, attributes_[i].c_str());
+
+        // ...and whoever built it. Binaries don't survive driver updates.
+        driverHash_ = 2166136261u;
+        driverHash_ = hashString(driverHash_,
+                                 (const char*) glGetString(GL_VENDOR));
+        driverHash_ = hashString(driverHash_,
+                                 (const char*) glGetString(GL_RENDERER));
+        driverHash_ = hashString(driverHash_,
+                                 (const char*) glGetString(GL_VERSION));
+    }
+
+    // Build the plain variant now, so that errors show up at startup
+    programID(0);
+}
+
+GLuint
+Shader::compile(GLenum type, const std::string& header,
+                const std::vector<char>& source)
+{
+    const GLchar* sources[2] = { header.c_str(), &source.front() };
+    GLint lengths[2] = { (GLint) header.size(), (GLint) source.size() - 1 };
+    GLuint shaderID;
+    GL_CHECK(shaderID = glCreateShader(type));
+    GL_CHECK(glShaderSource(shaderID, 2, sources, lengths));
+    GL_CHECK(glCompileShader(shaderID));
+    return shaderID;
+}
+
+GLuint
+Shader::build(unsigned variant)
 {
-    const GLchar* source[1];
-    int length = 0;
-
-    // Load the fragment shader and compile
-    std::vector<char> fragmentSource = readSource(path_ + ".frag");
-    source[0] = &fragmentSource.front();
-    length = fragmentSource.size()-1;
-    GL_CHECK(fragmentShaderID_ = glCreateShader(GL_FRAGMENT_SHADER));
-    GL_CHECK(glShaderSource(fragmentShaderID_, 1, source, &length));
-    GL_CHECK(glCompileShader(fragmentShaderID_));
-
-    // Load the vertex shader and compile
-    std::vector<char> vertexSource = readSource(path_ + ".vert");
-    source[0] = &vertexSource.front();
-    length = vertexSource.size()-1;
-    GL_CHECK(vertexShaderID_ = glCreateShader(GL_VERTEX_SHADER));
-    GL_CHECK(glShaderSource(vertexShaderID_, 1, source, &length));
-    GL_CHECK(glCompileShader(vertexShaderID_));
-
-    // Create the vertex program
-    programID_ = glCreateProgram();
-    GL_CHECK(glAttachShader(programID_, fragmentShaderID_));
-    GL_CHECK(glAttachShader(programID_, vertexShaderID_));
-    GL_CHECK(glLinkProgram(programID_));
+    // The defines for this variant go in front of the source
+    std::string header;
+    for (unsigned i = 0; i < defines_.size(); ++i)
+        if (variant & (1 << i))
+            header += "#define " + defines_[i] + "\n";
+
+    GLuint fragmentShaderID = compile(GL_FRAGMENT_SHADER, header,
+                                      fragmentSource_);
+    GLuint vertexShaderID = compile(GL_VERTEX_SHADER, header, vertexSource_);
+
+    // Create the vertex program, with the attributes where we want them
+    GLuint programID = glCreateProgram();
+    GL_CHECK(glAttachShader(programID, fragmentShaderID));
+    GL_CHECK(glAttachShader(programID, vertexShaderID));
+    for (unsigned i = 0; i < attributes_.size(); ++i)
+        GL_CHECK(glBindAttribLocation(programID, i, attributes_[i].c_str()));
+#ifdef FRAMEWORK_USE_GLEW
+    if (cacheEnabled_)
+        GL_CHECK(glProgramParameteri(programID,
+                                     GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                     GL_TRUE));
+#endif
+    GL_CHECK(glLinkProgram(programID));
 
     // Error checking
-    GL_CHECK(glGetProgramiv(programID_, GL_LINK_STATUS, (GLint*)&loaded_));
-    //glGetShaderiv(vertexShaderID_, GL_COMPILE_STATUS, (GLint*)&loaded_);
-    if (!loaded_) {
+    GLint linked;
+    GL_CHECK(glGetProgramiv(programID, GL_LINK_STATUS, &linked));
+    if (!linked) {
+        loaded_ = false;
         GLchar tempErrorLog[ERROR_BUFSIZE];
         GLsizei length;
-        glGetShaderInfoLog(fragmentShaderID_, ERROR_BUFSIZE, &length, tempErrorLog);
+        errors_ += "Variant " + header;
+        glGetShaderInfoLog(fragmentShaderID, ERROR_BUFSIZE, &length, tempErrorLog);
         errors_ += "Fragment shader errors:\n";
         errors_ += std::string(tempErrorLog, length) + "\n";
-        glGetShaderInfoLog(vertexShaderID_, ERROR_BUFSIZE, &length, tempErrorLog);
+        glGetShaderInfoLog(vertexShaderID, ERROR_BUFSIZE, &length, tempErrorLog);
         errors_ += "Vertex shader errors:\n";
         errors_ += std::string(tempErrorLog, length) + "\n";
-        glGetProgramInfoLog(programID_, ERROR_BUFSIZE, &length, tempErrorLog);
+        glGetProgramInfoLog(programID, ERROR_BUFSIZE, &length, tempErrorLog);
         errors_ += "Linker errors:\n";
         errors_ += std::string(tempErrorLog, length) + "\n";
     }
+    else
+        saveCached(variant, programID);
+
+    // The program keeps what it needs
+    GL_CHECK(glDeleteShader(vertexShaderID));
+    GL_CHECK(glDeleteShader(fragmentShaderID));
+
+    return programID;
 }
 
 Shader::~Shader() {
-    GL_CHECK(glDeleteShader(vertexShaderID_));
-    GL_CHECK(glDeleteShader(fragmentShaderID_));
-    GL_CHECK(glDeleteProgram(programID_));
+    for (std::map<unsigned, GLuint>::iterator it = programIDs_.begin();
+         it != programIDs_.end(); ++it)
+        GL_CHECK(glDeleteProgram(it->second));
 }
 
 std::vector<char> Shader::readSource(const std::string& path) {
@@ -106,8 +203,103 @@ const std::string& Shader::path() const {
     return path_;
 }
 
-GLuint Shader::programID() const {
-    return programID_;
+GLuint Shader::programID(unsigned variant) {
+    std::map<unsigned, GLuint>::iterator it = programIDs_.find(variant);
+    if (it != programIDs_.end())
+        return it->second;
+
+    // Compiling is slow, so try the cache first
+    GLuint programID = loadCached(variant);
+    if (programID == 0)
+        programID = build(variant);
+    programIDs_[variant] = programID;
+    return programID;
+}
+
+std::string
+Shader::cachePath(unsigned variant) const
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%u" SHADER_CACHE_SUFFIX, variant);
+    return path_ + suffix;
+}
+
+GLuint
+Shader::loadCached(unsigned variant)
+{
+    if (!cacheEnabled_)
+        return 0;
+
+    // Is there anything there, and is it ours?
+    std::ifstream in(cachePath(variant).c_str(), std::ios::binary);
+    if (in.fail())
+        return 0;
+    ShaderCacheHeader header;
+    if (!in.read((char*) &header, sizeof(header)) ||
+        header.magic != SHADER_CACHE_MAGIC ||
+        header.version != SHADER_CACHE_VERSION ||
+        header.sourceHash != sourceHash_ ||
+        header.driverHash != driverHash_ ||
+        header.variant != variant ||
+        header.binaryLength == 0)
+        return 0;
+    std::vector<char> binary(header.binaryLength);
+    if (!in.read(&binary.front(), binary.size()))
+        return 0;
+
+#ifdef FRAMEWORK_USE_GLEW
+    // The driver can still turn it down, in which case we clear the error
+    // rather than GL_CHECK it, and compile as usual
+    GLuint programID;
+    GL_CHECK(programID = glCreateProgram());
+    glProgramBinary(programID, header.binaryFormat, &binary.front(),
+                    binary.size());
+    glGetError();
+    GLint linked = GL_FALSE;
+    GL_CHECK(glGetProgramiv(programID, GL_LINK_STATUS, &linked));
+    if (!linked) {
+        GL_CHECK(glDeleteProgram(programID));
+        return 0;
+    }
+    return programID;
+#else
+    return 0;
+#endif
+}
+
+void
+Shader::saveCached(unsigned variant, GLuint programID)
+{
+    if (!cacheEnabled_)
+        return;
+
+#ifdef FRAMEWORK_USE_GLEW
+    GLint length = 0;
+    GL_CHECK(glGetProgramiv(programID, GL_PROGRAM_BINARY_LENGTH, &length));
+    if (length <= 0)
+        return;
+    std::vector<char> binary(length);
+    GLenum format;
+    GL_CHECK(glGetProgramBinary(programID, length, &length, &format,
+                                &binary.front()));
+
+    ShaderCacheHeader header;
+    header.magic = SHADER_CACHE_MAGIC;
+    header.version = SHADER_CACHE_VERSION;
+    header.sourceHash = sourceHash_;
+    header.driverHash = driverHash_;
+    header.variant = variant;
+    header.binaryFormat = format;
+    header.binaryLength = length;
+
+    // Not being able to write the cache just means compiling next time
+    std::string path = cachePath(variant);
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    out.write((const char*) &header, sizeof(header));
+    out.write(&binary.front(), length);
+    if (out.fail())
+        printf("Warning - Couldn't write shader cache %s.\n", path.c_str());
+#endif
 }
 
 const std::string& Shader::errors() const {
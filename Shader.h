@@ -4,6 +4,11 @@
 #include "Framework.h"
 #include <string>
 #include <vector>
+#include <map>
+#include <stdint.h>
+
+// Where we keep linked programs between runs, as <path>.<variant><suffix>
+#define SHADER_CACHE_SUFFIX ".bin"
 
 class Shader {
 public:
@@ -21,8 +26,21 @@ public:
      * at <path>.frag.glsl, and the fragment shader file should be at
      * <path>.vert.glsl.  If the program fails to compile, then the loaded()
      * function will return false.
+     *
+     * The same source can be built into several variants. Bit i of a
+     * variant key puts "#define <defines[i]>" at the top of both files, so
+     * each variant only has the code it needs. Attribute i is bound to
+     * location i in every variant, so that meshes don't need to look them
+     * up. Init() builds variant 0; the others are built when first asked
+     * for.
+     *
+     * Where the driver supports ARB_get_program_binary, linked variants are
+     * saved next to the sources and loaded from there on later runs, as
+     * long as the sources, defines, attributes and driver all match.
+     * Anything else means compiling as usual, and replacing the saved copy.
      */
-    void Init();
+    void Init(const char* const* defines, unsigned numDefines,
+              const char* const* attributes, unsigned numAttributes);
 
     /**
      * This function deallocates the shader.
@@ -36,18 +54,20 @@ public:
     const std::string& path() const;
 
     /**
-     * Returns the OpenGL handle for the GPU program.  You can use the handle
-     * with OpenGL like this: glUseProgram(shader->programID());
+     * Returns the OpenGL handle for a variant of the GPU program, building it
+     * if we haven't already.  You can use the handle
+     * with OpenGL like this: glUseProgram(shader->programID(variant));
      * Calling glUseProgram() will replace OpenGL's fixed pipeline with your
      * vertex/fragment shader.  You can also use the program handle to 
      * get/set uniform values and attributes using glUniformLocation(),
      * glUniform(), glAttributeLocation(), and glAttribute().
      * @return OpenGL handle to the GPU program
      */
-    GLuint programID() const;
+    GLuint programID(unsigned variant = 0);
 
     /**
-     * If the shader loaded successfully, then this function will return true.
+     * If every variant so far loaded successfully, then this function will
+     * return true.
      * If the shader didn't load successfully, the error messages can be
      * retrieved from the errors() function.
      */
@@ -62,12 +82,47 @@ public:
 private:
     std::vector<char> readSource(const std::string& path);
 
+    /**
+     * Compiles one stage of a variant. Returns the shader handle.
+     */
+    GLuint compile(GLenum type, const std::string& header,
+                   const std::vector<char>& source);
+
+    /**
+     * Compiles and links a variant, adding any errors to errors_.
+     */
+    GLuint build(unsigned variant);
+
+    /**
+     * Loads a variant from the program cache. Returns 0 if it isn't there,
+     * is out of date, or the driver won't take it.
+     */
+    GLuint loadCached(unsigned variant);
+
+    /**
+     * Saves a linked variant to the program cache.
+     */
+    void saveCached(unsigned variant, GLuint programID);
+
+    /**
+     * Where a variant lives in the program cache.
+     */
+    std::string cachePath(unsigned variant) const;
+
     std::string path_;
     std::string errors_;
-    GLuint vertexShaderID_;
-    GLuint fragmentShaderID_;
-    GLuint programID_;
+    std::vector<char> vertexSource_;
+    std::vector<char> fragmentSource_;
+    std::vector<std::string> defines_;
+    std::vector<std::string> attributes_;
+    std::map<unsigned, GLuint> programIDs_;
     bool loaded_;
+
+    // Program cache state. The hashes tell us whether a cached program
+    // came from these sources and this driver.
+    bool cacheEnabled_;
+    uint32_t sourceHash_;
+    uint32_t driverHash_;
 };
 
 #endif
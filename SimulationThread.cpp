@@ -0,0 +1,125 @@
+#include "SimulationThread.h"
+
+SimulationThread::SimulationThread(Gameclock& clock,
+                                   Communicator& communicator,
+                                   Timeline& timeline,
+                                   WorldModel& world)
+                                   : mClock(clock)
+                                   , mCommunicator(communicator)
+                                   , mTimeline(timeline)
+                                   , mWorld(world)
+                                   , mThread(&SimulationThread::ThreadMain, this)
+                                   , mRunning(false)
+                                   , mStopping(false)
+{
+    mProfiler.SetName("Simulation");
+}
+
+SimulationThread::~SimulationThread()
+{
+    Stop();
+}
+
+void
+SimulationThread::Start()
+{
+    assert(!mRunning);
+
+    // Have something to draw straight away
+    mWorld.WriteSnapshot(mSnapshots.GetWriteSnapshot());
+    mSnapshots.Publish();
+
+    mStopping = false;
+    mRunning = true;
+    mThread.Launch();
+}
+
+void
+SimulationThread::Stop()
+{
+    if (!mRunning)
+        return;
+
+    {
+        sf::Lock lock(mMutex);
+        mStopping = true;
+    }
+    mThread.Wait();
+    mRunning = false;
+}
+
+void
+SimulationThread::QueueInput(uint32_t inputs)
+{
+    sf::Lock lock(mMutex);
+    mQueuedInputs.push_back(inputs);
+}
+
+void
+SimulationThread::ThreadMain(void* userData)
+{
+    ((SimulationThread*) userData)->Run();
+}
+
+void
+SimulationThread::Run()
+{
+    while (!IsStopping())
+        Step();
+}
+
+bool
+SimulationThread::IsStopping()
+{
+    sf::Lock lock(mMutex);
+    return mStopping;
+}
+
+void
+SimulationThread::Step()
+{
+    sf::Clock stepTimer;
+
+    // Local input. It's stamped here rather than when it was read, since the
+    // clock belongs to us. Input is stamped with a slight delay (if any) so
+    // that it can reach everybody else in time.
+    {
+        ScopedPhase phase(&mProfiler, FRAMEPHASE_INPUT);
+        {
+            sf::Lock lock(mMutex);
+            mPendingInputs.swap(mQueuedInputs);
+        }
+        for (unsigned i = 0; i < mPendingInputs.size(); ++i) {
+            UserInput input(mCommunicator.GetPlayerID(),
+                            mCommunicator.GetInputTimestamp(mClock.Now()));
+            input.inputs = mPendingInputs[i];
+            mCommunicator.ApplyInput(input);
+        }
+        mPendingInputs.clear();
+    }
+
+    // Apply any state updates that may have come in, and send off any
+    // necessary updates.
+    {
+        ScopedPhase phase(&mProfiler, FRAMEPHASE_NETWORK);
+        mCommunicator.Synchronize();
+    }
+
+    // Tick the clock
+    {
+        ScopedPhase phase(&mProfiler, FRAMEPHASE_WAIT);
+        mClock.Tick();
+    }
+
+    // Step the world, and show the renderer where it ended up
+    {
+        ScopedPhase phase(&mProfiler, FRAMEPHASE_PHYSICS);
+        mTimeline.Advance(mClock.Now() - mClock.Then());
+        mWorld.WriteSnapshot(mSnapshots.GetWriteSnapshot());
+        mSnapshots.Publish();
+    }
+
+    // That's a step
+    mProfiler.Record(FRAMEPHASE_FRAME, stepTimer.GetElapsedTime());
+    mProfiler.EndFrame();
+}
@@ -0,0 +1,115 @@
+#ifndef SIMULATIONTHREAD_H
+#define SIMULATIONTHREAD_H
+
+#include "Framework.h"
+#include "Gameclock.h"
+#include "Communicator.h"
+#include "Timeline.h"
+#include "WorldModel.h"
+#include "FrameProfiler.h"
+#include "RenderSnapshot.h"
+#include <vector>
+#ifdef _WIN32
+#include <stdint.h>
+#endif
+
+/*
+ * Runs the simulation (networking, the clock, and stepping the timeline) on
+ * its own thread, so that a long rollback doesn't hold up rendering and the
+ * two can use separate cores.
+ *
+ * Once started, the clock, communicator, timeline and world belong to this
+ * thread. The render thread hands it local input with QueueInput(), and
+ * draws whatever GetSnapshots() has most recently.
+ */
+class SimulationThread {
+
+    public:
+
+    /*
+     * Constructor.
+     */
+    SimulationThread(Gameclock& clock, Communicator& communicator,
+                     Timeline& timeline, WorldModel& world);
+
+    /*
+     * Destructor. Stops the thread if it's running.
+     */
+    ~SimulationThread();
+
+    /*
+     * Starts simulating. Everything should already be bootstrapped and the
+     * clock started.
+     */
+    void Start();
+
+    /*
+     * Asks the thread to finish its current step, and waits for it.
+     */
+    void Stop();
+
+    /*
+     * Any thread. Queues a local input bitfield, to be stamped and applied
+     * on the simulation's next step.
+     */
+    void QueueInput(uint32_t inputs);
+
+    /*
+     * Where the simulation publishes its snapshots.
+     */
+    SnapshotBuffer& GetSnapshots() { return mSnapshots; };
+
+    /*
+     * Simulation thread timings. Only safe to look at while stopped.
+     */
+    FrameProfiler& GetProfiler() { return mProfiler; };
+
+    protected:
+
+    /*
+     * Thread entry point. userData is the SimulationThread.
+     */
+    static void ThreadMain(void* userData);
+
+    /*
+     * Runs steps until we're stopped.
+     */
+    void Run();
+
+    /*
+     * Does one step: input, networking, waiting for the clock, physics,
+     * and publishing a snapshot.
+     */
+    void Step();
+
+    /*
+     * Whether we've been asked to stop.
+     */
+    bool IsStopping();
+
+    // What we simulate
+    Gameclock& mClock;
+    Communicator& mCommunicator;
+    Timeline& mTimeline;
+    WorldModel& mWorld;
+
+    // The thread
+    sf::Thread mThread;
+    bool mRunning;
+
+    // Guards mQueuedInputs and mStopping
+    sf::Mutex mMutex;
+    std::vector<uint32_t> mQueuedInputs;
+    bool mStopping;
+
+    // Inputs taken off the queue. Only used by the simulation thread.
+    std::vector<uint32_t> mPendingInputs;
+
+    // Timings for each step
+    FrameProfiler mProfiler;
+
+    // What we hand to the renderer
+    SnapshotBuffer mSnapshots;
+};
+
+#endif /* SIMULATIONTHREAD_H */
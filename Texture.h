@@ -38,6 +38,11 @@ public:
      */
     bool IsInitialized() { return mInitialized; }
 
+    /*
+     * Gets the texture we bind while enabled, or 0 if we're not initialized.
+     */
+    GLuint GetID() { return mInitialized ? mTextureID : 0; }
+
 protected:
     GLuint mTextureID;
     bool mInitialized;
@@ -1,13 +1,69 @@
 #include "Timeline.h"
+#include "ReplayLog.h"
 
 using std::list;
 using std::vector;
 
+/*
+ * TimelineMetrics methods.
+ */
+
+TimelineMetrics::TimelineMetrics() : numInputs(0)
+                                   , numHeldInputs(0)
+                                   , numDroppedInputs(0)
+                                   , numRollbacks(0)
+                                   , totalRollbackTicks(0)
+                                   , maxRollbackTicks(0)
+{
+    for (unsigned i = 0; i < TIMELINE_DEPTH_BUCKETS; ++i)
+        depthHistogram[i] = 0;
+}
+
+void
+TimelineMetrics::RecordRollback(unsigned depth)
+{
+    // Rebuilding from the current tick isn't really a rollback
+    if (depth == 0)
+        return;
+
+    ++numRollbacks;
+    totalRollbackTicks += depth;
+    maxRollbackTicks = MAX(maxRollbackTicks, depth);
+
+    // Find the bucket
+    unsigned bucket = 0;
+    while (depth > 1 && bucket < TIMELINE_DEPTH_BUCKETS - 1) {
+        depth >>= 1;
+        ++bucket;
+    }
+    ++depthHistogram[bucket];
+}
+
+void
+TimelineMetrics::Dump()
+{
+    printf("Timeline: %u inputs, %u held for the future, %u dropped\n",
+           numInputs, numHeldInputs, numDroppedInputs);
+    printf("Timeline: %u rollbacks, average depth %.2f ticks, max depth %u ticks\n",
+           numRollbacks,
+           numRollbacks ? (double) totalRollbackTicks / numRollbacks : 0.0,
+           maxRollbackTicks);
+    for (unsigned i = 0; i < TIMELINE_DEPTH_BUCKETS; ++i) {
+        if (i == TIMELINE_DEPTH_BUCKETS - 1)
+            printf("    %4u+      ticks: %u\n", 1 << i, depthHistogram[i]);
+        else
+            printf("    %4u-%-4u  ticks: %u\n", 1 << i, (2 << i) - 1,
+                   depthHistogram[i]);
+    }
+}
+
 /*
  * Timeline methods.
  */
 
 Timeline::Timeline() : mWorld(NULL)
+                     , mRecorder(NULL)
+                     , mInputListener(NULL)
 {
 }
 
@@ -28,11 +84,60 @@ Timeline::Init(WorldModel& model, CommunicatorMode mode)
 
     // Generate an initial keyframe
     GenerateCurrentKeyframe();
+    if (mRecorder)
+        mRecorder->RecordState(mKeyframes.back()->state);
+}
+
+void
+Timeline::Resync(WorldState& state)
+{
+    if (mRecorder)
+        mRecorder->RecordState(state);
+
+    // Make sure our timeline contains the newest model state.
+    if (!UpToDate())
+        GenerateCurrentKeyframe();
+
+    // If the snapshot is from the future, we have nothing to rebuild. Jump
+    // ahead to it, and pick up any held inputs that it brings due.
+    if (state.timestamp > mKeyframes.back()->state.timestamp) {
+        Prune(mKeyframes.back()->state.timestamp + 1);
+        mWorld->SetState(state);
+        GenerateCurrentKeyframe();
+        ApplyPendingInputs();
+        return;
+    }
+
+    // Otherwise the snapshot becomes the keyframe at its tick, and replaces
+    // everything before it. It may be older than all of our history, in
+    // which case the rebuild takes a while longer.
+    KeyframeIterator resync;
+    if (state.timestamp < mKeyframes.front()->state.timestamp)
+        resync = mKeyframes.insert(mKeyframes.begin(), new Keyframe(state));
+    else {
+        resync = FindKeyframe(state.timestamp);
+        if ((*resync)->state.timestamp < state.timestamp) {
+            KeyframeIterator pos = resync;
+            ++pos;
+            resync = mKeyframes.insert(pos, new Keyframe(state));
+        }
+        else
+            (*resync)->state = state;
+        Prune(state.timestamp);
+    }
+
+    // Catch back up. The inputs at the snapshot's own tick may already be
+    // in it, but applying an input twice doesn't change anything.
+    Rectify(resync, mKeyframes.back()->state.timestamp - state.timestamp);
 }
 
 void
 Timeline::AddInput(UserInput& input)
 {
+    ++mMetrics.numInputs;
+    if (mRecorder)
+        mRecorder->RecordInput(input);
+
     // We may be fast-forwarding and rewinding, so make sure our timeline contains
     // the newest model state.
     if (!UpToDate())
@@ -43,17 +148,26 @@ Timeline::AddInput(UserInput& input)
         printf("Warning - Received input for player %u with timestamp %u, but "
                "we only have keyframes dating back to %u. Dropping.\n",
                input.playerID, input.timestamp, mKeyframes.front()->state.timestamp);
+        ++mMetrics.numDroppedInputs;
         return;
     }
 
-    // If the input is ahead of our current worldstate...
+    // If the input is ahead of our current worldstate, hold on to it until
+    // we get there. Clients deliberately run slightly ahead of the server,
+    // so this is the normal case for the server.
     if (input.timestamp > mKeyframes.back()->state.timestamp) {
 
-        // TODO - we should probably handle this better. Servers should discard
-        // input, and clients should sync their game clocks.
-        printf("Warning - Received input for player %u with timestamp %u, but "
-               "we only have keyframes dating up to %u. Dropping.\n",
-               input.playerID, input.timestamp, mKeyframes.back()->state.timestamp);
+        // Unless it's absurdly far ahead
+        if (input.timestamp > mKeyframes.back()->state.timestamp + TIMELINE_MAX_LEAD) {
+            printf("Warning - Received input for player %u with timestamp %u, but "
+                   "we only have keyframes dating up to %u. Dropping.\n",
+                   input.playerID, input.timestamp, mKeyframes.back()->state.timestamp);
+            ++mMetrics.numDroppedInputs;
+            return;
+        }
+
+        ++mMetrics.numHeldInputs;
+        mPendingInputs.insert(std::make_pair((unsigned) input.timestamp, input));
         return;
     }
 
@@ -61,8 +175,105 @@ Timeline::AddInput(UserInput& input)
     AddInputInternal(input);
 }
 
+void
+Timeline::Advance(int numTicks)
+{
+    if (mRecorder)
+        mRecorder->RecordAdvance(numTicks);
+
+    // Step the world. We stop at every multiple of KEYFRAME_STEP along the
+    // way to take a snapshot, so that rollbacks never have to go back too
+    // far, and so that every peer has snapshots at the same ticks to
+    // compare.
+    RollbackFrameStats& stats = mProfiler.Current();
+    sf::Clock timer;
+    while (numTicks > 0) {
+        unsigned start = mWorld->GetCurrentTimestamp();
+        int toKeyframe = KEYFRAME_STEP - start % KEYFRAME_STEP;
+        int stepSize = MIN(toKeyframe, numTicks);
+
+        timer.Reset();
+        mWorld->Step(stepSize);
+        stats.liveStepSeconds += timer.GetElapsedTime();
+        stats.liveTicks += stepSize;
+        numTicks -= stepSize;
+
+        if (stepSize == toKeyframe && !UpToDate()) {
+            timer.Reset();
+            GenerateCurrentKeyframe();
+            stats.snapshotSeconds += timer.GetElapsedTime();
+        }
+    }
+    unsigned now = mWorld->GetCurrentTimestamp();
+
+    // Catch up on anything we were holding
+    ApplyPendingInputs();
+
+    // Forget about history we'll never go back to, keeping the snapshot
+    // just before the cutoff to rebuild from.
+    if (now > TIMELINE_ROLLBACK_WINDOW) {
+        KeyframeIterator oldest = FindKeyframe(now - TIMELINE_ROLLBACK_WINDOW);
+        if (oldest != mKeyframes.end())
+            Prune((*oldest)->state.timestamp);
+    }
+
+    // That's a frame
+    mProfiler.EndFrame(now, mKeyframes.size());
+}
+
+void
+Timeline::ApplyPendingInputs()
+{
+    // Anything to do?
+    unsigned now = mWorld->GetCurrentTimestamp();
+    if (mPendingInputs.empty() || mPendingInputs.begin()->first > now)
+        return;
+
+    // Make sure our timeline contains the newest model state.
+    if (!UpToDate())
+        GenerateCurrentKeyframe();
+
+    // Record all the inputs that are due, keeping track of the earliest point
+    // we need to rebuild from. We only rebuild once.
+    KeyframeIterator earliest = mKeyframes.end();
+    unsigned earliestInput = now;
+    while (!mPendingInputs.empty() && mPendingInputs.begin()->first <= now) {
+        UserInput& input = mPendingInputs.begin()->second;
+
+        // We may have resynchronized since we got the input
+        if (input.timestamp < mKeyframes.front()->state.timestamp) {
+            printf("Warning - Held input for player %u with timestamp %u, but "
+                   "we only have keyframes dating back to %u. Dropping.\n",
+                   input.playerID, input.timestamp,
+                   mKeyframes.front()->state.timestamp);
+            ++mMetrics.numDroppedInputs;
+        }
+        else {
+            KeyframeIterator from = InsertInput(input);
+            if (earliest == mKeyframes.end() ||
+                (*from)->state.timestamp < (*earliest)->state.timestamp)
+                earliest = from;
+            earliestInput = MIN(earliestInput, (unsigned) input.timestamp);
+        }
+
+        mPendingInputs.erase(mPendingInputs.begin());
+    }
+
+    // Rebuild
+    if (earliest != mKeyframes.end())
+        Rectify(earliest, now - earliestInput);
+}
+
 void
 Timeline::AddInputInternal(UserInput& input)
+{
+    // Record the input and rebuild from there
+    unsigned depth = mKeyframes.back()->state.timestamp - input.timestamp;
+    Rectify(InsertInput(input), depth);
+}
+
+KeyframeIterator
+Timeline::InsertInput(UserInput& input)
 {
     // Find the newest keyframe with a timestamp less than or equal to this one
     KeyframeIterator nearest = FindKeyframe(input.timestamp);
@@ -82,15 +293,28 @@ Timeline::AddInputInternal(UserInput& input)
     else
         (*nearest)->inputs.push_back(input);
 
-    // Rectify
-    Rectify(nearest);
+    // Our caller rebuilds the world with it right away
+    if (mInputListener && !(input.inputs & USERINPUT_ROSTER_MASK))
+        mInputListener->OnInputApplied(input);
+
+    return nearest;
 }
 
 void
-Timeline::Rectify(KeyframeIterator lastGood)
+Timeline::Rectify(KeyframeIterator lastGood, unsigned depth)
 {
+    // Keep track of how late things are
+    mMetrics.RecordRollback(depth);
+    RollbackFrameStats& stats = mProfiler.Current();
+    if (depth > 0) {
+        ++stats.numRollbacks;
+        stats.maxDepth = MAX(stats.maxDepth, depth);
+    }
+
     // Rewind ourselves to the state snapshot given
+    sf::Clock timer;
     mWorld->SetState((*lastGood)->state);
+    stats.snapshotSeconds += timer.GetElapsedTime();
     KeyframeIterator curr, upcoming;
     curr = upcoming = lastGood;
 
@@ -100,24 +324,32 @@ Timeline::Rectify(KeyframeIterator lastGood)
         ++upcoming;
 
         // Dump the world model state into the timeline
-        WorldState state;
-        mWorld->GetState(state);
-        (*curr)->state = state;
+        timer.Reset();
+        mWorld->GetState((*curr)->state);
+        stats.snapshotSeconds += timer.GetElapsedTime();
 
         // Apply all the inputs at this stage
+        timer.Reset();
         for (unsigned i = 0; i < (*curr)->inputs.size(); ++i)
             mWorld->ApplyInput((*curr)->inputs[i]);
+        stats.applyInputSeconds += timer.GetElapsedTime();
 
         // Step the world, if necessary
         if (upcoming != mKeyframes.end()) {
             unsigned stepSize = (*upcoming)->state.timestamp -
                                   (*curr)->state.timestamp;
-            mWorld->Step(stepSize);
+            timer.Reset();
+            mWorld->Step(stepSize, true);
+            stats.resimStepSeconds += timer.GetElapsedTime();
+            stats.resimTicks += stepSize;
         }
 
         // We increment curr at the _end_ of the loop
         ++curr;
     }
+
+    // Only now does anybody get to see the result
+    mWorld->SyncSceneGraph();
 }
 
 void
@@ -134,6 +366,31 @@ Timeline::GenerateCurrentKeyframe()
     mKeyframes.push_back(frame);
 }
 
+bool
+Timeline::GetChecksum(unsigned timestamp, uint32_t& checksumOut)
+{
+    if (mKeyframes.empty())
+        return false;
+
+    KeyframeIterator it = FindKeyframe(timestamp);
+    if (it == mKeyframes.end() || (*it)->state.timestamp != timestamp)
+        return false;
+
+    checksumOut = (*it)->state.Checksum();
+    return true;
+}
+
+size_t
+Timeline::GetKeyframeBytes()
+{
+    size_t bytes = 0;
+    for (KeyframeIterator it = mKeyframes.begin(); it != mKeyframes.end(); ++it)
+        bytes += sizeof(Keyframe) +
+                 (*it)->state.playerVec.capacity() * sizeof(PlayerInfo) +
+                 (*it)->inputs.capacity() * sizeof(UserInput);
+    return bytes;
+}
+
 bool
 Timeline::UpToDate()
 {
@@ -148,6 +405,7 @@ Timeline::Prune(unsigned timestamp)
     while (it != mKeyframes.end()) {
         if ((*it)->state.timestamp >= timestamp)
             return;
+        delete *it;
         mKeyframes.erase(it++);
     }
 }
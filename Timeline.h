@@ -4,12 +4,82 @@
 #include "WorldModel.h"
 #include "UserInput.h"
 #include "Communicator.h"
+#include "RollbackProfiler.h"
 #include <list>
 #include <vector>
+#include <map>
 
-// The number of steps between keyframes
+// We always take a keyframe at multiples of this many ticks. Rollbacks
+// resimulate from the nearest keyframe, so this bounds how much extra work a
+// late input can cost us, at the price of taking more snapshots. It's also
+// how often peers compare checksums.
 #define KEYFRAME_STEP 30
 
+// How much history we keep around, in ticks. Inputs older than this are
+// dropped.
+#define TIMELINE_ROLLBACK_WINDOW 128
+
+// How far ahead of the world we'll hold on to an input, in ticks. Inputs
+// further in the future than this are dropped.
+#define TIMELINE_MAX_LEAD 64
+
+// The number of buckets in our rollback depth histogram. Bucket i counts
+// rollbacks of between 2^i and 2^(i+1) - 1 ticks, with the last bucket
+// catching everything deeper.
+#define TIMELINE_DEPTH_BUCKETS 6
+
+class ReplayLog;
+
+/*
+ * Interface for anybody who wants to know when input takes effect.
+ */
+class InputListener {
+
+    public:
+
+    virtual ~InputListener() {};
+
+    /*
+     * Called when a player's input goes into the simulation, which is when
+     * the world is rebuilt with it. Inputs from the future are held until
+     * then. Joins and leaves don't count.
+     */
+    virtual void OnInputApplied(UserInput& input) = 0;
+};
+
+/*
+ * Running tally of how our timeline has been behaving over the course of
+ * a match.
+ */
+struct TimelineMetrics {
+
+    /*
+     * Constructor. Zeroes everything.
+     */
+    TimelineMetrics();
+
+    /*
+     * Records a rollback of the given depth, in ticks.
+     */
+    void RecordRollback(unsigned depth);
+
+    /*
+     * Prints a summary to stdout.
+     */
+    void Dump();
+
+    // Inputs we've been given, and what became of them
+    unsigned numInputs;
+    unsigned numHeldInputs;
+    unsigned numDroppedInputs;
+
+    // Rollbacks, and how far back they went
+    unsigned numRollbacks;
+    unsigned long totalRollbackTicks;
+    unsigned maxRollbackTicks;
+    unsigned depthHistogram[TIMELINE_DEPTH_BUCKETS];
+};
+
 /*
  * A keyframe is an item in our timeline. It contains a snapshot of the
  * world state at the beginning of that timestep, and the input applied
@@ -53,9 +123,64 @@ class Timeline {
 
     /*
      * Adds an input to the timeline.
+     *
+     * Inputs from the past cause us to rewind and replay. Inputs from the
+     * future are held until the world catches up with them.
      */
     void AddInput(UserInput& input);
 
+    /*
+     * Steps the world forward by the given number of ticks, and applies any
+     * held inputs whose time has come.
+     */
+    void Advance(int numTicks);
+
+    /*
+     * Takes a snapshot from the server as the truth about its tick. Our
+     * history from before then is thrown away, and everything after it is
+     * rebuilt with the inputs we already have, which brings the world back
+     * to the current tick. A snapshot from a tick we haven't reached yet
+     * replaces everything.
+     */
+    void Resync(WorldState& state);
+
+    /*
+     * Gets the metrics we've gathered so far.
+     */
+    TimelineMetrics& GetMetrics() { return mMetrics; };
+
+    /*
+     * Gets our per-frame profiler.
+     */
+    RollbackProfiler& GetProfiler() { return mProfiler; };
+
+    /*
+     * Gets the checksum of the world state at the given timestamp, which
+     * must be a multiple of KEYFRAME_STEP. Returns false if we don't have
+     * a keyframe there (because it's too old, or we resynchronized since).
+     */
+    bool GetChecksum(unsigned timestamp, uint32_t& checksumOut);
+
+    /*
+     * Sets a log to record everything we're given to. May be NULL.
+     */
+    void SetRecorder(ReplayLog* recorder) { mRecorder = recorder; };
+
+    /*
+     * Sets an object to tell about inputs as they take effect. May be NULL.
+     */
+    void SetInputListener(InputListener* listener) { mInputListener = listener; };
+
+    /*
+     * Gets the number of keyframes we're holding on to.
+     */
+    unsigned GetNumKeyframes() { return mKeyframes.size(); };
+
+    /*
+     * Estimates the heap memory held by our keyframes, in bytes.
+     */
+    size_t GetKeyframeBytes();
+
     protected:
 
     /*
@@ -64,14 +189,29 @@ class Timeline {
      */
     void AddInputInternal(UserInput& input);
 
+    /*
+     * Records an input in the appropriate keyframe, without rebuilding
+     * anything. Returns the keyframe we need to Rectify() from.
+     */
+    KeyframeIterator InsertInput(UserInput& input);
+
+    /*
+     * Adds all the held inputs that are no longer in the future.
+     */
+    void ApplyPendingInputs();
+
     /*
      * Rebuilds the state snapshots in the keyframes, starting with a
      * position with a known good snapshot.
      *
+     * depth is how many ticks late the change that made us rebuild was,
+     * for metrics. That's measured from the change itself, not from
+     * lastGood, which can be up to a keyframe step earlier.
+     *
      * This mucks with WorldModel state. At the end, it leaves WorldModel
      * with the rebuilt state at the last keyframe.
      */
-    void Rectify(KeyframeIterator lastGood);
+    void Rectify(KeyframeIterator lastGood, unsigned depth);
 
     /*
      * Generates a keyframe for the current worldstate.
@@ -103,9 +243,22 @@ class Timeline {
     // Client or server?
     CommunicatorMode mMode;
 
-    // Our set of keyframes, from newest to oldest
+    // Our set of keyframes, from oldest to newest
     std::list<Keyframe*> mKeyframes;
 
+    // Inputs from the future, keyed by timestamp
+    std::multimap<unsigned, UserInput> mPendingInputs;
+
+    // How things have been going
+    TimelineMetrics mMetrics;
+    RollbackProfiler mProfiler;
+
+    // Where we record to, if anywhere
+    ReplayLog* mRecorder;
+
+    // Who wants to know about inputs taking effect, if anybody
+    InputListener* mInputListener;
+
 };
 
 #endif /* TIMELINE_H */
@@ -5,6 +5,7 @@
 UserInput::UserInput(unsigned playerID_, unsigned timestamp_) : inputs(0)
                                                               , timestamp(timestamp_)
                                                               , playerID(playerID_)
+                                                              , sequence(0)
 {
 }
 
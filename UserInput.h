@@ -23,6 +23,13 @@ typedef enum {
 
 #define GEN_INPUT_MASK(index, isBegin) (isBegin ? 1 << (2*index) : 1 << (2*index+1))
 
+// Inputs with one of these bits set don't come from a player. The server
+// sends them to add or remove the player they name, so that players come
+// and go at the same tick for everybody, and rollbacks replay it.
+#define USERINPUT_JOIN (1u << 30)
+#define USERINPUT_LEAVE (1u << 31)
+#define USERINPUT_ROSTER_MASK (USERINPUT_JOIN | USERINPUT_LEAVE)
+
 struct UserInput {
 
     /*
@@ -48,6 +55,10 @@ struct UserInput {
 
     // ID of the player doing the input
     uint32_t playerID;
+
+    // Counts up with each input a player sends. Filled in by
+    // Communicator::ApplyInput().
+    uint32_t sequence;
 };
 
 #endif /* USERINPUT_H */
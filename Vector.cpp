@@ -3,6 +3,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef VECTOR_USE_SSE
+/*
+ * Sums the four lanes, leaving the result in the lowest one.
+ */
+static inline float
+HorizontalSum(__m128 value)
+{
+    __m128 pairs = _mm_add_ps(value, _mm_movehl_ps(value, value));
+    __m128 sum = _mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs,
+                                                  _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(sum);
+}
+#endif
+
 Vector::Vector() : x(0.0)
                  , y(0.0)
                  , z(0.0)
@@ -53,7 +67,7 @@ Vector::Unit() const
 float
 Vector::Norm3() const
 {
-    return sqrt(x * x + y * y + z * z);
+    return sqrt(Dot3(*this));
 }
 
 bool
@@ -68,18 +82,30 @@ Vector::Equals3(Vector& other) const
 float
 Vector::Dot(const Vector& other) const
 {
+#ifdef VECTOR_USE_SSE
+    return HorizontalSum(_mm_mul_ps(VectorLoad(*this), VectorLoad(other)));
+#else
     return  x * other.x +
             y * other.y +
             z * other.z +
             w * other.w;
+#endif
 }
 
 float
 Vector::Dot3(const Vector& other) const
 {
+#ifdef VECTOR_USE_SSE
+    __m128 product = _mm_mul_ps(VectorLoad(*this), VectorLoad(other));
+    __m128 sum = _mm_add_ss(product, _mm_shuffle_ps(product, product,
+                                                    _MM_SHUFFLE(1, 1, 1, 1)));
+    sum = _mm_add_ss(sum, _mm_movehl_ps(product, product));
+    return _mm_cvtss_f32(sum);
+#else
     return  x * other.x +
             y * other.y +
             z * other.z;
+#endif
 }
 
 Vector
@@ -113,12 +139,23 @@ Vector::Cross(const Vector& other) const
 {
   // Setup
   Vector rv;
-  rv.w = 0.0f;
 
+#ifdef VECTOR_USE_SSE
+  // With both vectors rotated to (y, z, x), a * b' - a' * b gives the cross
+  // product rotated the same way, so we rotate it back.
+  __m128 a = VectorLoad(*this);
+  __m128 b = VectorLoad(other);
+  __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+  VectorStore(rv, _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+#else
   // Compute the cross product
   rv.x = y * other.z - z * other.y;
   rv.y = -(x * other.z - z * other.x);
   rv.z = x * other.y - y * other.x;
+#endif
+  rv.w = 0.0f;
 
   return rv;
 }
@@ -127,10 +164,14 @@ Vector
 Vector::Scale(float factor)
 {
     Vector rv;
+#ifdef VECTOR_USE_SSE
+    VectorStore(rv, _mm_mul_ps(VectorLoad(*this), _mm_set1_ps(factor)));
+#else
     rv.x = x * factor;
     rv.y = y * factor;
     rv.z = z * factor;
     rv.w = w * factor;
+#endif
     return rv;
 }
 
@@ -138,10 +179,14 @@ const Vector
 Vector::operator+(const Vector& other) const
 {
     Vector rv;
+#ifdef VECTOR_USE_SSE
+    VectorStore(rv, _mm_add_ps(VectorLoad(*this), VectorLoad(other)));
+#else
     rv.x = x + other.x;
     rv.y = y + other.y;
     rv.z = z + other.z;
     rv.w = w + other.w;
+#endif
     return rv;
 }
 
@@ -149,10 +194,14 @@ const Vector
 Vector::operator-(const Vector& other) const
 {
     Vector rv;
+#ifdef VECTOR_USE_SSE
+    VectorStore(rv, _mm_sub_ps(VectorLoad(*this), VectorLoad(other)));
+#else
     rv.x = x - other.x;
     rv.y = y - other.y;
     rv.z = z - other.z;
     rv.w = w - other.w;
+#endif
     return rv;
 }
 //
@@ -5,10 +5,30 @@
 
 #define VEC_EPS 0.0001f
 
+// Use SSE for vector and matrix math wherever the compiler has it. Define
+// VECTOR_NO_SIMD to use plain floats everywhere.
+#if !defined(VECTOR_NO_SIMD) && \
+    (defined(__SSE__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define VECTOR_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// Vectors (and so Matrix rows) sit on 16 byte boundaries, so that each one
+// fills exactly one SSE register. 32-bit MSVC can't pass aligned types by
+// value, so there we go without, and rely on unaligned loads.
+#if defined(__GNUC__)
+#define VECTOR_ALIGN __attribute__((aligned(16)))
+#elif defined(_WIN64)
+#define VECTOR_ALIGN __declspec(align(16))
+#else
+#define VECTOR_ALIGN
+#endif
+
 /*
  * Simple 4-dimensional vector implementation.
  */
-struct Vector {
+struct VECTOR_ALIGN Vector {
 
     float x, y, z, w;
     
@@ -125,4 +145,14 @@ struct Vector {
     const void Dump();
 };
 
+#ifdef VECTOR_USE_SSE
+/*
+ * Moves a Vector in and out of an SSE register. These are unaligned loads
+ * and stores, which cost the same as aligned ones when the data is aligned
+ * anyway, and still work when it isn't.
+ */
+inline __m128 VectorLoad(const Vector& v) { return _mm_loadu_ps(&v.x); }
+inline void VectorStore(Vector& v, __m128 value) { _mm_storeu_ps(&v.x, value); }
+#endif
+
 #endif /* VECTOR_H */
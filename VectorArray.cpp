@@ -0,0 +1,152 @@
+#include "VectorArray.h"
+#include <assert.h>
+
+void
+VectorArray::Resize(unsigned size)
+{
+    mX.resize(size, 0.0f);
+    mY.resize(size, 0.0f);
+    mZ.resize(size, 0.0f);
+    mSize = size;
+}
+
+Vector
+VectorArray::Get(unsigned index) const
+{
+    assert(index < mSize);
+    return Vector(mX[index], mY[index], mZ[index], 1.0f);
+}
+
+void
+VectorArray::Set(unsigned index, const Vector& vec)
+{
+    assert(index < mSize);
+    mX[index] = vec.x;
+    mY[index] = vec.y;
+    mZ[index] = vec.z;
+}
+
+void
+VectorArray::SetInterleaved(const GLfloat* xyz, unsigned count)
+{
+    Resize(count);
+    for (unsigned i = 0; i < count; ++i) {
+        mX[i] = xyz[3 * i + 0];
+        mY[i] = xyz[3 * i + 1];
+        mZ[i] = xyz[3 * i + 2];
+    }
+}
+
+void
+VectorArray::GetInterleaved(GLfloat* xyzOut) const
+{
+    for (unsigned i = 0; i < mSize; ++i) {
+        xyzOut[3 * i + 0] = mX[i];
+        xyzOut[3 * i + 1] = mY[i];
+        xyzOut[3 * i + 2] = mZ[i];
+    }
+}
+
+void
+VectorArray::Transform(const Matrix& mat, float w, VectorArray& out) const
+{
+    if (&out != this)
+        out.Resize(mSize);
+    if (mSize == 0)
+        return;
+
+    const float* x = &mX[0];
+    const float* y = &mY[0];
+    const float* z = &mZ[0];
+    float* outX = &out.mX[0];
+    float* outY = &out.mY[0];
+    float* outZ = &out.mZ[0];
+
+    // Each output component is a dot product with a matrix row. w is the
+    // same for everybody, so its part of that is a constant.
+    float m[3][4];
+    for (unsigned row = 0; row < 3; ++row) {
+        for (unsigned col = 0; col < 3; ++col)
+            m[row][col] = mat[row][col];
+        m[row][3] = mat[row][3] * w;
+    }
+
+    unsigned i = 0;
+#ifdef VECTOR_USE_SSE
+    // Four vectors at a time, with every matrix element splatted across a
+    // register
+    __m128 splat[3][4];
+    for (unsigned row = 0; row < 3; ++row)
+        for (unsigned col = 0; col < 4; ++col)
+            splat[row][col] = _mm_set1_ps(m[row][col]);
+
+    for (; i + 4 <= mSize; i += 4) {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 vz = _mm_loadu_ps(z + i);
+        __m128 result[3];
+        for (unsigned row = 0; row < 3; ++row)
+            result[row] =
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(splat[row][0], vx),
+                                      _mm_mul_ps(splat[row][1], vy)),
+                           _mm_add_ps(_mm_mul_ps(splat[row][2], vz),
+                                      splat[row][3]));
+        _mm_storeu_ps(outX + i, result[0]);
+        _mm_storeu_ps(outY + i, result[1]);
+        _mm_storeu_ps(outZ + i, result[2]);
+    }
+#endif
+
+    // Whatever's left over
+    for (; i < mSize; ++i) {
+        float vx = x[i], vy = y[i], vz = z[i];
+        outX[i] = m[0][0] * vx + m[0][1] * vy + m[0][2] * vz + m[0][3];
+        outY[i] = m[1][0] * vx + m[1][1] * vy + m[1][2] * vz + m[1][3];
+        outZ[i] = m[2][0] * vx + m[2][1] * vy + m[2][2] * vz + m[2][3];
+    }
+}
+
+void
+VectorArray::GetBounds(Vector& minOut, Vector& maxOut) const
+{
+    assert(mSize > 0);
+
+    const float* components[3] = { &mX[0], &mY[0], &mZ[0] };
+    for (unsigned c = 0; c < 3; ++c) {
+        const float* values = components[c];
+        float lo = values[0];
+        float hi = values[0];
+
+        unsigned i = 0;
+#ifdef VECTOR_USE_SSE
+        // Keep four running minimums and maximums, and combine them at the
+        // end
+        if (mSize >= 4) {
+            __m128 vlo = _mm_loadu_ps(values);
+            __m128 vhi = vlo;
+            for (i = 4; i + 4 <= mSize; i += 4) {
+                __m128 v = _mm_loadu_ps(values + i);
+                vlo = _mm_min_ps(vlo, v);
+                vhi = _mm_max_ps(vhi, v);
+            }
+            float los[4], his[4];
+            _mm_storeu_ps(los, vlo);
+            _mm_storeu_ps(his, vhi);
+            for (unsigned j = 0; j < 4; ++j) {
+                lo = MIN(lo, los[j]);
+                hi = MAX(hi, his[j]);
+            }
+        }
+#endif
+
+        // Whatever's left over
+        for (; i < mSize; ++i) {
+            lo = MIN(lo, values[i]);
+            hi = MAX(hi, values[i]);
+        }
+
+        minOut[c] = lo;
+        maxOut[c] = hi;
+    }
+    minOut.w = maxOut.w = 1.0f;
+}
@@ -0,0 +1,74 @@
+#ifndef VECTORARRAY_H
+#define VECTORARRAY_H
+
+#include "Vector.h"
+#include "Matrix.h"
+#include <vector>
+
+/*
+ * A batch of 3D vectors, stored as separate x, y and z arrays (structure of
+ * arrays) rather than one Vector after another. That way SSE can work on
+ * four vectors at a time with no shuffling, so transforming a whole batch
+ * runs about as fast as we can stream it through memory.
+ *
+ * There's no w array. Operations that need one take it as a parameter,
+ * since a batch is normally all points (w = 1) or all directions (w = 0).
+ */
+class VectorArray {
+
+    public:
+
+    /*
+     * Constructor. Starts out empty.
+     */
+    VectorArray() : mSize(0) {};
+
+    /*
+     * Gets/sets the number of vectors. New vectors are zero.
+     */
+    unsigned Size() const { return mSize; };
+    void Resize(unsigned size);
+
+    /*
+     * Gets/sets a single vector. Get() returns a w of 1.
+     */
+    Vector Get(unsigned index) const;
+    void Set(unsigned index, const Vector& vec);
+
+    /*
+     * Loads from/stores to a packed array of x, y, z triples, like the
+     * vertex arrays we hand to GL.
+     */
+    void SetInterleaved(const GLfloat* xyz, unsigned count);
+    void GetInterleaved(GLfloat* xyzOut) const;
+
+    /*
+     * Direct access to the component arrays.
+     */
+    float* X() { return mSize ? &mX[0] : NULL; };
+    float* Y() { return mSize ? &mY[0] : NULL; };
+    float* Z() { return mSize ? &mZ[0] : NULL; };
+
+    /*
+     * Transforms every vector by mat, treating them all as having the given
+     * w (1 for points, 0 for directions). The result goes in out, which may
+     * be this array.
+     */
+    void Transform(const Matrix& mat, float w, VectorArray& out) const;
+
+    /*
+     * Gets the axis-aligned box containing every vector. The array must not
+     * be empty. The w of each corner is 1.
+     */
+    void GetBounds(Vector& minOut, Vector& maxOut) const;
+
+    protected:
+
+    // Component arrays, each mSize long
+    std::vector<float> mX;
+    std::vector<float> mY;
+    std::vector<float> mZ;
+    unsigned mSize;
+};
+
+#endif /* VECTORARRAY_H */
@@ -2,8 +2,16 @@
 #include "UserInput.h"
 #include <string>
 #include <sstream>
+#include <string.h>
+#include <math.h>
 #include "Gameclock.h"
 
+#ifdef GROWBLES_BULLET_MT
+#include <bullet/LinearMath/btThreads.h>
+#include <bullet/BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <bullet/BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#endif
+
 using std::vector;
 using std::string;
 using std::stringstream;
@@ -14,6 +22,12 @@ using std::stringstream;
 
 #define ARMADILLO_BASE_Y 3.3
 
+// How many collision pairs each worker takes at a time
+#define PHYSICS_DISPATCH_GRAIN_SIZE 40
+
+// How many threads step the physics
+static unsigned sPhysicsThreads = 1;
+
 /*
  * Helper function to move a rigid body to a certain location
  */
@@ -43,15 +57,78 @@ WorldModel::Init(SceneGraph& sceneGraph)
     Vector emapPos(0.0, 3.0 + ARMADILLO_BASE_Y, 0.0, 1.0);
     sceneGraph.FindMesh("Armadillo_0")->EnvironmentMap(emapPos);
 
+    // Set up everything else
+    InitPhysics();
+}
+
+void
+WorldModel::InitHeadless()
+{
+    mSceneGraph = NULL;
+    InitPhysics();
+}
+
+void
+WorldModel::SetPhysicsThreads(unsigned numThreads)
+{
+    sPhysicsThreads = MAX(1, MIN(numThreads, WORLDMODEL_MAX_PHYSICS_THREADS));
+
+#ifdef GROWBLES_BULLET_MT
+    // Bullet only has the one scheduler, so we make it the first time
+    // somebody asks for threads and keep it around.
+    if (sPhysicsThreads > 1 &&
+        btGetTaskScheduler() == btGetSequentialTaskScheduler()) {
+        btITaskScheduler* scheduler = btCreateDefaultTaskScheduler();
+        if (scheduler == NULL) {
+            printf("Warning - Bullet has no task scheduler, physics will "
+                   "run on one thread.\n");
+            sPhysicsThreads = 1;
+            return;
+        }
+        btSetTaskScheduler(scheduler);
+    }
+    sPhysicsThreads = MIN(sPhysicsThreads,
+                          (unsigned) btGetTaskScheduler()->getMaxNumThreads());
+    btGetTaskScheduler()->setNumThreadsInUse(sPhysicsThreads);
+#else
+    if (sPhysicsThreads > 1) {
+        printf("Warning - Built without GROWBLES_BULLET_MT, physics will run "
+               "on one thread.\n");
+        sPhysicsThreads = 1;
+    }
+#endif
+}
+
+void
+WorldModel::InitPhysics()
+{
     // Setup physics simulation
     broadphase = new btDbvtBroadphase();
 
     collisionConfiguration = new btDefaultCollisionConfiguration();
-    dispatcher = new btCollisionDispatcher(collisionConfiguration);
-
-    solver = new btSequentialImpulseConstraintSolver;
 
-    dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,broadphase,solver,collisionConfiguration);
+#ifdef GROWBLES_BULLET_MT
+    // Narrowphase collision is spread across the workers, and each
+    // simulation island is handed to one solver from a pool. Whether that
+    // gets exactly the answer one thread would is up to Bullet; check a
+    // match with "replay -w" before relying on it.
+    if (sPhysicsThreads > 1) {
+        dispatcher = new btCollisionDispatcherMt(collisionConfiguration,
+                                                 PHYSICS_DISPATCH_GRAIN_SIZE);
+        btConstraintSolverPoolMt* solverPool =
+            new btConstraintSolverPoolMt(sPhysicsThreads);
+        solver = solverPool;
+        dynamicsWorld = new btDiscreteDynamicsWorldMt(dispatcher, broadphase,
+                                                      solverPool, NULL,
+                                                      collisionConfiguration);
+    }
+    else
+#endif
+    {
+        dispatcher = new btCollisionDispatcher(collisionConfiguration);
+        solver = new btSequentialImpulseConstraintSolver;
+        dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,broadphase,solver,collisionConfiguration);
+    }
 
     dynamicsWorld->setGravity(btVector3(0,-10,0));
 
@@ -121,44 +198,46 @@ WorldModel::~WorldModel()
 }
 
 void
-WorldModel::Step(int numTicks, float deltaSeconds)
+WorldModel::Step(int numTicks, bool resimulating)
 {
     assert(numTicks > 0);
 
-    if(deltaSeconds < 0)
-        deltaSeconds = numTicks*GAMECLOCK_TICK_MS/1000.0f;
-
-    // BOF step physics
-    dynamicsWorld->stepSimulation(deltaSeconds, 10);
+    const btScalar tickSeconds = GAMECLOCK_TICK_MS / 1000.0f;
+    for (int tick = 0; tick < numTicks; ++tick) {
+
+        // Push the players around. Forces only last for one
+        // stepSimulation(), so this has to happen every tick.
+        for (unsigned i = 0; i < mPlayers.size(); ++i)
+            HandleInputForPlayer(mPlayers[i]->GetPlayerID());
+
+        // BOF step physics. A whole number of fixed substeps fits in the
+        // tick, so Bullet never has any time left over to carry into the
+        // next one or to interpolate the motion states with.
+        dynamicsWorld->stepSimulation(tickSeconds, WORLDMODEL_SUBSTEPS_PER_TICK,
+                                      tickSeconds / WORLDMODEL_SUBSTEPS_PER_TICK);
+        // EOF step physics
+
+        // BOF update platform. The platform counts in ticks, and the falling
+        // ring's body has to keep up with it.
+        platform->update();
+        int fallingRing = platform->getFallingRing();
+        float fallingRingPos = platform->getFallingRingPos();
+        MoveRigidBody(platformRigidBodies[fallingRing], 0.0, fallingRingPos, 0.0);
+    }
 
-    // Loop over players
+    // Loop over players. We go by the bodies themselves rather than their
+    // motion states, which are only Bullet's guess at where they are for
+    // drawing.
     for(unsigned i = 0; i < mPlayers.size(); ++i){
         Player *player = mPlayers[i];
         assert(player);
-        HandleInputForPlayer(player->GetPlayerID());
-        btTransform trans;
-        mPlayerRigidBodies[player]->getMotionState()->getWorldTransform(trans);
+        const btTransform& trans = mPlayerRigidBodies[player]->getWorldTransform();
 
         Vector playerPos = trans.getOrigin();
-        Matrix playerRot = trans.getBasis();
-        player->setPosition(playerPos);
-        player->setRotation(playerRot);
+        Quaternion playerRot(trans.getRotation());
+        player->setPose(playerPos, playerRot, !resimulating);
     }
 
-    //std::cout << "sphere x: " << trans.getOrigin().getX() << std::endl;
-    // EOF step physics
-    
-    // BOF update platform
-    
-    // update platform position
-    platform->update();
-    
-    // move the platform rigid bodies along with the rings
-    int fallingRing = platform->getFallingRing();
-    std::cout << "falling ring: " << fallingRing << "\n";
-    float fallingRingPos = platform->getFallingRingPos();
-    MoveRigidBody(platformRigidBodies[fallingRing], 0.0, fallingRingPos, 0.0);
-
     /* Drawing should not happen in WorldModel.
 
     
@@ -186,79 +265,152 @@ WorldModel::Step(int numTicks, float deltaSeconds)
     mCurrentTimestamp += numTicks;
 }
 
+void
+WorldModel::SyncSceneGraph()
+{
+    for (unsigned i = 0; i < mPlayers.size(); ++i)
+        mPlayers[i]->updateTransform();
+}
+
 void
 WorldModel::GetState(WorldState& stateOut)
 {
-    std::vector<PlayerInfo> playerInfoVec;
+    // Fill in place, so that reusing a state doesn't allocate
+    std::vector<PlayerInfo>& playerInfoVec = stateOut.playerVec;
+    playerInfoVec.resize(mPlayers.size());
     for (size_t i=0; i<mPlayers.size(); i++) {
-        PlayerInfo playerInfo;
+        PlayerInfo& playerInfo = playerInfoVec[i];
         playerInfo.playerID = mPlayers[i]->GetPlayerID();
         playerInfo.activeInputs = mPlayers[i]->GetActiveInputs();
-        playerInfo.pos =  mPlayers[i]->getPosition();
-        playerInfoVec.push_back(playerInfo);
+        playerInfo.reserved[0] = playerInfo.reserved[1] = 0;
+        playerInfo.rotation = mPlayers[i]->getRotation();
+        btRigidBody* body = mPlayerRigidBodies[mPlayers[i]];
+        playerInfo.pos = body->getWorldTransform().getOrigin();
+        playerInfo.linearVelocity = body->getLinearVelocity();
+        playerInfo.angularVelocity = body->getAngularVelocity();
     }
-    stateOut.playerVec = playerInfoVec;
+    platform->getState(stateOut.platform);
     stateOut.timestamp = mCurrentTimestamp;
 }
 
 void
 WorldModel::SetState(WorldState& stateIn)
 {
-    std::vector<PlayerInfo> playerInfoVec = stateIn.playerVec;
+    std::vector<PlayerInfo>& playerInfoVec = stateIn.playerVec;
     for (size_t i=0; i< playerInfoVec.size(); i++) {
-        std::cout << "received: " << playerInfoVec[i].playerID << "\n";
-        Player* player = GetPlayer(playerInfoVec[i].playerID);
-        if (player == NULL) { // Add players to the client if they have not yet been added
-            AddPlayer(playerInfoVec[i].playerID);
+        PlayerInfo& info = playerInfoVec[i];
+        Player* player = GetPlayer(info.playerID);
+        const Quaternion& rotation = info.rotation;
+
+        // Add players to the client if they have not yet been added
+        if (player == NULL) {
+            AddPlayer(info.playerID, info.pos, rotation);
+            player = GetPlayer(info.playerID);
         }
-        //Vector playerPos = playerInfoVec[i].pos;
-        //player->moveTo(playerPos);
-        // HANDLE activeInputs!
+
+        // Put the rigid body back where the snapshot had it
+        btRigidBody* body = mPlayerRigidBodies[player];
+        btTransform transform;
+        transform.setOrigin(btVector3(info.pos.x, info.pos.y, info.pos.z));
+        transform.setRotation(rotation.ToBullet());
+        btVector3 linearVelocity(info.linearVelocity.x,
+                                 info.linearVelocity.y,
+                                 info.linearVelocity.z);
+        btVector3 angularVelocity(info.angularVelocity.x,
+                                  info.angularVelocity.y,
+                                  info.angularVelocity.z);
+        body->setWorldTransform(transform);
+        body->setInterpolationWorldTransform(transform);
+        body->getMotionState()->setWorldTransform(transform);
+        body->setLinearVelocity(linearVelocity);
+        body->setInterpolationLinearVelocity(linearVelocity);
+        body->setAngularVelocity(angularVelocity);
+        body->setInterpolationAngularVelocity(angularVelocity);
+        body->clearForces();
+
+        // And the model representation
+        player->setPose(info.pos, rotation);
+        player->setActiveInputs(info.activeInputs);
+    }
+
+    // Remove players who have left. Everybody in the state is here now, so
+    // if the counts match there's nobody extra.
+    for (unsigned i = mPlayers.size(); i > 0; --i) {
+        if (mPlayers.size() == playerInfoVec.size())
+            break;
+        unsigned playerID = mPlayers[i - 1]->GetPlayerID();
+        bool found = false;
+        for (size_t j = 0; j < playerInfoVec.size() && !found; ++j)
+            found = (playerInfoVec[j].playerID == playerID);
+        if (!found)
+            RemovePlayer(playerID);
     }
+
+    // Restore the platform
+    platform->setState(stateIn.platform);
+    SyncPlatformBodies();
+
+    // Bullet keeps track of any time it was given that didn't make up a
+    // whole substep. Step() never leaves any, but it's not part of the
+    // state, so make sure. A zero length variable step resets it without
+    // simulating anything.
+    dynamicsWorld->stepSimulation(0, 0);
+
     mCurrentTimestamp = stateIn.timestamp;
 }
 
-static float sInitialPositions[][3] = { {-8.0, 5.0, 0.0},
-                                        {-4.0, 5.0, 4.0} };
+Vector
+WorldModel::GenerateSpawnPosition(unsigned index)
+{
+    // We lay the players out on a sunflower spiral: each successive player
+    // is rotated by the golden angle, and pushed outwards so that every
+    // player covers the same area of the disc. This keeps neighbours well
+    // spaced for any number of players up to the maximum, without needing
+    // to know ahead of time how many will show up.
+    assert(index < WORLDMODEL_MAX_PLAYERS);
+    const float goldenAngle = 2.39996323f;
+    float radius = WORLDMODEL_SPAWN_RADIUS *
+                   sqrt((index + 0.5f) / WORLDMODEL_MAX_PLAYERS);
+    float theta = index * goldenAngle;
+
+    return Vector(radius * cos(theta), 5.0f, radius * sin(theta), 0.0f);
+}
+
+void
+WorldModel::SyncPlatformBodies()
+{
+    // Rings that have already fallen sit at the bottom of their drop, and
+    // the falling ring is wherever the platform says it is. The rings inside
+    // it haven't moved yet.
+    int fallingRing = platform->getFallingRing();
+    for (int i = 0; i < fallingRing; ++i)
+        MoveRigidBody(platformRigidBodies[i], 0.0, -DROP_DISTANCE, 0.0);
+    MoveRigidBody(platformRigidBodies[fallingRing], 0.0,
+                  platform->getFallingRingPos(), 0.0);
+}
 
 void
 WorldModel::AddPlayer(unsigned playerID)
 {
     // Generate the initial position.
-    //
-    // We only have enough initial positions for two players. This can be trivially
-    // fixed.
-    unsigned posIndex = mPlayers.size();
-    assert(posIndex <= 1);
-    Vector initialPosition(sInitialPositions[posIndex][0],
-                           sInitialPositions[posIndex][1],
-                           sInitialPositions[posIndex][2],
-                           0.0f);
-    Matrix initialRotation;
+    Vector initialPosition = GenerateSpawnPosition(mPlayers.size());
+    Quaternion initialRotation;
 
     // Call the internal helper
     AddPlayer(playerID, initialPosition, initialRotation);
 }
 
 void
-WorldModel::AddPlayer(unsigned playerID, Vector initialPosition, Matrix initialRotation)
+WorldModel::AddPlayer(unsigned playerID, Vector initialPosition, Quaternion initialRotation)
 {
     // Make sure we don't already have a player by this ID
     assert(GetPlayer(playerID) == NULL);
 
-    // Add the player to the scenegraph
-    stringstream numSS;
-    numSS << playerID;
-    string nodeName = string("PlayerNode_") + numSS.str();
-    string rootName = string("PlayerRoot_") + numSS.str();
-
-    // WARNING: Any transform you pass into AddNode is not used. Each
-    // Player object sets his own node's transform.
-    Matrix identityTransform;
-    SceneNode* playerNode = mSceneGraph->AddNode(&mSceneGraph->rootNode,
-                                                 identityTransform,
-                                                 nodeName.c_str());
-    mSceneGraph->LoadScene(SPHERE_PATH, rootName.c_str(), playerNode);
+    // Add the player to the scenegraph, if we have one and it's ours to
+    // update
+    SceneNode* playerNode = NULL;
+    if (mSceneGraph != NULL && !mRenderFromSnapshots)
+        playerNode = CreatePlayerNode(playerID);
 
     // Initialize the model representation of the player
     Player* player = new Player(playerID, playerNode, initialPosition, initialRotation);
@@ -270,7 +422,7 @@ WorldModel::AddPlayer(unsigned playerID, Vector initialPosition, Matrix initialR
     btCollisionShape* playerShape = new btSphereShape(1);
     mPlayerShapes[player] = playerShape;
     btDefaultMotionState* playerMotionState =
-    new btDefaultMotionState(btTransform(btQuaternion(0,0,0,1),
+    new btDefaultMotionState(btTransform(initialRotation.ToBullet(),
     btVector3(initialPosition.x,initialPosition.y,initialPosition.z)));
 
     btScalar playerMass = 1;
@@ -287,6 +439,111 @@ WorldModel::AddPlayer(unsigned playerID, Vector initialPosition, Matrix initialR
     dynamicsWorld->addRigidBody(playerRigidBody);
 }
 
+void
+WorldModel::RemovePlayer(unsigned playerID)
+{
+    vector<Player*>::iterator it = mPlayers.begin();
+    while (it != mPlayers.end() && (*it)->GetPlayerID() != playerID)
+        ++it;
+    assert(it != mPlayers.end());
+    Player* player = *it;
+    mPlayers.erase(it);
+
+    // Physics
+    btRigidBody* playerRigidBody = mPlayerRigidBodies[player];
+    dynamicsWorld->removeRigidBody(playerRigidBody);
+    delete playerRigidBody->getMotionState();
+    delete playerRigidBody;
+    delete mPlayerShapes[player];
+    mPlayerRigidBodies.erase(player);
+    mPlayerShapes.erase(player);
+
+    // Drawing. Snapshot nodes go in ApplySnapshot(), when the snapshots stop
+    // mentioning them.
+    if (player->GetSceneNode() != NULL)
+        mSceneGraph->rootNode.RemoveChild(player->GetSceneNode());
+
+    delete player;
+}
+
+SceneNode*
+WorldModel::CreatePlayerNode(unsigned playerID)
+{
+    assert(mSceneGraph);
+
+    stringstream numSS;
+    numSS << playerID;
+    string nodeName = string("PlayerNode_") + numSS.str();
+    string rootName = string("PlayerRoot_") + numSS.str();
+
+    // WARNING: Any transform you pass into AddNode is not used. Each
+    // Player object (or snapshot) sets the node's transform.
+    Matrix identityTransform;
+    SceneNode* playerNode = mSceneGraph->AddNode(&mSceneGraph->rootNode,
+                                                 identityTransform,
+                                                 nodeName.c_str());
+    mSceneGraph->LoadScene(SPHERE_PATH, rootName.c_str(), playerNode);
+    return playerNode;
+}
+
+void
+WorldModel::SetRenderFromSnapshots(bool enabled)
+{
+    assert(mPlayers.empty());
+    mRenderFromSnapshots = enabled;
+}
+
+void
+WorldModel::WriteSnapshot(RenderSnapshot& snapshotOut)
+{
+    snapshotOut.timestamp = mCurrentTimestamp;
+    snapshotOut.players.resize(mPlayers.size());
+    for (unsigned i = 0; i < mPlayers.size(); ++i) {
+        Player* player = mPlayers[i];
+        PlayerPose& pose = snapshotOut.players[i];
+        pose.playerID = player->GetPlayerID();
+        pose.position = player->getPosition();
+        pose.rotation = player->getRotation();
+    }
+}
+
+void
+WorldModel::ApplySnapshot(const RenderSnapshot& snapshot)
+{
+    assert(mSceneGraph && mRenderFromSnapshots);
+
+    for (unsigned i = 0; i < snapshot.players.size(); ++i) {
+        const PlayerPose& pose = snapshot.players[i];
+        SceneNode*& node = mSnapshotNodes[pose.playerID];
+        if (node == NULL)
+            node = CreatePlayerNode(pose.playerID);
+
+        // Same as Player::updateTransform()
+        Matrix translation;
+        translation.Translate(pose.position.x, pose.position.y,
+                              pose.position.z);
+        node->LoadIdentityTransform();
+        node->ApplyTransform(translation);
+        node->ApplyTransform(pose.rotation.ToMatrix());
+    }
+
+    // Remove the nodes of players who have left. Everybody in the snapshot
+    // has a node now, so if the counts match there's nobody extra.
+    std::map<unsigned, SceneNode*>::iterator it = mSnapshotNodes.begin();
+    while (mSnapshotNodes.size() > snapshot.players.size() &&
+           it != mSnapshotNodes.end()) {
+        bool found = false;
+        for (unsigned i = 0; i < snapshot.players.size() && !found; ++i)
+            found = (snapshot.players[i].playerID == it->first);
+        if (found) {
+            ++it;
+            continue;
+        }
+        mSceneGraph->rootNode.RemoveChild(it->second);
+        mSnapshotNodes.erase(it++);
+    }
+}
+
 Player*
 WorldModel::GetPlayer(unsigned playerID)
 {
@@ -303,9 +560,25 @@ WorldModel::GetPlayer(unsigned playerID)
 void
 WorldModel::ApplyInput(UserInput& input)
 {
-    // Get the player the input applies to
+    // Get the player the input applies to. Inputs can outlive their player,
+    // if it left while they were in flight.
     Player* player = GetPlayer(input.playerID);
-    assert(player);
+
+    // Players coming and going. A snapshot taken after the fact may
+    // already have dealt with it.
+    if (input.inputs & USERINPUT_JOIN) {
+        if (player == NULL)
+            AddPlayer(input.playerID);
+        return;
+    }
+    if (input.inputs & USERINPUT_LEAVE) {
+        if (player != NULL)
+            RemovePlayer(input.playerID);
+        return;
+    }
+
+    if (player == NULL)
+        return;
 
     // Apply it
     player->applyInput(input);
@@ -337,3 +610,159 @@ WorldModel::HandleInputForPlayer(unsigned playerID)
 }
 
 
+
+/*
+ * WorldState serialization.
+ *
+ * The wire format is a fixed header followed by one PlayerWireInfo per
+ * player. Like the rest of our network code, this assumes that both ends
+ * agree on struct packing and endianness.
+ */
+
+/*
+ * A PlayerInfo as we send it, with the rotation from Quaternion::Pack().
+ * Packing is lossy, so states that come off the wire are close to, but not
+ * exactly, what the sender had.
+ */
+struct PlayerWireInfo {
+    uint32_t playerID;
+    uint32_t activeInputs;
+
+    // Also keeps the vectors 16 byte aligned
+    uint64_t rotation;
+
+    Vector pos;
+    Vector linearVelocity;
+    Vector angularVelocity;
+};
+
+struct WorldStateHeader {
+    uint32_t timestamp;
+    uint32_t numPlayers;
+    PlatformState platform;
+};
+
+void
+WorldState::Serialize(std::vector<char>& bufferOut) const
+{
+    // Clear the padding too, so the same state always gives the same bytes
+    WorldStateHeader header;
+    memset(&header, 0, sizeof(header));
+    header.timestamp = timestamp;
+    header.numPlayers = playerVec.size();
+    header.platform = platform;
+
+    bufferOut.resize(sizeof(header) +
+                     playerVec.size() * sizeof(PlayerWireInfo));
+    memcpy(&bufferOut[0], &header, sizeof(header));
+    for (unsigned i = 0; i < playerVec.size(); ++i) {
+        const PlayerInfo& info = playerVec[i];
+        PlayerWireInfo wire;
+        wire.playerID = info.playerID;
+        wire.activeInputs = info.activeInputs;
+        wire.rotation = info.rotation.Pack();
+        wire.pos = info.pos;
+        wire.linearVelocity = info.linearVelocity;
+        wire.angularVelocity = info.angularVelocity;
+        memcpy(&bufferOut[sizeof(header) + i * sizeof(wire)], &wire,
+               sizeof(wire));
+    }
+}
+
+bool
+WorldState::Deserialize(const char* buffer, unsigned size)
+{
+    // Read the header
+    WorldStateHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, buffer, sizeof(header));
+
+    // Make sure the players are all there
+    if (size != sizeof(header) + header.numPlayers * sizeof(PlayerWireInfo) ||
+        header.numPlayers > WORLDMODEL_MAX_PLAYERS)
+        return false;
+
+    timestamp = header.timestamp;
+    platform = header.platform;
+    playerVec.resize(header.numPlayers);
+    for (unsigned i = 0; i < header.numPlayers; ++i) {
+        PlayerWireInfo wire;
+        memcpy(&wire, buffer + sizeof(header) + i * sizeof(wire),
+               sizeof(wire));
+        PlayerInfo& info = playerVec[i];
+        info.playerID = wire.playerID;
+        info.activeInputs = wire.activeInputs;
+        info.reserved[0] = info.reserved[1] = 0;
+        info.pos = wire.pos;
+        info.rotation = Quaternion::Unpack(wire.rotation);
+        info.linearVelocity = wire.linearVelocity;
+        info.angularVelocity = wire.angularVelocity;
+    }
+    return true;
+}
+
+/*
+ * WorldState checksums. We use FNV-1a over quantized values.
+ *
+ * Step() takes the same fixed steps everywhere, but peers still don't get
+ * bit-identical results: Bullet's contact caches and broadphase aren't part
+ * of the state, so a world that was rolled back carries on from different
+ * ones than a world that wasn't. Rounding hides those last few bits. It
+ * isn't airtight, since two values a hair apart can land on opposite sides
+ * of a rounding boundary, so the occasional mismatch between peers that
+ * really agree costs us a needless resync.
+ */
+
+static void
+HashInt(uint32_t& hash, int32_t value)
+{
+    for (unsigned i = 0; i < sizeof(value); ++i) {
+        hash ^= (value >> (8 * i)) & 0xFF;
+        hash *= 16777619u;
+    }
+}
+
+static void
+HashFloat(uint32_t& hash, float value)
+{
+    HashInt(hash, (int32_t) floor(value / WORLDSTATE_CHECKSUM_QUANTUM + 0.5f));
+}
+
+static void
+HashVector(uint32_t& hash, const Vector& v)
+{
+    HashFloat(hash, v.x);
+    HashFloat(hash, v.y);
+    HashFloat(hash, v.z);
+}
+
+uint32_t
+WorldState::Checksum() const
+{
+    // The platform
+    uint32_t hash = 2166136261u;
+    HashInt(hash, timestamp);
+    HashInt(hash, platform.dropTimer);
+    HashInt(hash, platform.dropCount);
+    HashInt(hash, platform.fallingRing);
+    HashInt(hash, platform.dropState);
+    HashFloat(hash, platform.dropY);
+
+    // The players. We add up their hashes so that their order doesn't
+    // matter. Rotations are left out, since the players are spheres.
+    uint32_t playerSum = 0;
+    for (unsigned i = 0; i < playerVec.size(); ++i) {
+        const PlayerInfo& info = playerVec[i];
+        uint32_t playerHash = 2166136261u;
+        HashInt(playerHash, info.playerID);
+        HashInt(playerHash, info.activeInputs);
+        HashVector(playerHash, info.pos);
+        HashVector(playerHash, info.linearVelocity);
+        HashVector(playerHash, info.angularVelocity);
+        playerSum += playerHash;
+    }
+    HashInt(hash, playerSum);
+
+    return hash;
+}
@@ -5,17 +5,50 @@
 #include "Platform.h"
 #include "GLDebugDrawer.h"
 #include "Player.h"
+#include "RenderSnapshot.h"
 #include <vector>
+#include <map>
 
 class SceneGraph;
 class UserInput;
 
-// struct containing information about a player
+// The most players we can place on the platform
+#define WORLDMODEL_MAX_PLAYERS 64
+
+// Radius of the disc that players are spawned in. This keeps everybody off
+// the outermost ring, but not off the ones after it: only the innermost
+// ring (radius 3) never falls, and that's too small for a full lobby, so
+// players have to work their way in as the rings drop.
+#define WORLDMODEL_SPAWN_RADIUS 12.0f
+
+// Bullet substeps per tick. Two keeps us close to Bullet's default 1/60 s
+// step, which is what the game was tuned with.
+#define WORLDMODEL_SUBSTEPS_PER_TICK 2
+
+// Upper limit on physics worker threads. Only used when built with
+// GROWBLES_BULLET_MT, against a Bullet built with BT_THREADSAFE.
+#define WORLDMODEL_MAX_PHYSICS_THREADS 64
+
+// Positions and velocities are rounded to a multiple of this before being
+// checksummed, so that differences in the last few bits don't count (see
+// WorldState::Checksum()).
+#define WORLDSTATE_CHECKSUM_QUANTUM 0.01f
+
+// struct containing information about a player. This is exactly what the
+// simulation had, so that rolling back to it changes nothing; rotations are
+// only packed down on the wire (see WorldState::Serialize()).
 struct PlayerInfo {
     unsigned playerID;
     uint32_t activeInputs;
+
+    // Keeps the vectors 16 byte aligned, with the same layout whether or
+    // not the compiler aligns them for us. Always zero.
+    uint32_t reserved[2];
+
     Vector pos;
-    Matrix rotation;
+    Quaternion rotation;
+    Vector linearVelocity;
+    Vector angularVelocity;
 };
 
 // Struct containing all mutable world state
@@ -23,13 +56,35 @@ struct WorldState {
 
     // We want some values here so that this structure
     // takes up room in order to test the network code.
-    WorldState() : dummy1(12), dummy2(33) {};
+    WorldState() : dummy1(12), dummy2(33), timestamp(0) {};
     unsigned dummy1;
     unsigned dummy2;
     std::vector<PlayerInfo> playerVec;
 
+    // State of the platform rings
+    PlatformState platform;
+
     // Timestamp of this worldstate
     unsigned timestamp;
+
+    /*
+     * Flattens the state into a buffer suitable for sending over the
+     * wire. The buffer is cleared first.
+     */
+    void Serialize(std::vector<char>& bufferOut) const;
+
+    /*
+     * Loads the state from a buffer generated by Serialize(). Returns
+     * false if the buffer is malformed.
+     */
+    bool Deserialize(const char* buffer, unsigned size);
+
+    /*
+     * Computes a cheap hash of everything that matters to the simulation,
+     * for comparing states between peers. Doesn't depend on the order of
+     * the players.
+     */
+    uint32_t Checksum() const;
 };
 
 class WorldModel {
@@ -39,26 +94,70 @@ class WorldModel {
     /*
      * Dummy constructor.
      */
-    WorldModel() : mCurrentTimestamp(0) {};
+    WorldModel() : mSceneGraph(NULL), mRenderFromSnapshots(false)
+                 , mCurrentTimestamp(0) {};
 
     /*
      * Initializes the world model.
      */
     void Init(SceneGraph& sceneGraph);
 
+    /*
+     * Initializes the world model without any scenegraph. The simulation
+     * runs exactly as usual, but nothing is ever drawn. Used for benchmarks
+     * and tools.
+     */
+    void InitHeadless();
+
+    /*
+     * If enabled, stepping the world never touches the scenegraph. Instead,
+     * whoever renders calls ApplySnapshot() with snapshots taken by
+     * WriteSnapshot(), which lets the simulation run on another thread.
+     * Must be set before any players are added.
+     */
+    void SetRenderFromSnapshots(bool enabled);
+
+    /*
+     * Fills in a snapshot of everything the renderer needs.
+     */
+    void WriteSnapshot(RenderSnapshot& snapshotOut);
+
+    /*
+     * Moves the scenegraph to match a snapshot, adding nodes for players we
+     * haven't drawn before and removing those of players who have left. This only touches the scenegraph, so the render
+     * thread can call it while another thread steps the world.
+     */
+    void ApplySnapshot(const RenderSnapshot& snapshot);
+
+    /*
+     * Sets how many threads step the physics simulation, for every world
+     * initialized after this. Bullet's task scheduler is shared by the whole
+     * process, so this is too. Defaults to 1, which runs everything on the
+     * calling thread as before.
+     *
+     * Only has an effect when built with GROWBLES_BULLET_MT.
+     */
+    static void SetPhysicsThreads(unsigned numThreads);
+
     /*
      * Destructor.
      */
     ~WorldModel();
 
     /*
-     * Steps the model forward in time. The bullet physics engine needs
-     * an exact amount of time in order to interpolate the state if it
-     * does not fall exactly on an integer timestep.
+     * Steps the model forward in time. Every tick is simulated separately,
+     * with the same fixed timestep, so the result doesn't depend on how the
+     * ticks are split up between calls or on how long they really took.
      * @param numTicks: number of timesteps to go forward
-     * @param deltaSeconds: exact amount of time to step forward in time
+     * @param resimulating: if true, only the simulation moves forward. The
+     *                      scenegraph is left alone until SyncSceneGraph().
      */
-    void Step(int numTicks, float deltaSeconds=-1);
+    void Step(int numTicks, bool resimulating=false);
+
+    /*
+     * Moves the scenegraph to match the players, after resimulating.
+     */
+    void SyncSceneGraph();
 
     /*
      * Get/Set world state. Allows for rewinding.
@@ -69,12 +168,20 @@ class WorldModel {
     /*
      * Adds a player to the world.
      *
-     * This places the players where it pleases, and as such should only
-     * be called on the server (where the world is generated). Everybody else
-     * should receive state dumps from the server.
+     * Where the player goes depends only on how many players there are
+     * already, so every peer that adds the same players in the same order
+     * puts them in the same places. Once the timeline is running, players
+     * should only be added by USERINPUT_JOIN inputs from the server.
      */
     void AddPlayer(unsigned playerID);
 
+    /*
+     * Removes a player from the world, along with its rigid body and
+     * scenegraph node. Like AddPlayer(), this happens through
+     * USERINPUT_LEAVE inputs from the server.
+     */
+    void RemovePlayer(unsigned playerID);
+
     /*
      * Gets a player by ID.
      *
@@ -83,7 +190,17 @@ class WorldModel {
     Player* GetPlayer(unsigned playerID);
 
     /*
-     * Applies inputs.
+     * Gets the number of players in the world.
+     */
+    unsigned GetNumPlayers() { return mPlayers.size(); };
+
+    /*
+     * Gets a player by index, for iterating over all of them.
+     */
+    Player* GetPlayerByIndex(unsigned index) { return mPlayers[index]; };
+
+    /*
+     * Applies inputs, including the server's joins and leaves.
      */
     void ApplyInput(UserInput& input);
 
@@ -94,19 +211,44 @@ class WorldModel {
 
     protected:
 
+    /*
+     * Sets up the physics simulation and the platform.
+     */
+    void InitPhysics();
+
+    /*
+     * Adds the scenegraph nodes for a player.
+     */
+    SceneNode* CreatePlayerNode(unsigned playerID);
+
     /*
      * Internal-only method. Adds a player at a specified position.
      */
-    void AddPlayer(unsigned playerID, Vector position, Matrix rotation);
+    void AddPlayer(unsigned playerID, Vector position, Quaternion rotation);
+
+    /*
+     * Generates the spawn position for the nth player to join.
+     */
+    static Vector GenerateSpawnPosition(unsigned index);
+
+    /*
+     * Moves the platform rigid bodies to match the platform state.
+     */
+    void SyncPlatformBodies();
 
     /*
      * Applies forces for the current inputs.
      */
     void HandleInputForPlayer(unsigned playerID);
 
-    // The scenegraph associated with this world
+    // The scenegraph associated with this world. NULL if we're headless.
     SceneGraph* mSceneGraph;
 
+    // Whether the scenegraph is only updated by ApplySnapshot(), and the
+    // player nodes it's added so far. The nodes belong to whoever renders.
+    bool mRenderFromSnapshots;
+    std::map<unsigned, SceneNode*> mSnapshotNodes;
+
     // The players
     std::vector<Player*> mPlayers;
     
@@ -117,7 +259,7 @@ class WorldModel {
     btBroadphaseInterface* broadphase;
     btDefaultCollisionConfiguration* collisionConfiguration;
     btCollisionDispatcher* dispatcher;
-    btSequentialImpulseConstraintSolver* solver;
+    btConstraintSolver* solver;
     btDiscreteDynamicsWorld* dynamicsWorld;
     // Physics properties of the platform
     std::vector<btCollisionShape*> platformShapes;
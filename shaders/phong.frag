@@ -1,6 +1,13 @@
 // This is a texture sampler.  It lets you sample textures!  The keyword
 // "uniform" means constant - sort of.  The uniform variables are the same
 // for all fragments in an object, but they can change in between objects.
+//
+// Which variant this is comes from #defines that RenderContext puts in
+// front of the source:
+// SHADOW_PASS: a depth-only shadow pass
+// RENDER_PARTICLES: we're rendering particles rather than triangles
+// MAP_NORMALS: we're doing normal mapping
+// MAP_ENVIRONMENT: we're doing environment mapping
 
 uniform sampler2D spriteMap; // Set to texture sampler 0
 uniform sampler2D diffuseMap; // Set to texture sampler 1
@@ -9,33 +16,31 @@ uniform sampler2D normalMap; // Set to texture sampler 3
 uniform sampler2D shadowMap; // Set to texture sampler 4
 uniform samplerCube envMap; // Set to texture sampler 5
 
-// Diffuse, ambient, and specular materials.  These are also uniform.
-uniform vec3 Kd;
-uniform vec3 Ks;
-uniform vec3 Ka;
-uniform float alpha;
+// Diffuse, ambient, and specular materials. These are also uniform. They
+// come in one block (see Material.h).
+uniform vec4 materialBlock[3];
+#define Ka materialBlock[0].rgb
+#define alpha materialBlock[0].a
+#define Kd materialBlock[1].rgb
+#define Ks materialBlock[2].rgb
+
+// The lights, in one block (see RenderContext.h). Four vectors per light:
+// eye space position, ambient, diffuse and specular.
+uniform vec4 lightBlock[8];
+#define lightPosition(i) lightBlock[4 * (i)]
+#define lightAmbient(i) lightBlock[4 * (i) + 1]
+#define lightDiffuse(i) lightBlock[4 * (i) + 2]
+#define lightSpecular(i) lightBlock[4 * (i) + 3]
 
 // We need the inverse view matrix for environment mapping
 uniform mat3 inverseViewMatrix;
 
-// Are we doing the shadow pass?
-uniform bool shadowPass;
-
-// Boolean telling us whether we're rendering particles rather than triangles
-uniform bool renderParticles;
-
 // Which type of particle are we rendering?
 // 1: fire
 // 2: smoke
 // 3: gun particles
 uniform int particleType;
 
-// Are we doing normal mapping?
-uniform bool mapNormals;
-
-// Are we doing environment mapping?
-uniform bool mapEnvironment;
-
 varying vec2 texcoord;
 varying vec3 normal;
 varying vec3 tangent;
@@ -44,6 +49,7 @@ varying vec3 eyePosition;
 varying vec3 lightspacePosition;
 varying float particleAge;
 
+#ifdef MAP_NORMALS
 vec3 mappedNormal() {
 
     // Sample the normal
@@ -56,6 +62,7 @@ vec3 mappedNormal() {
     mat3 tbn = mat3(tangent, bitangent, normal);
     return tbn * decompressed;
 }
+#endif
 
 vec3 shadeFromLight(in int lightNum, in vec3 N, in vec3 L, in vec3 V) {
 
@@ -66,28 +73,28 @@ vec3 shadeFromLight(in int lightNum, in vec3 N, in vec3 L, in vec3 V) {
 
     // Sample textures
     vec3 Td, Ts, Ta;
-    if (mapEnvironment) {
-        vec3 cubeCoords = vec3(inverseViewMatrix * reflect(-V, N));
-        Td = Ts = Ta = textureCube(envMap, cubeCoords).rgb;
-    }
-    else {
-        Td = texture2D(diffuseMap, texcoord).rgb;
-        Ts = texture2D(specularMap, texcoord).rgb;
-        Ta = vec3(1, 1, 1);
-    }
+#ifdef MAP_ENVIRONMENT
+    vec3 cubeCoords = vec3(inverseViewMatrix * reflect(-V, N));
+    Td = Ts = Ta = textureCube(envMap, cubeCoords).rgb;
+#else
+    Td = texture2D(diffuseMap, texcoord).rgb;
+    Ts = texture2D(specularMap, texcoord).rgb;
+    Ta = vec3(1, 1, 1);
+#endif
 
     // Calculate the diffuse color coefficient, and sample the diffuse texture
-    vec3 diffuse = Rd * Kd * Td * gl_LightSource[lightNum].diffuse.rgb;
+    vec3 diffuse = Rd * Kd * Td * lightDiffuse(lightNum).rgb;
 
     // Calculate the specular coefficient
-    vec3 specular = Rs * Ks * Ts * gl_LightSource[lightNum].specular.rgb;
+    vec3 specular = Rs * Ks * Ts * lightSpecular(lightNum).rgb;
 
     // Ambient is easy
-    vec3 ambient = Ka * Ta * gl_LightSource[lightNum].ambient.rgb;
+    vec3 ambient = Ka * Ta * lightAmbient(lightNum).rgb;
 
     return diffuse + specular + ambient;
 }
 
+#ifdef RENDER_PARTICLES
 float computeParticleAlpha(float age) {
 
     // Fire
@@ -111,36 +118,35 @@ float computeParticleAlpha(float age) {
         return 1.0;
     }
 }
+#endif
 
 void main() {
 
     // If we're doing the shadow pass, all we care about is the depth buffer,
     // which is taken care of automatically. Just write a solid color and be
     // done.
-    if (shadowPass) {
-        gl_FragColor = vec4(0.0, 1.0, 0.0, 1.0);
-        return;
-    }
+#if defined(SHADOW_PASS)
+    gl_FragColor = vec4(0.0, 1.0, 0.0, 1.0);
 
     // Particle rendering
-    if (renderParticles) {
-        vec4 texSample = texture2D(spriteMap,  gl_TexCoord[0].xy);
-        gl_FragColor = vec4(texSample.rgb, texSample.a * computeParticleAlpha(particleAge));
-        return;
-    }
+#elif defined(RENDER_PARTICLES)
+    vec4 texSample = texture2D(spriteMap,  gl_TexCoord[0].xy);
+    gl_FragColor = vec4(texSample.rgb, texSample.a * computeParticleAlpha(particleAge));
+
+#else
 
     // Do normal mapping, if enabled
-    vec3 N;
-    if (mapNormals)
-        N = normalize(mappedNormal());
-    else
-        N = normalize(normal);
+#ifdef MAP_NORMALS
+    vec3 N = normalize(mappedNormal());
+#else
+    vec3 N = normalize(normal);
+#endif
 
     // Calculate the view vector
     vec3 V = normalize(-eyePosition);
 
-    vec3 L0 = normalize(-gl_LightSource[0].position.xyz);
-    vec3 L1 = normalize(gl_LightSource[1].position.xyz - eyePosition);
+    vec3 L0 = normalize(-lightPosition(0).xyz);
+    vec3 L1 = normalize(lightPosition(1).xyz - eyePosition);
 
     // Determine if the vertex is in shadow for the directional light
     vec2 shadowCoord = vec2(lightspacePosition.x * 0.5 + 0.5,
@@ -154,4 +160,5 @@ void main() {
 
     // This actually writes to the frame buffer
     gl_FragColor = vec4(light0Contrib + light1Contrib, 1);
+#endif
 }
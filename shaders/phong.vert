@@ -1,4 +1,10 @@
 
+// Which variant this is comes from #defines that RenderContext puts in
+// front of the source:
+// SHADOW_PASS: a "dead simple" depth-only shadow pass
+// RENDER_PARTICLES: we're rendering particles rather than triangles
+// MAP_NORMALS, MAP_ENVIRONMENT: only matter to the fragment shader
+
 // These are the "input" to our shader.  They are read from the vertex
 // arrays that we specified in the C++ code.
 attribute vec3 positionIn;
@@ -11,15 +17,15 @@ attribute float particleAgeIn;
 // The model matrix, separate from the view matrix
 uniform mat4 modelMatrix;
 
+// The model-view, projection and normal matrices. We work these out
+// ourselves instead of using OpenGL's matrix stack.
+uniform mat4 modelViewMatrix;
+uniform mat4 projectionMatrix;
+uniform mat3 normalMatrix;
+
 // The light matrix
 uniform mat4 lightMatrix;
 
-// Boolean telling us whether we're doing a "dead simple" shadow pass
-uniform bool shadowPass;
-
-// Boolean telling us whether we're rendering particles rather than triangles
-uniform bool renderParticles;
-
 // Which type of particle are we rendering?
 // 1: fire
 // 2: smoke
@@ -38,6 +44,7 @@ varying vec3 eyePosition;
 varying vec3 lightspacePosition;
 varying float particleAge;
 
+#ifdef RENDER_PARTICLES
 float computeParticleBaseSize(float age) {
 
     // fire
@@ -55,6 +62,7 @@ float computeParticleBaseSize(float age) {
         return 0.3;
     }
 }
+#endif
 
 void main() {
 
@@ -67,38 +75,37 @@ void main() {
      * 3 - Light Projection
      *
      * Since we have 1 as modelMatrix and 2+3 as lightMatrix, we just ignore the
-     * modelview matrix here. Note that not setting this would normally be a
-     * problem since gl_NormalMatrix depends on gl_ModelView, but we don't care
-     * about normals for the shadow pass.
+     * modelview matrix here. It isn't even set during the shadow pass, and
+     * neither is the normal matrix, but we don't care about normals for the
+     * shadow pass.
      */
-    if (shadowPass) {
+#ifdef SHADOW_PASS
 
-        // Transform the vertex by the light modelview and the light projection.
-        gl_Position = lightMatrix * modelMatrix * vec4(positionIn, 1);
+    // Transform the vertex by the light modelview and the light projection.
+    // That's all for the shadow pass.
+    gl_Position = lightMatrix * modelMatrix * vec4(positionIn, 1);
 
-        // All done for the shadow pass
-        return;
-    }
+#else
 
     // Transform the vertex to get the eye-space position of the vertex
-    vec4 eyeTemp = gl_ModelViewMatrix * vec4(positionIn, 1);
+    vec4 eyeTemp = modelViewMatrix * vec4(positionIn, 1);
     eyePosition = eyeTemp.xyz;
 
     // Transform again to get the clip-space position.  The gl_Position
     // variable tells OpenGL where the vertex should go.
-    gl_Position = gl_ProjectionMatrix * eyeTemp;
+    gl_Position = projectionMatrix * eyeTemp;
 
     // particle handling
-    if (renderParticles) {
-        float baseSize = computeParticleBaseSize(particleAgeIn);
-        gl_PointSize = baseSize * (viewportWidth / (1.0 + length(eyePosition.xyz)));
-        particleAge = particleAgeIn;
-    }
+#ifdef RENDER_PARTICLES
+    float baseSize = computeParticleBaseSize(particleAgeIn);
+    gl_PointSize = baseSize * (viewportWidth / (1.0 + length(eyePosition.xyz)));
+    particleAge = particleAgeIn;
+#endif
 
     // Transform the normal and friends
-    normal = gl_NormalMatrix * normalIn;
-    tangent = gl_NormalMatrix * tangentIn;
-    bitangent = gl_NormalMatrix * bitangentIn;
+    normal = normalMatrix * normalIn;
+    tangent = normalMatrix * tangentIn;
+    bitangent = normalMatrix * bitangentIn;
 
     // If we're rendering particles, use the gl texture coordinates. Otherwise
     // use the attributes.
@@ -107,4 +114,6 @@ void main() {
     // Calculate the lightspace position. Bias all 3 coordinates into the
     // range [0, 1]
     lightspacePosition = (lightMatrix * modelMatrix * vec4(positionIn, 1)).xyz;
+
+#endif
 }